@@ -7,7 +7,7 @@ FILE="packets-01"
 CAPPATH="/tmp"
 
 while [ 1 ]; do
-  ./csvtools -d 5 -p -70 -P -2 -b -to -w ${CAPPATH}/test -k devices.csv ${CAPPATH}/${FILE}-old.csv -l ${CAPPATH}/${FILE}.csv
-  cp ${CAPPATH}/${FILE}.csv ${CAPPATH}/${FILE}-old.csv
+  # The previous power levels are kept in ${CAPPATH}/test-last.csv
+  ./csvtools -d 5 -p -70 -P -2 -b -to -w ${CAPPATH}/test -k devices.csv -l ${CAPPATH}/${FILE}.csv
   sleep 5
 done
@@ -0,0 +1,154 @@
+/*
+    Airodump CSV Tools
+    Reads the shared memory device list (--shm), see csvshm.h.
+    Copyright (C) 2013-2018 Christopher Bolduc
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "csvshm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CSVSHM_TRIES 1000 // before csvshmRead gives up with EAGAIN
+
+// Maps the segment again, as big as it is now
+static int csvshmMap (csvshm *s) {
+  struct stat st;
+  void *map;
+
+  if (fstat (s->fd, &st) != 0) return -1;
+  if ((size_t) st.st_size < CSVSHM_DEVS_OFF) {
+    errno = EINVAL;
+    return -1;
+  }
+  map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, s->fd, 0);
+  if (map == MAP_FAILED) return -1;
+  if (s->map) munmap ((void *) s->map, s->mapSize);
+  s->map = map;
+  s->mapSize = st.st_size;
+  return 0;
+}
+
+// Opens the segment csvtools --shm [name] writes
+// Returns 0, or -1 with errno set
+int csvshmOpen (csvshm *s, const char *name) {
+  const csvshmheader *h;
+
+  s->map = NULL;
+  s->mapSize = 0;
+  s->fd = shm_open (name, O_RDONLY, 0);
+  if (s->fd < 0) return -1;
+  if (csvshmMap (s) != 0) {
+    close (s->fd);
+    return -1;
+  }
+  h = (const csvshmheader *) s->map;
+  if (h->magic != CSVSHM_MAGIC || h->version != CSVSHM_VERSION || h->devSize != sizeof(csvshmdev)) {
+    csvshmClose (s);
+    errno = EPROTO;
+    return -1;
+  }
+  return 0;
+}
+
+// Copies the devices into v (its buffer is reused from one call to the
+// next), only returning once it has a copy csvtools didn't change under it
+// Returns 0, or -1 with errno set
+int csvshmRead (csvshm *s, csvshmview *v) {
+  const csvshmheader *h;
+  uint32_t seq;
+  size_t devsLen, need;
+  int tries;
+
+  for (tries = 0; tries < CSVSHM_TRIES; tries++) {
+    h = (const csvshmheader *) s->map;
+    seq = __atomic_load_n (&h->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+      sched_yield ();
+      continue;
+    }
+    v->hdr = *h;
+    v->hdr.seq = seq;
+    if (v->hdr.size > s->mapSize) {
+      // It grew
+      if (csvshmMap (s) != 0) return -1;
+      continue;
+    }
+    devsLen = (size_t) v->hdr.count * sizeof(csvshmdev);
+    need = devsLen + v->hdr.stringsLen;
+    if (CSVSHM_DEVS_OFF + devsLen > v->hdr.size || v->hdr.stringsOff + v->hdr.stringsLen > v->hdr.size) {
+      // Half written header
+      __atomic_thread_fence (__ATOMIC_ACQUIRE);
+      if (__atomic_load_n (&h->seq, __ATOMIC_RELAXED) == seq) {
+        errno = EPROTO;
+        return -1;
+      }
+      continue;
+    }
+    if (need > v->bufSize) {
+      free (v->buf);
+      v->buf = malloc (need + 1);
+      if (v->buf == NULL) {
+        v->bufSize = 0;
+        return -1;
+      }
+      v->bufSize = need;
+    }
+    memcpy (v->buf, s->map + CSVSHM_DEVS_OFF, devsLen);
+    memcpy ((char *) v->buf + devsLen, s->map + v->hdr.stringsOff, v->hdr.stringsLen);
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    if (__atomic_load_n (&h->seq, __ATOMIC_RELAXED) != seq) continue;
+
+    v->devs = (csvshmdev *) v->buf;
+    v->strings = (const char *) v->buf + devsLen;
+    // So a bad offset still gives a string
+    ((char *) v->buf)[need] = '\0';
+    return 0;
+  }
+  errno = EAGAIN;
+  return -1;
+}
+
+// Returns the string at off in a view (v)
+const char *csvshmString (const csvshmview *v, uint32_t off) {
+  if (off >= v->hdr.stringsLen) return "";
+  return v->strings + off;
+}
+
+// Writes a binary MAC as AA:BB:CC:DD:EE:FF to str (18 bytes)
+char *csvshmMac (const uint8_t *mac, char *str) {
+  snprintf (str, 18, "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  return str;
+}
+
+void csvshmViewFree (csvshmview *v) {
+  free (v->buf);
+  v->buf = NULL;
+  v->bufSize = 0;
+}
+
+void csvshmClose (csvshm *s) {
+  if (s->map) munmap ((void *) s->map, s->mapSize);
+  if (s->fd >= 0) close (s->fd);
+  s->map = NULL;
+  s->fd = -1;
+}
@@ -0,0 +1,117 @@
+/*
+    Airodump CSV Tools
+    Shared memory device list (--shm) and a library to read it.
+    Copyright (C) 2013-2018 Christopher Bolduc
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* With --shm [name], csvtools keeps every device it knows about in a POSIX
+ * shared memory segment, rewritten after each pass.  The segment is:
+ *
+ *   csvshmheader                      at 0
+ *   csvshmdev[count]                  at CSVSHM_DEVS_OFF
+ *   strings (ESSIDs, vendors, descs)  at stringsOff, each one ending in
+ *                                     \0, and each one there only once
+ *
+ * seq is odd while csvtools is writing.  A reader copies what it wants and
+ * then checks seq didn't change, so it never waits on csvtools or the
+ * other way round.  The segment only grows, and size says how big it is.
+ *
+ * Reading it (link with libcsvshm.a, and -lrt on older systems):
+ *
+ *   csvshm s;
+ *   csvshmview v = { 0 };
+ *   char mac[18];
+ *   uint32_t i;
+ *
+ *   if (csvshmOpen (&s, "/csvtools") != 0) ...
+ *   while (csvshmRead (&s, &v) == 0) {
+ *     for (i=0; i < v.hdr.count; i++)
+ *       printf ("%s %d %s\n", csvshmMac (v.devs[i].mac, mac), v.devs[i].power,
+ *         csvshmString (&v, v.devs[i].essid));
+ *     ...
+ *   }
+ *   csvshmViewFree (&v);
+ *   csvshmClose (&s);
+ *
+ * Only csvshmOpen and a csvshmRead after the segment grew make system
+ * calls.
+ */
+
+#ifndef CSVSHM_H
+#define CSVSHM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CSVSHM_MAGIC 0x4d485343 // "CSHM"
+#define CSVSHM_VERSION 1
+#define CSVSHM_DEVS_OFF 64
+
+// csvshmdev flags
+#define CSVSHM_AP 1 // an AP, otherwise a station
+#define CSVSHM_NEW 2 // not in the previous file or run (-n)
+#define CSVSHM_OLD 4 // in it (-o)
+#define CSVSHM_SELECTED 8 // shown by the last pass
+#define CSVSHM_KNOWN 16 // has a description from -k
+#define CSVSHM_LOCATED 32 // has a GPS position
+
+typedef struct csvshmheader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t seq; // odd while csvtools is writing
+  uint32_t count; // devices
+  uint64_t size; // bytes in the segment
+  uint64_t stringsOff;
+  uint32_t stringsLen;
+  uint32_t devSize; // sizeof(csvshmdev)
+  int64_t time; // when it was written, seconds since 1970
+} csvshmheader;
+
+typedef struct csvshmdev {
+  int64_t lastSeen; // seconds since 1970, 0 if unknown
+  uint8_t mac[6];
+  uint8_t bssid[6]; // an AP's own, or the AP a station is associated with, 0s if none
+  int16_t power;
+  int16_t maxPower;
+  uint32_t flags;
+  uint32_t essid; // offsets in the strings, 0 is ""
+  uint32_t vendor;
+  uint32_t desc;
+} csvshmdev;
+
+typedef struct csvshm {
+  int fd;
+  const unsigned char *map;
+  size_t mapSize;
+} csvshm;
+
+// A copy of the segment made by csvshmRead
+typedef struct csvshmview {
+  csvshmheader hdr;
+  csvshmdev *devs;
+  const char *strings;
+  void *buf;
+  size_t bufSize;
+} csvshmview;
+
+int csvshmOpen (csvshm *s, const char *name);
+int csvshmRead (csvshm *s, csvshmview *v);
+const char *csvshmString (const csvshmview *v, uint32_t off);
+char *csvshmMac (const uint8_t *mac, char *str);
+void csvshmViewFree (csvshmview *v);
+void csvshmClose (csvshm *s);
+
+#endif
@@ -18,9 +18,10 @@
 */
 
 #include "csvtools.h"
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
 
-#define MINTIME "0000-00-00 00:30:00"
-#define MAXTIME "0001-00-00 00:00:00"
 
 // Boolean Globals
 int onlyAddCommon;
@@ -31,6 +32,16 @@ int deltaSpecified;
 int text_brief;
 int timeMax;
 int timeMin;
+int showAPs;
+int showEnddevs;
+int nearQuery;
+int bboxQuery;
+int kmzOutput;
+int outputs; // OUT_ flags, the formats --out asks for
+int htmlView; // --html-view
+int showTrack;
+int heatmapKey;
+int heatmapMax;
 
 // Other Globals
 int sortBy;
@@ -39,11 +50,14 @@ int numInputFiles;
 int minPower;
 int maxPower;
 int minPowerDelta;
+int kmlTileSize;
+double trackTolerance;
+double heatmapRes;
 int mac_db_sz;
 int known_macs_sz;
 int ap_count;
 int sta_count;
-FILE *kmlFile, *textFile, *htmlFile, *csvFile;
+FILE *kmlFile, *textFile, *htmlFile, *csvFile, *jsonFile;
 macdb *mac_database, *known_macs, *known_ips;
 char *remoteserver;
 int remoteport;
@@ -53,6 +67,32 @@ int extraStaCt;
 aplist aptable[HASHTABLE_SZ];
 stalist statable[HASHTABLE_SZ];
 int collisions;
+char *filePrefix;
+char *gpsFile;
+char *knownMacsFile, *knownIPsFile;
+char *loadedKnownMacs, *loadedKnownIPs;
+int tableGeneration; // bumped when loadTables reads different known MAC/IP tables
+char *profilesFile;
+char *filterExpr;
+char *lastInputFile;
+int useLastState;
+int watchInterval;
+char *eventsTarget; // --events file, - or udp:host:port
+int departAfter; // --depart seconds
+long long lastStateTime; // when [prefix]-last.csv was written, 0 if unknown
+char *execCommand; // --exec
+char *soundFile; // --sound
+int execMax; // --exec-max
+int execDebounce; // --exec-debounce seconds
+int execRate; // --exec-rate per minute
+char *querySocket; // --query-socket
+char *shmName; // --shm
+char *metricsTarget; // --metrics file or :port
+char *traceFile; // --trace
+int statsFormat; // --stats, STATS_TEXT or STATS_JSON, 0 for none
+long long counters[COUNTER_COUNT]; // see metrics.c
+double nearLat, nearLon, nearRadius;
+double bbox[4];
 
 int compareApByMac ( const void *p1, const void *p2 ) {
   const ap *ap1 = (ap*) p1;
@@ -172,35 +212,35 @@ int charToHex( char c ) {
 int getMacHash ( const char *mac ) {
   int hash, ret;
   if (strlen(mac) < 17) {
-    if (verbosity >= 2) fprintf (stderr, "getMacHash: Malformed MAC address %s (too short)\n", mac);
+    TRACE (TRACE_BAD_MAC, mac, 17);
     return -1;
   }
   ret = charToHex( mac[16] );
   if (ret == -1) {
-    if (verbosity >= 2) fprintf (stderr, "getMacHash: Malformed MAC address %s (char 16)\n", mac);
+    TRACE (TRACE_BAD_MAC, mac, 16);
     return -1;
   }
   hash = ret;
   ret = charToHex( mac[15] );
   if (ret == -1) {
-    if (verbosity >= 2) fprintf (stderr, "getMacHash: Malformed MAC address %s (char 15)\n", mac);
+    TRACE (TRACE_BAD_MAC, mac, 15);
     return -1;
   }
   hash += ret << 4;
   ret = charToHex( mac[13] );
   if (ret == -1) {
-    if (verbosity >= 2) fprintf (stderr, "getMacHash: Malformed MAC address %s (char 13)\n", mac);
+    TRACE (TRACE_BAD_MAC, mac, 13);
     return -1;
   }
   hash += ret << 8;
   ret = charToHex( mac[12] );
   if (ret == -1) {
-    if (verbosity >= 2) fprintf (stderr, "getMacHash: Malformed MAC address %s (char 12)\n", mac);
+    TRACE (TRACE_BAD_MAC, mac, 12);
     return -1;
   }
   hash += ret << 12;
   if (hash > HASHTABLE_SZ || hash < 0) {
-    if (verbosity >= 2) fprintf (stderr, "getMacHash: Hash > HASHTABLE_SZ or < 0 MAC: %s\n", mac);
+    TRACE (TRACE_BAD_MAC, mac, 0);
     return -1;
   }
 //  printf ("getMacHash: returning hash of %d\n", hash);
@@ -208,14 +248,12 @@ int getMacHash ( const char *mac ) {
 }
 
 int addApToHT(aplist *ht, ap *a) {
-  if (verbosity >= 2) printf ("addApToHT: Adding %s\n", a->bssid);
+  int chain = 1;
   int hash = getMacHash(a->bssid);
-  if (hash == -1) {
-    if (verbosity >= 2) fprintf (stderr, "addApToHT: getMacHash returned error\n");
-    return -1;
-  }
+  if (hash == -1) return -1;
   aplist *list1 = ht + hash;
   if (list1->data == NULL) {
+    TRACE (TRACE_AP_ADD, a->bssid, 0);
 //    list1 = (aplist *) malloc(sizeof(aplist)); // already alloc'ed
 //    if (list1 == NULL) return -1;
     list1->data = a;
@@ -225,22 +263,23 @@ int addApToHT(aplist *ht, ap *a) {
   }
   while (list1->next != NULL) {
     list1 = list1->next;
+    chain++;
   }
+  TRACE (TRACE_AP_ADD, a->bssid, chain);
   list1->next = (aplist *) malloc(sizeof(aplist));
   if (list1->next == NULL) return -1;
+  memAdd (MEM_HASH, sizeof(aplist));
   list1->next->data = a;
   list1->next->next = NULL;
   return 0;
 }
 
 ap *findApHT (aplist *aps, const char *mac) {
-  if (verbosity >= 2) printf("findApHT: looking for %s\n", mac);
+  int probes = 0;
   int hash = getMacHash(mac);
-  if (hash == -1) {
-    if (verbosity >= 2) fprintf (stderr, "findApHT: getMacHash returned error\n");
-    return NULL;
-  }
+  if (hash == -1) return NULL;
   aplist *list1 = aps + hash;
+  counters[COUNTER_HASH_LOOKUPS]++;
 /* not possible
   if (list1 == NULL) {
     fprintf (stderr, "findAp: hash for this entry is null (%s)\n", mac);
@@ -248,29 +287,27 @@ ap *findApHT (aplist *aps, const char *mac) {
   }
 */
   while (list1 != NULL) {
-    if (list1->data == NULL) {
-      if (verbosity >= 2) printf("findApHT: not found 1\n");
-      return NULL; // not found - array gets alloc'ed even if we don't want it to
-    }
+    if (list1->data == NULL) break; // not found - array gets alloc'ed even if we don't want it to
+    counters[COUNTER_HASH_PROBES]++;
+    probes++;
 //    printf("Comparing %s to %s\n", mac, list1->data->bssid);
     if (strcmp(mac, list1->data->bssid) == 0) {
-//      printf("findApHT: found\n");
+      TRACE (TRACE_AP_HIT, mac, probes);
       return list1->data;
     }
     list1 = list1->next;
   }
+  TRACE (TRACE_AP_MISS, mac, probes);
   return NULL; // not found
 }
 
 int addStaToHT(stalist *ht, enddev *e) {
-  if (verbosity >= 2) printf ("addStaToHT: Adding %s\n", e->station_mac);
+  int chain = 1;
   int hash = getMacHash(e->station_mac);
-  if (hash == -1) {
-    if (verbosity >= 2) fprintf (stderr, "addStaToHT: getMacHash returned error\n");
-    return -1;
-  }
+  if (hash == -1) return -1;
   stalist *list1 = ht + hash;
   if (list1->data == NULL) {
+    TRACE (TRACE_STA_ADD, e->station_mac, 0);
 //    list1 = (aplist *) malloc(sizeof(aplist)); // already alloc'ed
 //    if (list1 == NULL) return -1;
     list1->data = e;
@@ -280,9 +317,12 @@ int addStaToHT(stalist *ht, enddev *e) {
   }
   while (list1->next != NULL) {
     list1 = list1->next;
+    chain++;
   }
+  TRACE (TRACE_STA_ADD, e->station_mac, chain);
   list1->next = (stalist *) malloc(sizeof(stalist));
   if (list1->next == NULL) return -1;
+  memAdd (MEM_HASH, sizeof(stalist));
   list1->next->data = e;
   list1->next->next = NULL;
 //  printf("addStaToHT: added %s to additional node\n", e->station_mac);
@@ -290,13 +330,11 @@ int addStaToHT(stalist *ht, enddev *e) {
 }
 
 enddev *findStaHT (stalist *stl, const char *mac) {
-  if (verbosity >= 2) printf("findStaHT: looking for %s\n", mac);
+  int probes = 0;
   int hash = getMacHash(mac);
-  if (hash == -1) {
-    if (verbosity >= 2) fprintf (stderr, "findStaHT: getMacHash returned error\n");
-    return NULL;
-  }
+  if (hash == -1) return NULL;
   stalist *list1 = stl + hash;
+  counters[COUNTER_HASH_LOOKUPS]++;
 /* not possible
   if (list1 == NULL) {
     fprintf (stderr, "findAp: hash for this entry is null (%s)\n", mac);
@@ -304,20 +342,19 @@ enddev *findStaHT (stalist *stl, const char *mac) {
   }
 */
   while (list1 != NULL) {
-    if (list1->data == NULL) {
-      if (verbosity>=2) printf("findStaHT: not found 1 - %s\n", mac);
-      return NULL; // not found - array gets alloc'ed even if we don't want it to
-    }
+    if (list1->data == NULL) break; // not found - array gets alloc'ed even if we don't want it to
+    counters[COUNTER_HASH_PROBES]++;
+    probes++;
 //    printf("Comparing %s to %s\n", mac, list1->data->station_mac);
     if (strcmp(mac, list1->data->station_mac) == 0) {
-//      printf("findStaHT: found %s\n", mac);
+      TRACE (TRACE_STA_HIT, mac, probes);
       return list1->data;
     }
 //    printf ("Hash collision on %s (%s)\n", list1->data->station_mac, mac);
     collisions++;
     list1 = list1->next;
   }
-  if (verbosity>=2) printf("findStaHT: not found 2 - %s\n", mac);
+  TRACE (TRACE_STA_MISS, mac, probes);
   return NULL; // not found
 }
 
@@ -437,6 +474,19 @@ void dateDiff (datetime *delta, const datetime *d1, const datetime *d2) {
   }
 }
 
+// Seconds since 1970-01-01 00:00:00 for a datetime (no time zones)
+long long dateToSeconds (const datetime *d) {
+  // Days from the civil calendar, shifted so the year starts in March
+  long long y = d->year - (d->month <= 2);
+  long long era = (y >= 0 ? y : y - 399) / 400;
+  long long yoe = y - era * 400;
+  long long doy = (153 * (d->month + (d->month > 2 ? -3 : 9)) + 2) / 5 + d->day - 1;
+  long long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  long long days = era * 146097 + doe - 719468;
+
+  return days * 86400 + d->hour * 3600 + d->minute * 60 + d->second;
+}
+
 // Returns 1 if d1 > d2, -1 if d2 > d1, 0 if equal
 int compareDates (datetime *d1, datetime *d2) {
   if (d1->year > d2->year) return 1;
@@ -456,10 +506,10 @@ int compareDates (datetime *d1, datetime *d2) {
 
 void getNowStr(char * buffer) {
   time_t timer;
-  struct tm* tm_info;
+  struct tm tm_buf, *tm_info;
 
   time(&timer);
-  tm_info = localtime(&timer);
+  tm_info = localtime_r(&timer, &tm_buf);
   strftime(buffer, 26, "%Y-%m-%d %H:%M:%S", tm_info);
 
 }
@@ -518,10 +568,10 @@ char *dateHumanLong(const datetime *d, char *str) {
 int compareToNow (const char *lastTimeSeen, const char *thresh) {
   time_t timer;
   char buffer[26];
-  struct tm* tm_info;
+  struct tm tm_buf, *tm_info;
 
   time(&timer);
-  tm_info = localtime(&timer);
+  tm_info = localtime_r(&timer, &tm_buf);
   strftime(buffer, 26, "%Y-%m-%d %H:%M:%S", tm_info);
 
   // Only show devices where last_time_seen was 30 minutes ago or less
@@ -585,6 +635,7 @@ void free_ht_sta (stalist *sts) {
 void free_gps (gps *g) {
   if (g == NULL) return;
   free_gps(g->next);
+  memSub (MEM_GPS, sizeof(gps));
   free(g);
 }
 
@@ -615,73 +666,6 @@ int isValidMacAddress(const char* mac) {
     return (i == 12 && (s == 5 || s == 0));
 }
 
-int send_info_udp(char *hostname, int portno, char *msg) {
-    int sockfd, n;
-    int serverlen;
-    struct sockaddr_in serveraddr;
-    struct hostent *server;
-
-    if (msg == NULL) {
-      fprintf(stderr, "send_info_udp err: msg null\n");
-      return 1;
-    }
-
-    /* socket: create the socket */
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd < 0)
-        error("ERROR opening socket");
-
-    /* gethostbyname: get the server's DNS entry */
-    server = gethostbyname(hostname);
-    if (server == NULL) {
-        fprintf(stderr,"ERROR, no such host as %s\n", hostname);
-        return 1;
-    }
-
-    /* build the server's Internet address */
-    bzero((char *) &serveraddr, sizeof(serveraddr));
-    serveraddr.sin_family = AF_INET;
-    bcopy((char *)server->h_addr, (char *)&serveraddr.sin_addr.s_addr, server->h_length);
-//    serveraddr.sin_addr.s_addr = htonl(INADDR_BROADCAST);
-    serveraddr.sin_port = htons(portno);
-
-    /* send the message to the server */
-    serverlen = sizeof(serveraddr);
-    n = sendto(sockfd, msg, strlen(msg), 0, (const struct sockaddr *) &serveraddr, (socklen_t) serverlen);
-    if (n < 0)
-      error("ERROR in sendto");
-
-    return 0;
-}
-
-// http://cboard.cprogramming.com/linux-programming/105923-c-program-play-sound.html
-// 2015-08-18
-void play_sound (char *path) {
-  pid_t x;      // a special kind of int
-//  char kil[20] = "kill -s 9 ";
-
-  x = fork();   /* now there's actually two "x"s:
-if fork succeeds, "x" to the CHILD PROCESS is the return value of fork (0)
-and "x" to the PARENT PROCESS is the actual system pid of the child process.*/
-
-  if (x < 0) {  // just in case fork fails 
-    puts("fork failure");
-    return;
-  }
-  else if (x == 0) { // therefore this block will be the child process 
-    execlp("mpg123", "mpg123", "-q", path, (char *)NULL);
-  }
-/*                   // see GNU docs, "system" also works                
-  else {
-    printf("from parent: mpg123 is pid %d\nENTER to quit\n", x);
-    sprintf(kil,"%s%d",kil,x);
-    getchar();  // wait for user input
-    system(kil);
-    printf("All ");
-  }
-*/
-}
-
 // This is a separate function from getWord in case the ESSID has commas in it
 long getEssid(char *currWord, char *buffer, long i, long lSize) {
   long lastComma = 0;
@@ -706,7 +690,6 @@ long getEssid(char *currWord, char *buffer, long i, long lSize) {
     j++;
   }
   i++;
-  j++;
   currWord[j] = '\0';
   return i;
 }
@@ -821,7 +804,7 @@ void printAPPowerToFileRec (ap *a, FILE *f) {
     fprintf(f, "%s", CRLF);
     return;
   }
-  if (verbosity >= 2) printf("Printing AP Power to file: %s\n", a->bssid);
+  TRACE (TRACE_AP_POWER_OUT, a->bssid, 0);
   printAPPowerToFile (a, f);
 
   result = ferror (f);
@@ -882,6 +865,8 @@ char *readFileToString(FILE *pFile, long *sz) {
     fputs ("Reading error\n", stderr);
     exit(3);
   }
+  counters[COUNTER_BYTES_READ] += lSize;
+  memAdd (MEM_PARSER, lSize);
 //  fclose(pFile);
   *sz = lSize;
   return buffer;
@@ -918,7 +903,6 @@ void readAPPowerFromFile (ap *first, FILE *f) {
       i++;
       j++;
     }
-    if (verbosity>=2) printf ("bssid: %s ", bssid);
     while (buffer[i] == ' ') i++;
     j=0;
     while (i<lSize) {
@@ -937,7 +921,6 @@ void readAPPowerFromFile (ap *first, FILE *f) {
       j++;
     }
     power = atoi(pwrbuf);
-    if (verbosity>=2)  printf ("pwr: %d ", power);
     j=0;
     while (buffer[i] == ' ') i++;
     while (i<lSize) {
@@ -952,15 +935,16 @@ void readAPPowerFromFile (ap *first, FILE *f) {
       j++;
     }
     while (buffer[i] == ' ' || buffer[i] == '\r' || buffer[i] == '\n') i++;
-    if (verbosity>=2) printf ("time: %s\n", time);
 //    if (bssid[0] != '(') { // (not associated)
       curr = findApHT (aptable, bssid);
+      TRACE (TRACE_AP_POWER, bssid, curr != NULL);
       if (curr != NULL) {
         curr->maxPwrLevel = power;
         strcpy(curr->maxPwrTime, time);
       }
 //    }
   }
+  memSub (MEM_PARSER, lSize);
   free (buffer);
 }
 
@@ -995,7 +979,6 @@ void readEnddevPowerFromFile (enddev *first, FILE *f) {
       i++;
       j++;
     }
-    if (verbosity>=2) printf ("mac: %s ", mac);
     while (buffer[i] == ' ') i++;
     j=0;
     while (i<lSize) {
@@ -1014,7 +997,6 @@ void readEnddevPowerFromFile (enddev *first, FILE *f) {
       j++;
     }
     power = atoi(pwrbuf);
-    if (verbosity>=2) printf ("pwr: %d ", power);
     j=0;
     while (buffer[i] == ' ') i++;
     while (i<lSize) {
@@ -1029,18 +1011,17 @@ void readEnddevPowerFromFile (enddev *first, FILE *f) {
       j++;
     }
     while (buffer[i] == ' ' || buffer[i] == '\r' || buffer[i] == '\n') i++;
-    if (verbosity>=2) printf ("time: %s\n", time);
 //    curr = findEnddevByMAC (first, mac);
     curr = findStaHT (statable, mac);
+    TRACE (TRACE_STA_POWER, mac, curr != NULL);
     if (curr != NULL) {
 //      printf("Found station %s\n", mac);
       curr->maxPwrLevel = power;
       strcpy(curr->maxPwrTime, time);
-    } else {
-      if (verbosity>=2) printf("findStaHT - %s - not found\n", mac);
     }
   }
 
+  memSub (MEM_PARSER, lSize);
   free (buffer);
 }
 
@@ -1057,7 +1038,7 @@ void printEndDevicesDisplayedToFile (enddev *e, FILE *f) {
       continue;
     }
     fprintf (f, "%s, %s, %s%s", curr->station_mac, curr->last_time_displayed, curr->essid, CRLF);
-    if (verbosity >= 2) printf ("printEndDevicesDisplayedToFile: %s, %s, %s\n", curr->station_mac, curr->last_time_displayed, curr->essid);
+    TRACE (TRACE_PRINTED_OUT, curr->station_mac, 0);
     result = ferror (f);
     if (result) {
       printf ("printEndDevicesDisplayedToFile fprintf returned error: %d\n", result);
@@ -1067,7 +1048,7 @@ void printEndDevicesDisplayedToFile (enddev *e, FILE *f) {
   }
   for (i=0; i < extraStaCt; i++) {
     fprintf (f, "%s, %s, %s%s", extraSta[i].mac, extraSta[i].vendor, extraSta[i].essid, CRLF);
-    if (verbosity >= 2) printf ("printEndDevicesDisplayedToFile EXTRA: %s, %s, %s\n", extraSta[i].mac, extraSta[i].vendor, extraSta[i].essid);
+    TRACE (TRACE_PRINTED_OUT, extraSta[i].mac, 1);
     result = ferror (f);
     if (result) {
       printf ("printEndDevicesDisplayedToFile fprintf returned error: %d\n", result);
@@ -1077,6 +1058,8 @@ void printEndDevicesDisplayedToFile (enddev *e, FILE *f) {
   fprintf(f, "%s", CRLF);
 }
 
+static long extraStaBytes; // allocated for extraSta
+
 void readEnddevDisplayedFromFile (enddev *first, FILE *f) {
   enddev *curr;
   char mac[80];
@@ -1098,7 +1081,12 @@ void readEnddevDisplayedFromFile (enddev *first, FILE *f) {
     i++;
   }
   if (verbosity >=2) printf ("readEnddevDisplayedFromFile: Allocating memory for extraSta\n");
-  extraSta = (macdb*) malloc (sizeof(macdb) * nLines);
+  memSub (MEM_STATE, extraStaBytes);
+  free (extraSta); // from the last run (--watch)
+  extraStaCt = 0;
+  extraStaBytes = sizeof(macdb) * (nLines + 1);
+  extraSta = (macdb*) malloc (extraStaBytes);
+  memAdd (MEM_STATE, extraStaBytes);
   i=0;
   while (i<lSize) {
     j=0;
@@ -1110,6 +1098,8 @@ void readEnddevDisplayedFromFile (enddev *first, FILE *f) {
       }
       else if (buffer[i] == '\r' || buffer[i] == '\n') {
         fprintf (stderr, "readEnddevDisplayedFromFile: Error: unexpected EOL for mac %s\n", mac);
+        memSub (MEM_PARSER, lSize);
+        free (buffer);
         return;
       }
       else
@@ -1117,7 +1107,6 @@ void readEnddevDisplayedFromFile (enddev *first, FILE *f) {
       i++;
       j++;
     }
-    if (verbosity>=2) printf ("readEnddevDisplayedFromFile: mac: %s ", mac);
 //    while (buffer[i] == ' ') i++; // why is this here?
     j=0;
     int atEnd=0;
@@ -1136,7 +1125,6 @@ void readEnddevDisplayedFromFile (enddev *first, FILE *f) {
       i++;
       j++;
     }
-    if (verbosity>=2) printf ("time: %s\n", time);
     essid[0]='\0'; // possibly blank
     if (!atEnd) {
       // additional parameter: essid
@@ -1174,6 +1162,7 @@ void readEnddevDisplayedFromFile (enddev *first, FILE *f) {
     }
 //    curr = findEnddevByMAC (first, mac);
     curr = findStaHT (statable, mac);
+    TRACE (TRACE_PRINTED, mac, curr != NULL);
     if (curr != NULL) {
 //      printf("found %s\n", mac);
       strcpy(curr->last_time_displayed, time);
@@ -1187,26 +1176,96 @@ void readEnddevDisplayedFromFile (enddev *first, FILE *f) {
       strcpy(extraSta[extraStaCt].vendor, time);
       strcpy(extraSta[extraStaCt].essid, essid);  // I don't think this matters
       extraStaCt++;
-      if (verbosity >= 2) fprintf (stdout, "Added extra station LTD: %s MAC: %s\n", time, mac);
     }
   }
+  memSub (MEM_PARSER, lSize);
+  free (buffer);
   if (verbosity >= 2) printf ("readEnddevDisplayedFromFile: End of function\n");
 }
 
+// Prints the power and last time seen of every AP and Enddev to a file (f)
+// so the next run can work out -d, -n and -o from just the -l file
+void printLastToFile (ap *firstAp, enddev *firstEnddev, FILE *f) {
+  ap *a;
+  enddev *e;
+  char nowstr[26];
+
+  // When this was written, for --events
+  getNowStr (nowstr);
+  fprintf (f, "NOW, -, 0, %s%s", nowstr, CRLF);
+  for (a = firstAp; a != NULL; a = a->next)
+    fprintf (f, "AP, %s, %d, %s%s", a->bssid, a->power, a->last_time_seen, CRLF);
+  for (e = firstEnddev; e != NULL; e = e->next)
+    fprintf (f, "STA, %s, %d, %s%s", e->station_mac, e->power, e->last_time_seen, CRLF);
+}
+
+// Reads a file written by printLastToFile as if it were an older csv file:
+// devices in it are old (with their previous power), the rest are new
+void readLastFromFile (FILE *f) {
+  char line[256];
+  char type[8];
+  char mac[80];
+  char lts[80];
+  int power;
+  ap *a;
+  enddev *e;
+
+  while (fgets (line, sizeof(line), f) != NULL) {
+    if (sscanf (line, "%7[^,], %79[^,], %d, %79[^\r\n]", type, mac, &power, lts) != 4) continue;
+    if (strcmp(type, "NOW") == 0) {
+      datetime d;
+      if (strToTime (&d, lts)) lastStateTime = dateToSeconds (&d);
+    } else if (strcmp(type, "AP") == 0) {
+      a = findApHT (aptable, mac);
+      if (a == NULL) continue;
+      a->new = 0;
+      a->old = 1;
+      a->oldPower = power;
+      strcpy (a->prev_last_time_seen, lts);
+    } else {
+      e = findStaHT (statable, mac);
+      if (e == NULL) continue;
+      e->new = 0;
+      e->old = 1;
+      e->oldPower = power;
+      strcpy (e->prev_last_time_seen, lts);
+    }
+  }
+}
+
+// Gets the devices ready for the -l file to be read again (--watch)
+// What was the last file becomes the older file
+void startNextRead (ap *firstAp, enddev *firstEnddev) {
+  ap *a;
+  enddev *e;
+
+  for (a = firstAp; a != NULL; a = a->next) {
+    a->new = a->old = 0;
+    strcpy (a->prev_last_time_seen, a->last_time_seen);
+  }
+  for (e = firstEnddev; e != NULL; e = e->next) {
+    e->new = e->old = 0;
+    strcpy (e->prev_last_time_seen, e->last_time_seen);
+  }
+}
+
 gps *readGPSFile (ap *firstap, enddev *firsted, FILE *f) {
   gps *g, *g1, *gprev;
   int result;
 
   gprev = g = g1 = (gps *) malloc (sizeof(gps));
+  memAdd (MEM_GPS, sizeof(gps));
 
   while (1) {
     result = fscanf (f, "%d-%d-%d %d:%d:%d, %lf, %lf\r\n", &(g->dt.year), &(g->dt.month), &(g->dt.day), &(g->dt.hour), &(g->dt.minute), &(g->dt.second), &(g->lat), &(g->lon));
     if (result == EOF) {
       gprev->next = NULL;
+      memSub (MEM_GPS, sizeof(gps));
       free(g);
       return g1;
     }
     g->next = (gps *) malloc (sizeof(gps));
+    memAdd (MEM_GPS, sizeof(gps));
     gprev = g;
     g = g->next;
   }
@@ -1281,18 +1340,24 @@ void addGPSInfo (ap *firstap, enddev *firsted, gps *firstg) {
   }
 }
 
+// Returns 1 if the AP (a) belongs in the KML output
+int showAPInKML (ap *a) {
+  return a->selected && a->lat != 0.0; // no GPS data
+}
+
 // Prints a single AP (a) to a file (f)
 void printAPToFileKML (ap *a, FILE *f) {
-  if (a->power < minPower) return;
-  if (a->power > maxPower) return;
-  if (a->lat == 0.0) return; // no GPS data
-  if (onlyShowKnown && strcmp(a->desc, "") == 0) return;
+  char vendor[80];
+
+  if (!showAPInKML(a)) return;
+  // A copy, so the other outputs keep the real name
+  str_replace (strcpy (vendor, a->vendor), '&', ' ');
   fprintf(f, "<Placemark>%s"
     "<name>%s (%s)</name>%s"
-    "<description>%s", CRLF, strcmp(a->desc, "") == 0 ? a->essid : a->desc, str_replace(a->vendor, '&', ' '), CRLF, CRLF);
+    "<description>%s", CRLF, strcmp(a->desc, "") == 0 ? a->essid : a->desc, vendor, CRLF, CRLF);
   fprintf (f, "Description: %s%s", a->desc, CRLF);
   fprintf (f, "BSSID: %s%s", a->bssid, CRLF);
-  fprintf (f, "Vendor: %s%s", str_replace(a->vendor, '&', ' '), CRLF);
+  fprintf (f, "Vendor: %s%s", vendor, CRLF);
   fprintf (f, "First time seen: %s%s", a->first_time_seen, CRLF);
   fprintf (f, "Last time seen: %s%s", a->last_time_seen, CRLF);
   fprintf (f, "Channel: %s%s", a->channel, CRLF);
@@ -1321,26 +1386,24 @@ void printAPToFileKML (ap *a, FILE *f) {
 
 }
 
+// Returns 1 if the Enddev (e) belongs in the KML output
+int showEndDeviceInKML (enddev *e) {
+  return e->selected && e->lat != 0.0; // no GPS data
+}
+
 // Prints a single Enddev (e) to a file (f)
 void printEndDeviceToFileKML (enddev *e, FILE *f) {
-  int powerDelta = e->power - e->oldPower;
-//  if (powerDelta < 0) powerDelta = -powerDelta;
-  if (e->power < minPower) return;
-  if (e->power > maxPower) return;
-  if (e->lat == 0.0) return; // no GPS data
-  if (onlyShowKnown && strcmp(e->desc, "") == 0) {
-    if (verbosity) printf ("Skipping station: %s\n", e->station_mac); 
-    return;
-  }
-  if (deltaSpecified) {
-    if (e->oldPower >= -1 || powerDelta <= minPowerDelta) return;
-  }
+  char vendor[80];
+
+  if (!showEndDeviceInKML(e)) return;
+  // A copy, so the other outputs keep the real name
+  str_replace (strcpy (vendor, e->vendor), '&', ' ');
   fprintf(f, "<Placemark>%s"
     "<name>%s (%s)</name>%s"
-    "<description>%s", CRLF, strcmp(e->desc, "") == 0 ? e->station_mac : e->desc, str_replace(e->vendor, '&', ' '), CRLF, CRLF);
+    "<description>%s", CRLF, strcmp(e->desc, "") == 0 ? e->station_mac : e->desc, vendor, CRLF, CRLF);
   fprintf (f, "Description: %s%s", e->desc, CRLF);
   fprintf (f, "Station MAC: %s%s", e->station_mac, CRLF);
-  fprintf (f, "Vendor: %s%s", str_replace(e->vendor, '&', ' '), CRLF);
+  fprintf (f, "Vendor: %s%s", vendor, CRLF);
   fprintf (f, "First time seen: %s%s", e->first_time_seen, CRLF);
   fprintf (f, "Last time seen: %s%s", e->last_time_seen, CRLF);
   fprintf (f, "Power: %d%s", e->power, CRLF);
@@ -1362,14 +1425,6 @@ void printEndDeviceToFileKML (enddev *e, FILE *f) {
 
 // Prints a single AP (a) to a file (f)
 void printAPToFileHTML (ap *a, FILE *f) {
-  if (a->power < minPower) return;
-  if (a->power > maxPower) return;
-  if (onlyShowKnown && strcmp(a->desc, "") == 0) return;
-  // If it's been less than MINTIME, return
-  if (timeMin && compareToNow(a->last_time_seen, MINTIME) < 0) return;
-  // If it's been more than MAXTIME, return
-  if (timeMax && compareToNow(a->last_time_seen, MAXTIME) > 0) return;
-
   fprintf (f, "<tr><td>%s</td><td>%s</td><td>%s</td><td>%s</td><td>%s</td><td>%s</td><td>%s</td><td>%s</td><td>%s</td>"
     "<td>%s</td><td>%d</td><td>%s</td><td>%s</td><td>%s</td><td>%s</td><td>%s</td><td>%s</td><td>%s</td><td>%s</td></tr>%s",
     a->bssid, a->vendor, a->first_time_seen, a->last_time_seen, a->prev_last_time_seen, a->channel, a->speed, a->privacy, a->cipher,
@@ -1415,14 +1470,6 @@ void printEndDeviceToFileHTML (enddev *e, FILE *f) {
   dateDiff(&delta, &d1, &d2);
   timeToStr(&delta, deltastr);
 
-  if (e->power < minPower) return;
-  if (e->power > maxPower) return;
-  if (onlyShowKnown && strcmp(e->desc, "") == 0) return;
-
-  // If it's been less than MINTIME, return
-  if (timeMin && compareToNow(e->last_time_displayed, MINTIME) < 0) return;
-  // If it's been more than MAXTIME, return
-  if (timeMax && compareToNow(e->last_time_displayed, MAXTIME) > 0) return;
   fprintf (f, "<tr><td>%s</td><td>%s</td><td>%s</td><td>%s</td><td>%s</td><td>%d</td><td>%s</td><td>%s</td><td>%s</td><td>%s</td><td>%s</td><td>%s</td><td>%s</td></tr>%s", e->station_mac, e->vendor, e->first_time_seen,
     e->last_time_seen, deltastr, e->power, e->packets, e->bssid, e->channel, e->essid, e->probed_essids, e->desc, e->ip, CRLF);
 }
@@ -1456,8 +1503,6 @@ void printEndDevicesToFileHTML (enddev *e, FILE *f) {
 
 // Prints a single AP (a) to a file (f)
 void printAPToFileCSV (ap *a, FILE *f) {
-  if (a->power < minPower) return;
-  if (a->power > maxPower) return;
   fprintf (f, "%s, %s, %s, %s, %s, %s, %s, %s, %d, %s, %s, %s, %s, %s, %s%s",
     a->bssid, a->first_time_seen, a->last_time_seen, a->channel, a->speed, a->privacy, a->cipher,
     a->authentication, a->power, a->beacons, a->ivs, a->lan_ip, a->id_length, a->essid, a->key, CRLF);
@@ -1466,30 +1511,12 @@ void printAPToFileCSV (ap *a, FILE *f) {
 // Prints all of the APs in the linked list (a) to a file (f)
 // Prints a single Enddev (e) to a file (f)
 void printEndDeviceToFileCSV (enddev *e, FILE *f) {
-  if (e->power < minPower) return;
-  if (e->power > maxPower) return;
   fprintf (f, "%s, %s, %s, %d, %s, %s, %s%s", e->station_mac, e->first_time_seen,
     e->last_time_seen, e->power, e->packets, e->bssid, e->probed_essids, CRLF);
 }
 
 // Prints a single ap (a) to a file (f)
 void printAPToFileText (ap *a, FILE *f) {
-  int powerDelta = a->power - a->oldPower;
-//  if (powerDelta < 0) powerDelta = -powerDelta;
-  if (a->power < minPower) return;
-  if (a->power > maxPower) return;
-  if (onlyShowKnown && strcmp(a->desc, "") == 0) return;
-  // If it's been less than MINTIME, return
-  if (timeMin && compareToNow(a->last_time_seen, MINTIME) < 0) return;
-  // If it's been more than MAXTIME, return
-  if (timeMax && compareToNow(a->last_time_seen, MAXTIME) > 0) return;
-
-  if (deltaSpecified) {
-    if (a->oldPower >= -1 || powerDelta <= minPowerDelta) return;
-    // We found something, ring a bell
-//    printf ("\a");
-  }
-
   if (text_brief) {
     fprintf (f, "%s AP:  %s ESSID: %s PWR: %d DESC: %s VEN: %s%s", a->last_time_seen, a->bssid, a->essid, a->power, a->desc, a->vendor, CRLF);
     return;
@@ -1545,83 +1572,27 @@ void printAPsToFileText (ap *a, FILE *f) {
   printAPsToFileText (a->next, f);
 }
 */
-// Prints a single Enddev (e) to a file (f)
-void printEndDeviceToFileText (enddev *e, FILE *f) {
-  int powerDelta = e->power - e->oldPower;
-  char descbuf[256];
-  int skip = 0;
-//  if (powerDelta < 0) powerDelta = -powerDelta;
-  if (!isValidMacAddress(e->station_mac)) {
-    fprintf(stderr,"printEndDeviceToFileText: Discarding invalid MAC: %s\n", e->station_mac);
-    return;
-  }
-  if (e->power < minPower) return;
-  if (e->power > maxPower) return;
-  if (onlyShowKnown && strcmp(e->desc, "") == 0) return;
-
-  // Alert if this device has gone away
-  // Not seen for exactly 31 to 40 seconds
-//  if (compareToNow (e->last_time_displayed, "0000-00-00 00:00:30") > 0 && compareToNow (e->last_time_displayed, "0000-00-00 00:00:40") <= 0) {
-      // if strToTime is successful and last_time_displayed was within the last minute
-//      fprintf(stdout, "Station %s (%s) went away. LTD: %s\n", e->station_mac, e->desc, e->last_time_displayed);
-//  }
-
-  if (deltaSpecified) {
-    if (e->oldPower >= -1 || powerDelta <= minPowerDelta) {
-//      printf("%s - Not printing due to delta: %s %s\n", e->last_time_seen, e->station_mac, e->desc);
-      skip = 1;
-    }
-  }
-
-  char ltd_old[80];
-  strcpy(ltd_old, e->last_time_displayed);
-  char currtime[26];
-  time_t timer;
-  struct tm* tm_info;
-
-  time(&timer);
-  tm_info = localtime(&timer);
-  strftime(currtime, 26, "%Y-%m-%d %H:%M:%S", tm_info);
-  
-  // If we recently saw this device, set last time displayed to now, even if MINTIME/MAXTIME not met.
-  // May not always be desirable, but the goal is to prevent devices that
-  // remain in range from spamming the screen.
-  if (!skip && compareToNow (e->last_time_seen, "0000-00-00 00:00:30") < 0) {
-    // If last_time_seen is within the last 30 seconds
-    strcpy(e->last_time_displayed, currtime);
-    if (verbosity >= 2) fprintf(stdout, "Updating LTD for %s to %s\n", e->station_mac, e->last_time_displayed);
-  }
-
-  // If for some reason, ltd_old is after last_time_seen, return (prevents spamming old data)
-  datetime d1, d2;
-  if (!strToTime (&d1, e->last_time_seen)) return; // return if strToTime fails
-  if (!strToTime (&d2, ltd_old)) return;
-
-  // If it's been less than MINTIME, return
-  if ( timeMin && (compareToNow(ltd_old, MINTIME) <= 0 || compareDates(&d1, &d2) < 0 ) ) {
-//    printf("%s - Not printing due to MINTIME: %s DESC: %s LTD:%s\n", e->last_time_seen, e->station_mac, e->desc, ltd_old);
-    return;
-  }
-  // If it's been more than MAXTIME, return
-//  printf ("%s ", e->station_mac); // print mac address for debugging compareToNow()
-  if (timeMax && compareToNow(ltd_old, MAXTIME) > 0) {
-//    printf("%s - Not printing due to MAXTIME: %s DESC: %s LTD:%s\n", e->last_time_seen, e->station_mac, e->desc, ltd_old);
-    return;
+// Places in str how long before this run the Enddev (e) was last
+// displayed, or "new" if it never was
+char *timeSinceDisplayed (enddev *e, char *str) {
+  datetime delta, d1, d2, zerodate;
+  char nowstr[26];
+
+  getNowStr(nowstr);
+  strToTime(&d1, nowstr);
+  strToTime(&d2, e->prev_last_time_displayed);
+  strToTime(&zerodate, "0000-00-00 00:00:00");
+  if(compareDates(&zerodate, &d2) == 0) {
+    strcpy(str, "new");
+  } else {
+    dateDiff(&delta, &d1, &d2);
+    dateHumanLong(&delta, str);
   }
+  return str;
+}
 
-  if (skip) return;
-
-  // Make last_time_displayed the current time
-  strcpy(e->last_time_displayed, currtime);
-
-//  play_sound("heart.mp3");
-
-//  if (verbosity >= 2) printf ("Sending UDP segment...");
-//  sprintf(descbuf, "STA: %s (%s) ESSID: %s PWR: %d DESC: %s\n", e->station_mac, e->vendor, e->essid, e->power, e->desc);
-//  sprintf(descbuf, "%s", e->desc);
-//  if (remoteserver)
-//    send_info_udp(remoteserver, remoteport, descbuf);
-
+// Prints a single Enddev (e) to a file (f)
+void printEndDeviceToFileText (enddev *e, FILE *f) {
   if (text_brief) {
     datetime delta, d1, d2;
     char nowstr[26];
@@ -1640,38 +1611,11 @@ void printEndDeviceToFileText (enddev *e, FILE *f) {
     dateDiff(&delta, &d1, &d2);
     dateHuman(&delta, ltsstr);
     /* time since last time displayed */
-    strToTime(&d1, nowstr);
-    strToTime(&d2, ltd_old);
-    datetime zerodate;
-    strToTime(&zerodate, "0000-00-00 00:00:00");
-    if(compareDates(&zerodate, &d2) == 0) {
-      strcpy(ltdstr, "new");
-    } else {
-      dateDiff(&delta, &d1, &d2);
-      dateHumanLong(&delta, ltdstr);
-    }
+    timeSinceDisplayed(e, ltdstr);
 //    fprintf (f, "%s STA: %s CH%s ESSID: %s PWR: %d DESC: %s VEN: %s%s", e->last_time_seen, e->station_mac, e->channel, e->essid, e->power+100, e->desc, e->vendor, CRLF);
 //    fprintf (f, "LTS: %s LTD: %s FtL: %s STA: %s CH%s ESSID: %s PWR: %d DESC: %s VEN: %s%s", e->last_time_seen, ltd_old, deltastr, e->station_mac, e->channel, e->essid, e->power+100, e->desc, e->vendor, CRLF);
 //    e->channel[4] = '\0';
     fprintf (f, "%s,%s,%s,%s,%s,%s,%d,%s,%s%s", nowstr, ltsstr, ltdstr, e->station_mac, e->channel, e->essid, e->power+100, e->desc, e->vendor, CRLF);
-    if (remoteserver) {
-      char descbuf[80];
-/*
-      if (strcmp(e->desc, "") != 0)
-        strcpy(descbuf, e->essid);
-      else
-        strcpy(descbuf, e->desc);
-      if (strcmp(descbuf, "") != 0) {
-*/
-      if (strcmp(e->desc, "") != 0) {
-        bzero(descbuf, 80);
-        strcat(descbuf, e->desc);
-        strcat(descbuf, ", ");
-        strcat(descbuf, ltdstr);
-        if (remoteserver)
-          send_info_udp(remoteserver, remoteport, descbuf);
-      }
-    }
     return;
   }
   fprintf (f, "Station MAC: %s%s", e->station_mac, CRLF);
@@ -1720,14 +1664,17 @@ void printEndDevicesToFileText (enddev *e, FILE *f) {
 }
 */
 
-// Prints all of the APs in the linked list (a) to a file (f)
-void printAPsToFileRec (ap *a) {
-  int result;
-  int i;
-  int skip = 1;
+// Returns the selected APs in the order they are printed (count is set
+// to how many), to be freed by the caller
+ap **sortAPsToPrint (ap *a, int *count) {
+  int i, n = 0;
   ap *curr = a;
-  ap **ap_arr = (ap **) malloc(ap_count * sizeof(ap*));
+  ap **ap_arr = (ap **) malloc((ap_count + 1) * sizeof(ap*));
 
+  if (ap_arr == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
   for (i=0; i < ap_count; i++) {
     if (curr == NULL) {
       ap_arr[i] = NULL;
@@ -1749,63 +1696,33 @@ void printAPsToFileRec (ap *a) {
     break;
   }
 
-  for (i=0; i < ap_count; i++) {
-    curr = ap_arr[i];
-
-    if (curr == NULL) {
-      break;
-    }
-
-    skip = 1;
-    if (onlyAddNew) {
-      if (curr->new) {
-        skip = 0;
-//        printf("AP is new: %s\n", curr->bssid);
-      }
-    } else if (onlyAddOld) {
-      if (curr->old) {
-        skip = 0;
-//        printf("AP is old: %s\n", curr->bssid);
-      }
-    } else {
-      skip = 0;
-//      printf("OnlyAddNew and OnlyAddOld are off\n");
-    }
-
-    if (!skip) {
-      printAPToFileCSV (curr, csvFile);
-      printAPToFileText (curr, textFile);
-      printAPToFileHTML (curr, htmlFile);
-      if (kmlFile) printAPToFileKML (curr, kmlFile);
-    }
-  }
-  fprintf(csvFile, "%s", CRLF);
-/*
-  result = ferror (f);
-  if (result) {
-    printf ("printAPsToFileCSV fprintf returned error: %d\n", result);
-    return;
+  // selectDevices decides what gets printed
+  for (i=0; i < ap_count && ap_arr[i] != NULL; i++) {
+    if (ap_arr[i]->selected) ap_arr[n++] = ap_arr[i];
   }
- */
-//  printAPsToFileRec (a->next);
+  *count = n;
+  return ap_arr;
 }
 
-// Prints a linked list of Enddevs (e) to files (text, html, csv)
-void printEndDevicesToFileRec (enddev *e) {
-  int result;
-  int i;
-  int skip = 1;
+// Returns the selected Enddevs in the order they are printed (count is set
+// to how many), to be freed by the caller
+enddev **sortEndDevicesToPrint (enddev *e, int *count) {
+  int i, n = 0;
   enddev *curr = e;
-  enddev **sta_arr = (enddev **) malloc(sta_count * sizeof(enddev*));
+  enddev **sta_arr = (enddev **) malloc((sta_count + 1) * sizeof(enddev*));
 
+  if (sta_arr == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
   for (i=0; i < sta_count; i++) {
     if (curr == NULL) {
       sta_arr[i] = NULL;
       // should not get here, but just in case...
-      if (verbosity >= 2) printf("Warning: got a null station!\n");
+      TRACE (TRACE_STA_SORT, NULL, i);
     } else {
       sta_arr[i] = curr;
-      if (verbosity >= 2) printf("Added station %s\n", curr->station_mac);
+      TRACE (TRACE_STA_SORT, curr->station_mac, i);
       curr = curr->next;
     }
   }
@@ -1821,45 +1738,11 @@ void printEndDevicesToFileRec (enddev *e) {
     break;
   }
 
-  for (i=0; i < sta_count; i++) {
-    curr = sta_arr[i];
-    if (curr == NULL) {
-      break;
-    }
-    skip = 1;
-//    printf("i = %d/%d\n", i, sta_count);
-//    printf("next station (%d): %s\n", i, curr->station_mac);
-    if (onlyAddNew) {
-      if (curr->new) skip = 0;
-    } else if (onlyAddOld) {
-      if (curr->old) skip = 0;
-    } else {
-      skip = 0;
-    }
-
-    if (!skip) {
-      if (verbosity >= 2) printf("Printing to csv/text/html station: %s Pwr: %d\n", curr->station_mac, curr->power);
-      if (verbosity >= 2) printf("Printing station to csv file.\n");
-      printEndDeviceToFileCSV (curr, csvFile);
-      if (verbosity >= 2) printf("Printing station to text file.\n");
-      printEndDeviceToFileText (curr, textFile);
-      if (verbosity >= 2) printf("Printing station to html file.\n");
-      printEndDeviceToFileHTML (curr, htmlFile);
-      if (verbosity >= 2) printf("Printing %s to KML file\n", curr->station_mac);
-      if (kmlFile) printEndDeviceToFileKML (curr, kmlFile);
-    }
-  }
-  fprintf(csvFile, "%s", CRLF);
-  free(sta_arr); 
-
-/*
-  result = ferror (f);
-  if (result) {
-    printf ("printEndDevicesToFileCSV fprintf returned error: %d\n", result);
-    return;
+  for (i=0; i < sta_count && sta_arr[i] != NULL; i++) {
+    if (sta_arr[i]->selected) sta_arr[n++] = sta_arr[i];
   }
-*/
-//  printEndDevicesToFileRec (e->next);  // not using recursion anymore
+  *count = n;
+  return sta_arr;
 }
 
 int compareMacDbItems ( const void *p1, const void *p2 ) {
@@ -1896,6 +1779,7 @@ void readMacDB (char * fileName) {
 
   rewind(pFile);
   mac_database = (macdb *) malloc (lines * sizeof(macdb));
+  memAdd (MEM_ENRICH, lines * sizeof(macdb));
 
   for (ven=0; ven < lines; ven++) {
     if (fgets (buffer, 120, pFile) == NULL) {
@@ -1919,6 +1803,9 @@ void readMacDB (char * fileName) {
 //      printf ("Got ven: %s mac: %s\n", vendor, mac);
   }
   qsort(mac_database, lines, sizeof(macdb), &compareMacDbItems);
+  memSub (MEM_PARSER, lSize);
+  free (macfile);
+  fclose (pFile);
 }
 
 // Reads a CSV list of known MAC addresses (user-generated)
@@ -1949,7 +1836,8 @@ void readKnownMacs (char * fileName) {
   known_macs_sz = lines;
 
   rewind(pFile);
-  known_macs = (macdb *) malloc (lines * sizeof(macdb));
+  known_macs = (macdb *) malloc ((lines ? lines : 1) * sizeof(macdb));
+  memAdd (MEM_ENRICH, (lines ? lines : 1) * sizeof(macdb));
 
   for (ven=0; ven < lines; ven++) {
     if (fgets (buffer, 120, pFile) == NULL) {
@@ -1979,6 +1867,9 @@ void readKnownMacs (char * fileName) {
 //      printf ("Adding DESC: %s MAC: %s\n", vendor, mac);
   }
   qsort(known_macs, lines, sizeof(macdb), &compareMacDbItems);
+  memSub (MEM_PARSER, lSize);
+  free (macfile);
+  fclose (pFile);
 }
 
 // Reads a CSV list of known IP addresses (script-generated)
@@ -2002,10 +1893,12 @@ void readKnownIPs (char * fileName) {
   while (fgets (buffer, 120, pFile) != NULL) {
     if (known_ips == NULL) {
       known_ips = (macdb *) malloc (sizeof(macdb));
+      memAdd (MEM_ENRICH, sizeof(macdb));
       known_ips->next = NULL;
       curr_node = known_ips;
     } else {
       curr_node->next = (macdb *) malloc (sizeof(macdb));
+      memAdd (MEM_ENRICH, sizeof(macdb));
       curr_node = curr_node->next;
       curr_node->next = NULL;
     }
@@ -2031,6 +1924,85 @@ void readKnownIPs (char * fileName) {
 
 //    printf ("Added %s - %s\n", mac, vendor);
   }
+  fclose (pFile);
+}
+
+// Returns the index just past the end of the line starting at i
+static long lineEnd (const char *buffer, long i, long lSize) {
+  const char *nl = memchr (buffer + i, '\n', lSize - i);
+  return nl ? nl - buffer + 1 : lSize;
+}
+
+// 64-bit FNV-1a hash of len bytes (data), carrying on from h (HASH64_INIT to start)
+unsigned long long hash64 (unsigned long long h, const char *data, long len) {
+  long k;
+  for (k=0; k < len; k++) {
+    h ^= (unsigned char) data[k];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+// Looks up the vendor, description and IP of an AP.  The vendor is only
+// looked up once, the rest again only if the known MAC/IP tables changed.
+static void enrichAp (ap *a) {
+  char mac[9];
+
+  if (a->enrichGen == tableGeneration) return;
+  phaseBegin (PHASE_ENRICH);
+  if (a->enrichGen < 0) {
+    memcpy (mac, a->bssid, 8);
+    mac[8] = '\0';
+    strcpy (a->vendor, findVendorByMACBin (mac_database, mac_db_sz, mac));
+  }
+  // "Vendor" is actually the description in this case
+  strcpy (a->desc, findVendorByMACBin (known_macs, known_macs_sz, a->bssid));
+  // Do the same for the IP address
+  strcpy (a->ip, findVendorByMAC (known_ips, a->bssid));
+  a->enrichGen = tableGeneration;
+  phaseEnd (PHASE_ENRICH);
+}
+
+// Same as enrichAp for an Enddev (e)
+static void enrichEnddev (enddev *e) {
+  char mac[9];
+
+  if (e->enrichGen == tableGeneration) return;
+  phaseBegin (PHASE_ENRICH);
+  if (e->enrichGen < 0) {
+    memcpy (mac, e->station_mac, 8);
+    mac[8] = '\0';
+    strcpy (e->vendor, findVendorByMACBin (mac_database, mac_db_sz, mac));
+  }
+  strcpy (e->desc, findVendorByMACBin (known_macs, known_macs_sz, e->station_mac));
+  strcpy (e->ip, findVendorByMAC (known_ips, e->station_mac));
+  e->enrichGen = tableGeneration;
+  phaseEnd (PHASE_ENRICH);
+}
+
+// The row for this AP (a) is the same as when it was last read,
+// so only the fields that depend on which file it's in change
+static void reuseAPRow (ap *a, const char *fileName, const int lastFile) {
+  if (!lastFile) strcpy(a->prev_last_time_seen, a->last_time_seen);
+  a->oldPower = a->old ? a->power : 0;
+  strcpy (a->fileName, fileName);
+  memcpy(&(a->prvtime2), &(a->time2), sizeof(datetime));
+  enrichAp (a);
+}
+
+// Same as reuseAPRow for an Enddev (e)
+static void reuseEnddevRow (enddev *e, const char *fileName, const int lastFile) {
+  ap *a;
+
+  if (!lastFile) strcpy(e->prev_last_time_seen, e->last_time_seen);
+  e->oldPower = e->old ? e->power : 0;
+  strcpy (e->fileName, fileName);
+  memcpy(&(e->prvtime2), &(e->time2), sizeof(datetime));
+  enrichEnddev (e);
+  // The AP's row may have changed
+  a = e->bssid[0] != '(' ? findApHT (aptable, e->bssid) : NULL;
+  strcpy(e->essid, a ? a->essid : "");
+  strcpy(e->channel, a ? a->channel : "");
 }
 
 // Reads a CSV file (fileName)
@@ -2043,7 +2015,6 @@ devset readCSVFile (char * fileName, ap *firstAp, enddev *firstEnddev, const int
   long i=0, j=0, k=0;
   long lSize;
   char *buffer;
-  char mac[9];
   char power[5];
   char currWord[80];
   char description[16][80];
@@ -2057,7 +2028,12 @@ devset readCSVFile (char * fileName, ap *firstAp, enddev *firstEnddev, const int
   enddev *lastEnddev = firstEnddev;
   enddev *tempEnddev = NULL;
   devset dset;
+  long rowEnd;
+  unsigned long long hash;
+  int rows = 0, unchanged = 0;
+  long long started = metricsClock ();
 
+  phaseBegin (PHASE_PARSE);
   pFile = fopen (fileName, "r");
 
   if (pFile == NULL) {
@@ -2079,6 +2055,7 @@ devset readCSVFile (char * fileName, ap *firstAp, enddev *firstEnddev, const int
     fputs ("Memory error\n", stderr);
     exit(2);
   }
+  memAdd (MEM_PARSER, lSize);
 
   // copy the file into the buffer
   result = fread (buffer, 1, lSize, pFile);
@@ -2097,7 +2074,7 @@ devset readCSVFile (char * fileName, ap *firstAp, enddev *firstEnddev, const int
     }
   }
 
-  if (verbosity >= 2) printf ("Processing %s\n", fileName);
+  TRACE (TRACE_FILE, NULL, traceName (fileName));
   // Read the list of aps
   while (i < lSize-1) {
     //Check if we are at the end of the ap list
@@ -2109,10 +2086,14 @@ devset readCSVFile (char * fileName, ap *firstAp, enddev *firstEnddev, const int
       break;
     }
     // Read the next AP
+    rowEnd = lineEnd (buffer, i, lSize);
+    hash = hash64 (HASH64_INIT, buffer + i, rowEnd - i);
+    rows++;
     i = getWord (currWord, buffer, i, lSize);
     keepDate = 0;
     if (firstAp == NULL) {
       firstAp = (ap *) malloc (sizeof(ap));
+      memAdd (MEM_DEVICES, sizeof(ap));
       firstAp->next = NULL;
       firstAp->new = lastFile ? 1 : 0;
       firstAp->old = 0;
@@ -2121,13 +2102,18 @@ devset readCSVFile (char * fileName, ap *firstAp, enddev *firstEnddev, const int
       strcpy(firstAp->last_time_displayed, "0000-00-00 00:00:00");
       bzero(firstAp->maxPwrTime, 80);
       firstAp->lat = firstAp->lon = 0.0;
+      firstAp->enrichGen = -1;
+      firstAp->eventsQueued = 0;
+      firstAp->departTimer.pprev = NULL;
       lastAp = currAp = firstAp;
+      TRACE (TRACE_AP_NEW, currWord, lastFile);
       ap_count++;
     } else {
 //      currAp = findApByBSSID (firstAp, currWord);
         currAp = findApHT (aptable, currWord);
       if (currAp == NULL) {
         currAp = (ap *) malloc (sizeof(ap));
+        memAdd (MEM_DEVICES, sizeof(ap));
         currAp->next = NULL;
         currAp->new = lastFile ? 1 : 0;
         currAp->old = 0;
@@ -2136,25 +2122,31 @@ devset readCSVFile (char * fileName, ap *firstAp, enddev *firstEnddev, const int
         currAp->maxPwrLevel = -100;
         bzero(currAp->maxPwrTime, 80);
         currAp->lat = currAp->lon = 0.0;
+      currAp->enrichGen = -1;
+      currAp->eventsQueued = 0;
+      currAp->departTimer.pprev = NULL;
         lastAp->next = currAp;
         lastAp = currAp;
+        TRACE (TRACE_AP_NEW, currWord, lastFile);
         ap_count++;
       } else {
         currAp->new = 0;
         currAp->old = lastFile ? 1 : 0;
+        if (currAp->rowHash == hash) {
+          // Nothing to parse
+          reuseAPRow (currAp, fileName, lastFile);
+          TRACE (TRACE_AP_ROW, currWord, 1);
+          unchanged++;
+          i = rowEnd;
+          continue;
+        }
         strcpy(first_time_seen, currAp->first_time_seen);
         keepDate = 1;
       }
     }
 
     strcpy (currAp->bssid, currWord);
-    memcpy (mac, currAp->bssid, 8);
-    mac[8] = '\0';
-    strcpy (currAp->vendor, findVendorByMACBin (mac_database, mac_db_sz, mac));
-    // "Vendor" is actually the description in this case
-    strcpy (currAp->desc, findVendorByMACBin (known_macs, known_macs_sz, currAp->bssid));
-    // Do the same for the IP address
-    strcpy (currAp->ip, findVendorByMAC (known_ips, currAp->bssid));
+    enrichAp (currAp);
     i = getWord (currAp->first_time_seen, buffer, i, lSize);
     if (keepDate) strcpy(currAp->first_time_seen, first_time_seen);
     i = getWord (currAp->last_time_seen, buffer, i, lSize);
@@ -2195,18 +2187,21 @@ devset readCSVFile (char * fileName, ap *firstAp, enddev *firstEnddev, const int
       &(currAp->time2.hour),
       &(currAp->time2.minute),
       &(currAp->time2.second));
+    if (heatmapKey) heatmapAddSample (currAp);
+    if (eventsTarget) eventsQueueAp (currAp);
     if (currAp->power > currAp->maxPwrLevel && currAp->power < -1) {
       currAp->maxPwrLevel = currAp->power;
       strcpy(currAp->maxPwrTime, currAp->last_time_seen);
     }
     if (strcmp(currAp->maxPwrTime, "") == 0) strcpy(currAp->maxPwrTime, currAp->last_time_seen);
+    currAp->rowHash = hash;
     if (findApHT (aptable, currAp->bssid) == NULL)  {
       if (addApToHT(aptable, currAp) == -1) {// Add the AP to the hash table
         fprintf(stderr, "Exiting due to malformed file\n");
         exit(1); // If file is malformed, exit and crash
       }
     }
-    if (verbosity >= 2) printf("added ap: %s\n", currAp->bssid);
+    TRACE (TRACE_AP_ROW, currAp->bssid, 0);
   }
 
   // Skip the description line
@@ -2227,10 +2222,14 @@ devset readCSVFile (char * fileName, ap *firstAp, enddev *firstEnddev, const int
       i += 2;
       break;
     }
+    rowEnd = lineEnd (buffer, i, lSize);
+    hash = hash64 (HASH64_INIT, buffer + i, rowEnd - i);
+    rows++;
     i = getWord (currWord, buffer, i, lSize);
     keepDate = 0;
     if (firstEnddev == NULL) {
       firstEnddev = (enddev *) malloc (sizeof(enddev));
+      memAdd (MEM_DEVICES, sizeof(enddev));
       firstEnddev->next = NULL;
       firstEnddev->new = lastFile ? 1 : 0;
       firstEnddev->old = 0;
@@ -2238,15 +2237,20 @@ devset readCSVFile (char * fileName, ap *firstAp, enddev *firstEnddev, const int
       strcpy(firstEnddev->last_time_displayed, "0000-00-00 00:00:00");
       firstEnddev->maxPwrLevel = -100;
       firstEnddev->lat = firstEnddev->lon = 0.0;
+      firstEnddev->enrichGen = -1;
+      firstEnddev->eventsQueued = 0;
+      firstEnddev->execTime = 0;
+      firstEnddev->departTimer.pprev = NULL;
       bzero(firstEnddev->maxPwrTime, 80);
       lastEnddev = currEnddev = firstEnddev;
+      TRACE (TRACE_STA_NEW, currWord, lastFile);
       sta_count++;
     } else {
 //      currEnddev = findEnddevByMAC (firstEnddev, currWord);
       currEnddev = findStaHT (statable, currWord);
       if (currEnddev == NULL) {
-        if (verbosity>=2) printf("Did not find %s lastfile: %d\n", currWord, lastFile);
         currEnddev = (enddev *) malloc (sizeof(enddev));
+        memAdd (MEM_DEVICES, sizeof(enddev));
         currEnddev->next = NULL;
         currEnddev->new = lastFile ? 1 : 0;
         currEnddev->old = 0;
@@ -2255,24 +2259,30 @@ devset readCSVFile (char * fileName, ap *firstAp, enddev *firstEnddev, const int
         currEnddev->maxPwrLevel = -100;
         bzero(currEnddev->maxPwrTime, 80);
         currEnddev->lat = currEnddev->lon = 0.0;
+      currEnddev->enrichGen = -1;
+      currEnddev->eventsQueued = 0;
+      currEnddev->execTime = 0;
+      currEnddev->departTimer.pprev = NULL;
         lastEnddev->next = currEnddev;
         lastEnddev = currEnddev;
+        TRACE (TRACE_STA_NEW, currWord, lastFile);
         sta_count++;
       } else {
-        strcpy (first_time_seen, currEnddev->first_time_seen);
         currEnddev->new = 0;
         currEnddev->old = lastFile ? 1 : 0;
+        if (currEnddev->rowHash == hash) {
+          reuseEnddevRow (currEnddev, fileName, lastFile);
+          TRACE (TRACE_STA_ROW, currWord, 1);
+          unchanged++;
+          i = rowEnd;
+          continue;
+        }
+        strcpy (first_time_seen, currEnddev->first_time_seen);
         keepDate = 1;
       }
     }
     strcpy (currEnddev->station_mac, currWord);
-    memcpy (mac, currEnddev->station_mac, 8);
-    mac[8] = '\0';
-    strcpy (currEnddev->vendor, findVendorByMACBin (mac_database, mac_db_sz, mac));
-    // "Vendor" is actually the description in this case
-    strcpy (currEnddev->desc, findVendorByMACBin (known_macs, known_macs_sz, currEnddev->station_mac));
-    // Do the same for the IP address
-    strcpy (currEnddev->ip, findVendorByMAC (known_ips, currEnddev->station_mac));
+    enrichEnddev (currEnddev);
     i = getWord (currEnddev->first_time_seen, buffer, i, lSize);
     if (keepDate) strcpy (currEnddev->first_time_seen, first_time_seen);
     i = getWord (currEnddev->last_time_seen, buffer, i, lSize);
@@ -2286,7 +2296,6 @@ devset readCSVFile (char * fileName, ap *firstAp, enddev *firstEnddev, const int
     if (currEnddev->bssid[0] != '(') { // (not associated)
       currAp = findApHT (aptable, currEnddev->bssid);
       if (currAp != NULL) {
-        if (verbosity>=2) printf("Could not find %s\n", currEnddev->bssid);
         strcpy(currEnddev->essid, currAp->essid);
 	strcpy(currEnddev->channel, currAp->channel); // also grab the channel
       } else {
@@ -2336,43 +2345,32 @@ devset readCSVFile (char * fileName, ap *firstAp, enddev *firstEnddev, const int
       i++; j++;
     }
     currEnddev->probed_essids[j] = '\0';
+    currEnddev->rowHash = hash;
+    if (eventsTarget) eventsQueueEnddev (currEnddev);
     if (findStaHT (statable, currEnddev->station_mac) == NULL) addStaToHT(statable, currEnddev);
-    if (verbosity>=2) printf("added sta (new? %d): %s\n", currEnddev->new, currEnddev->station_mac);
+    TRACE (TRACE_STA_ROW, currEnddev->station_mac, 0);
   }
 
-//  fclose(pFile);
+  fclose(pFile);
+  memSub (MEM_PARSER, lSize);
   free (buffer);
 
-  if (verbosity>=2) printf("Finished reading %s\n", fileName);  // Debug
+  TRACE (TRACE_FILE_DONE, NULL, rows);
+  if (verbosity) printf("%s: %d rows, %d unchanged\n", fileName, rows, unchanged);
+  metricsRows (fileName, rows, unchanged, lSize, metricsClock () - started);
+  phaseEnd (PHASE_PARSE);
   dset.s = firstAp;
   dset.e = firstEnddev;
   return dset;
 }
 
-int main (int argc, char **argv) {
-  int i, lastFile, showAPs, showEnddevs;
-  ap *firstAp = NULL;
-  enddev *firstEnddev = NULL;
-  gps *gps1 = NULL;
-  devset dset;
-/*
-  FILE *csvFile = NULL;
-  FILE *textFile = NULL;
-  FILE *htmlFile = NULL;
- */
-  FILE *tmpFile = NULL;
-  char *fileToMonitor = NULL;
-  char *filePrefix = NULL;
-  char *gpsFile = NULL;
-  char buffer[256];
-//  int continuous = 0; //boolean
-
-  // Set the default values
+// Sets every option back to its default value
+void setDefaultOptions (void) {
   onlyAddCommon = 0;
   onlyAddNew = 0;
   onlyAddOld = 0;
+  onlyShowKnown = 0;
   deltaSpecified = 0;
-  numInputFiles = 0;
   showAPs = 1;
   showEnddevs = 1;
   minPower = -100;
@@ -2380,261 +2378,685 @@ int main (int argc, char **argv) {
   minPowerDelta = -1;
   text_brief = 0;
   verbosity = 0;
-  ap_count = 0;
-  sta_count = 0;
   timeMin = 0;
   timeMax = 0;
+  sortBy = 0;
   remoteserver = NULL;
-  extraStaCt = 0;
-  collisions = 0;
-  kmlFile = NULL; // 2018-03-24
-
-  if (argc < 2) {
-    printf ("Usage: %s [options] -w prefix file1 [file2] [file3]...[-l] [file n]\n", argv[0]);
-    printf ("-a only show APs\n");
-    printf ("-b print brief text in text mode\n");
-    printf ("-e only show end devices\n");
+  textFile = NULL;
+  filePrefix = NULL;
+  gpsFile = NULL;
+  knownMacsFile = NULL;
+  knownIPsFile = NULL;
+  profilesFile = NULL;
+  filterExpr = NULL;
+  watchInterval = 0;
+  eventsTarget = NULL;
+  departAfter = EVENT_DEPART_SECS;
+  execCommand = NULL;
+  soundFile = NULL;
+  execMax = 2;
+  execDebounce = 60;
+  execRate = 10;
+  querySocket = NULL;
+  shmName = NULL;
+  metricsTarget = NULL;
+  traceFile = NULL;
+  statsFormat = 0;
+  kmzOutput = 0;
+  outputs = OUT_TEXT | OUT_CSV | OUT_HTML | OUT_KML;
+  htmlView = 0;
+  kmlTileSize = 500;
+  showTrack = 1;
+  trackTolerance = 5.0;
+  heatmapKey = 0;
+  heatmapMax = 16;
+  heatmapRes = 10.0;
+  nearQuery = 0;
+  bboxQuery = 0;
+}
+
+void printUsage (const char *prog) {
+  printf ("Usage: %s [options] -w prefix file1 [file2] [file3]...[-l] [file n]\n", prog);
+  printf ("-a only show APs\n");
+  printf ("-b print brief text in text mode\n");
+  printf ("-e only show end devices\n");
+  printf ("-f [filter] only show devices matching [filter], e.g. \"power > -60 && known && age < 30s\"\n");
 //    printf ("-c specifies a csv file to output to\n");
 //    printf ("-t specifies a text file to output to\n");
-    printf ("-to prints text to stdout (cannot be used with -t)\n");
+  printf ("-to prints text to stdout (cannot be used with -t)\n");
 //    printf ("-h specifies a html file to output to\n");
-    printf ("-g [file] specifies a GPS input file\n");
-    printf ("-i [file] specifies a CSV file of known IP addresses\n");
-    printf ("-l specifies the last file (must be the last file specified)\n");
-    printf ("-k [file] specifies a CSV file of known MAC addresses\n");
-    printf ("-m only show APs and Stations in the file specified with -k\n");
-    printf ("-d [delta] only shows devices whose power is stronger than before by [delta]\n");
-    printf ("-n only shows APs and Stations that are new in the last file\n");
-    printf ("-o only shows APs and Stations that are not new in the last file\n");
-    printf ("-p [power] only shows APs and Stations with power greater than [power]\n");
-    printf ("-P [power] only shows APs and Stations with power less than [power]\n");
-    printf ("-sl sort by last time seen\n");
-    printf ("-t only shows APs and Stations greater than the minimum time\n");
-    printf ("-T only shows APs and Stations less than the maximum time\n");
-    printf ("-u [server] [port] send findings to UDP server on [server]:[port]\n");
-    printf ("-v verbose output\n");
-    printf ("-vv very verbose output\n");
-    printf ("-w [prefix] specifies output file prefix\n");
-    return 1;
-  }
-
-  firstAp = NULL;
-  firstEnddev = NULL;
-
-  tmpFile = fopen("/usr/share/aircrack-ng/airodump-ng-oui.txt", "r");
-  if (tmpFile) {
-    fclose(tmpFile);
-    readMacDB ("/usr/share/aircrack-ng/airodump-ng-oui.txt");
-//    printf("reading /usr/share/aircrack-ng/airodump-ng-oui.txt\n");
-  } else if (tmpFile = fopen("/etc/aircrack-ng/airodump-ng-oui.txt", "r")) {
-    fclose(tmpFile);
-    readMacDB ("/etc/aircrack-ng/airodump-ng-oui.txt");
-//    printf("reading /etc/aircrack-ng/airodump-ng-oui.txt\n");
-  } 
-  for (i = 1; i < argc; i++) {
+  printf ("-g [file] specifies a GPS input file\n");
+  printf ("-i [file] specifies a CSV file of known IP addresses\n");
+  printf ("-l specifies the last file (must be the last file specified)\n");
+  printf ("-k [file] specifies a CSV file of known MAC addresses\n");
+  printf ("-m only show APs and Stations in the file specified with -k\n");
+  printf ("-d [delta] only shows devices whose power is stronger than before by [delta]\n");
+  printf ("-n only shows APs and Stations that are new in the last file\n");
+  printf ("-o only shows APs and Stations that are not new in the last file\n");
+  printf ("-p [power] only shows APs and Stations with power greater than [power]\n");
+  printf ("-P [power] only shows APs and Stations with power less than [power]\n");
+  printf ("-sl sort by last time seen\n");
+  printf ("-t only shows APs and Stations greater than the minimum time\n");
+  printf ("-T only shows APs and Stations less than the maximum time\n");
+  printf ("-u [server] [port] send findings to UDP server on [server]:[port]\n");
+  printf ("-v verbose output\n");
+  printf ("-vv very verbose output\n");
+  printf ("-w [prefix] specifies output file prefix\n");
+  printf ("--out [text,csv,html,kml,kmz,json] only write these formats (default text,csv,html,kml; json is [prefix].jsonl, one device per line)\n");
+  printf ("--html-view write the html output as a page that scrolls, sorts and filters any number of devices\n");
+  printf ("--kmz write GPS output as a tiled KMZ file instead of KML\n");
+  printf ("--kmz-tile [n] maximum devices per KMZ tile (default 500)\n");
+  printf ("--no-track leave the GPS track out of the KML/KMZ output\n");
+  printf ("--track-tolerance [meters] how far the simplified GPS track may stray from the log (default 5)\n");
+  printf ("--heatmap [bssid|essid] draw signal strength maps of the APs with the most samples (needs -g)\n");
+  printf ("--heatmap-max [n] how many heatmaps to draw (default 16)\n");
+  printf ("--heatmap-res [meters] heatmap cell size (default 10)\n");
+  printf ("--near [lat,lon,meters] list located devices within [meters] of lat,lon\n");
+  printf ("--bbox [south,west,north,east] list located devices inside the box\n");
+  printf ("--watch [secs] keep running and read the -l file again every [secs] seconds (default 5)\n");
+  printf ("--events [file|-|udp:host:port] write a line of JSON when a device is new, closer, departed or reappeared\n");
+  printf ("--depart [secs] how long a device must be unseen to have departed (default %d)\n", EVENT_DEPART_SECS);
+  printf ("--exec [command] run [command] with sh for each station that gets shown (CSVTOOLS_MAC etc. are set)\n");
+  printf ("--sound [file] play [file] with mpg123 for each station that gets shown\n");
+  printf ("--exec-max [n] run at most [n] --exec/--sound commands at once (default 2)\n");
+  printf ("--exec-debounce [secs] don't run them again for the same station within [secs] (default 60)\n");
+  printf ("--exec-rate [n] start at most [n] of them a minute (default 10)\n");
+  printf ("--query-socket [path] with --watch, answer queries about the devices on a Unix socket\n");
+  printf ("--shm [name] keep every device in POSIX shared memory [name] for other programs (see csvshm.h)\n");
+  printf ("--metrics [file|:port] write Prometheus metrics to [file] after each pass, or serve them on 127.0.0.1:[port] with --watch\n");
+  printf ("--trace [file] keep the last of what each thread did (hash lookups, rows) and write it to file at the end (with --watch, also on a SIGUSR2)\n");
+  printf ("--trace-decode [file] print a --trace file as text and exit\n");
+  printf ("--stats [text|json] print where the time and memory went to stderr at the end (with --watch, after a SIGUSR1)\n");
+  printf ("--profiles [file] write one set of outputs per line of [file] (name options...)\n");
+}
+
+// Applies the option at argv[i]
+// Returns the index of the last argument the option used,
+// or -1 if argv[i] is not an option (it's an input file)
+int parseOption (int argc, char **argv, int i) {
 /*
-    if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "-C") == 0) {
-      i++;
-      if (i >= argc) {
-        printf ("-c requires that you specify an output csv file.\n");
-        exit(1);
-      }
-      csvFile = fopen(argv[i], "w");
-      if (csvFile == NULL) {
-        printf ("Error opening CSV file: %s\n", argv[i]);
-        exit(1);
-      }
-      continue;
+  if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "-C") == 0) {
+    i++;
+    if (i >= argc) {
+      printf ("-c requires that you specify an output csv file.\n");
+      exit(1);
+    }
+    csvFile = fopen(argv[i], "w");
+    if (csvFile == NULL) {
+      printf ("Error opening CSV file: %s\n", argv[i]);
+      exit(1);
     }
+    return i;
+  }
 */
 /*
-    if (strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "-T") == 0) {
-      i++;
-      if (i >= argc) {
-        printf ("-t requires that you specify an output text file.\n");
-        exit(1);
-      }
-      textFile = fopen(argv[i], "w");
-      if (textFile == NULL) {
-        printf ("Error opening text file: %s\n", argv[i]);
-        exit(1);
-      }
-      continue;
+  if (strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "-T") == 0) {
+    i++;
+    if (i >= argc) {
+      printf ("-t requires that you specify an output text file.\n");
+      exit(1);
+    }
+    textFile = fopen(argv[i], "w");
+    if (textFile == NULL) {
+      printf ("Error opening text file: %s\n", argv[i]);
+      exit(1);
     }
+    return i;
+  }
 */
-    if (strcmp(argv[i], "-to") == 0 || strcmp(argv[i], "-TO") == 0) {
-      if (textFile != NULL) {
-        fprintf (stderr, "Error: -to cannot be used with -t\n");
-        exit(1);
-      }
-      textFile = stdout;
-      continue;
+  if (strcmp(argv[i], "-to") == 0 || strcmp(argv[i], "-TO") == 0) {
+    if (textFile != NULL) {
+      fprintf (stderr, "Error: -to cannot be used with -t\n");
+      exit(1);
     }
+    textFile = stdout;
+    return i;
+  }
 /*
-    if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-H") == 0) {
-      i++;
-      if (i >= argc) {
-        printf ("-h requires that you specify an output text file.\n");
-        exit(1);
-      }
-      htmlFile = fopen(argv[i], "w");
-      if (htmlFile == NULL) {
-        printf ("Error opening html file: %s\n", argv[i]);
-        exit(1);
-      }
-      continue;
+  if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-H") == 0) {
+    i++;
+    if (i >= argc) {
+      printf ("-h requires that you specify an output text file.\n");
+      exit(1);
+    }
+    htmlFile = fopen(argv[i], "w");
+    if (htmlFile == NULL) {
+      printf ("Error opening html file: %s\n", argv[i]);
+      exit(1);
     }
+    return i;
+  }
 */
-    if (strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "-A") == 0) {
-      showEnddevs = 0;
-      continue;
+  if (strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "-A") == 0) {
+    showEnddevs = 0;
+    return i;
+  }
+  if (strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "-B") == 0) {
+    text_brief = 1;
+    return i;
+  }
+  if (strcmp(argv[i], "-d") == 0) {
+    i++;
+    if (i >= argc) {
+      printf ("-d requires that you specify a minimum delta power level.\n");
+      exit(1);
     }
-    if (strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "-B") == 0) {
-      text_brief = 1;
-      continue;
+    deltaSpecified = 1;
+    minPowerDelta = atoi(argv[i]);
+    return i;
+  }
+  if (strcmp(argv[i], "-e") == 0 || strcmp(argv[i], "-E") == 0) {
+    showAPs = 0;
+    return i;
+  }
+  if (strcmp(argv[i], "-g") == 0) {
+    i++;
+    if (i >= argc) {
+      printf ("-g requires that you specify a GPS file.\n");
+      return i;
     }
-    if (strcmp(argv[i], "-d") == 0) {
-      i++;
-      if (i >= argc) {
-        printf ("-d requires that you specify a minimum delta power level.\n");
-        exit(1);
-      }
-      deltaSpecified = 1;
-      minPowerDelta = atoi(argv[i]);
-      continue;
+    gpsFile = argv[i];
+    return i;
+  }
+  if (strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "-I") == 0) {
+    i++;
+    if (i >= argc) {
+      printf ("-i requires that you specify a MAC/IP address file.\n");
+      exit(1);
     }
-    if (strcmp(argv[i], "-e") == 0 || strcmp(argv[i], "-E") == 0) {
-      showAPs = 0;
-      continue;
+    knownIPsFile = argv[i];
+    return i;
+  }
+  if (strcmp(argv[i], "-k") == 0 || strcmp(argv[i], "-K") == 0) {
+    i++;
+    if (i >= argc) {
+      printf ("-k requires that you specify a MAC address/hostname file.\n");
+      exit(1);
     }
-    if (strcmp(argv[i], "-g") == 0) {
-      i++;
-      if (i >= argc) {
-        printf ("-g requires that you specify a GPS file.\n");
-        continue;
-      }
-      gpsFile = argv[i];
-      continue;
+    knownMacsFile = argv[i];
+    return i;
+  }
+  if (strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "-M") == 0) {
+    onlyShowKnown = 1;
+    return i;
+  }
+  if (strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "-N") == 0) {
+    onlyAddNew = 1;
+    return i;
+  }
+  if (strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "-O") == 0) {
+    onlyAddOld = 1;
+    return i;
+  }
+  if (strcmp(argv[i], "-p") == 0) {
+    i++;
+    if (i >= argc) {
+      printf ("-p requires that you specify a minimum power level.\n");
+      exit(1);
     }
-    if (strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "-I") == 0) {
-      i++;
-      if (i >= argc) {
-        printf ("-i requires that you specify a MAC/IP address file.\n");
-        exit(1);
-      }
-      readKnownIPs(argv[i]);
-
-      continue;
+    minPower = atoi(argv[i]);
+    return i;
+  }
+  if (strcmp(argv[i], "-P") == 0) {
+    i++;
+    if (i >= argc) {
+      printf ("-P requires that you specify a maximum power level.\n");
+      exit(1);
     }
-    if (strcmp(argv[i], "-k") == 0 || strcmp(argv[i], "-K") == 0) {
-      i++;
-      if (i >= argc) {
-        printf ("-k requires that you specify a MAC address/hostname file.\n");
+    maxPower = atoi(argv[i]);
+    return i;
+  }
+  if (strcmp(argv[i], "-t") == 0) {
+    timeMin = 1;
+    return i;
+  }
+  if (strcmp(argv[i], "-T") == 0) {
+    timeMax = 1;
+    return i;
+  }
+  if (strcmp(argv[i], "-sf") == 0) {
+    sortBy = FIRSTSEEN;
+    return i;
+  }
+  if (strcmp(argv[i], "-sl") == 0) {
+    sortBy = LASTSEEN;
+    return i;
+  }
+  if (strcmp(argv[i], "-u") == 0) {
+    i++;
+    if (i+1 >= argc) {
+      printf ("-u requires that you specify a server and port");
+      exit(1);
+    }
+    remoteserver = argv[i];
+    i++;
+    remoteport = atoi(argv[i]);
+    return i;
+  }
+  if (strcmp(argv[i], "-v") == 0) {
+    verbosity = 1;
+    return i;
+  }
+  if (strcmp(argv[i], "-vv") == 0) {
+    verbosity = 2;
+    return i;
+  }
+  if (strcmp(argv[i], "-w") == 0) {
+    i++;
+    if (i >= argc) {
+      printf ("-w requires that you specify an output prefix.\n");
+      return i;
+    }
+    filePrefix = argv[i];
+    return i;
+  }
+  if (strcmp(argv[i], "--out") == 0) {
+    char list[256];
+    char *tok;
+    i++;
+    if (i >= argc) {
+      printf ("--out requires that you specify the formats to write (text,csv,html,kml,kmz,json).\n");
+      exit(1);
+    }
+    outputs = 0;
+    strncpy (list, argv[i], sizeof(list) - 1);
+    list[sizeof(list) - 1] = '\0';
+    for (tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ",")) {
+      if (strcmp(tok, "text") == 0 || strcmp(tok, "txt") == 0) outputs |= OUT_TEXT;
+      else if (strcmp(tok, "csv") == 0) outputs |= OUT_CSV;
+      else if (strcmp(tok, "html") == 0) outputs |= OUT_HTML;
+      else if (strcmp(tok, "kml") == 0) outputs |= OUT_KML;
+      else if (strcmp(tok, "json") == 0) outputs |= OUT_JSON;
+      else if (strcmp(tok, "kmz") == 0) {
+        outputs |= OUT_KML;
+        kmzOutput = 1;
+      } else {
+        fprintf (stderr, "Error: unknown --out format: %s\n", tok);
         exit(1);
       }
-      if (verbosity) printf ("Reading known MACs.\n");
-      readKnownMacs(argv[i]);
-
-      continue;
     }
-    if (strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "-M") == 0) {
-      onlyShowKnown = 1;
-      continue;
+    return i;
+  }
+  if (strcmp(argv[i], "--html-view") == 0) {
+    htmlView = 1;
+    return i;
+  }
+  if (strcmp(argv[i], "--kmz") == 0) {
+    kmzOutput = 1;
+    return i;
+  }
+  if (strcmp(argv[i], "--kmz-tile") == 0) {
+    i++;
+    if (i >= argc) {
+      printf ("--kmz-tile requires that you specify the number of devices per tile.\n");
+      exit(1);
     }
-    if (strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "-N") == 0) {
-      onlyAddNew = 1;
-      continue;
+    kmlTileSize = atoi(argv[i]);
+    if (kmlTileSize < 1) kmlTileSize = 1;
+    return i;
+  }
+  if (strcmp(argv[i], "--no-track") == 0) {
+    showTrack = 0;
+    return i;
+  }
+  if (strcmp(argv[i], "--track-tolerance") == 0) {
+    i++;
+    if (i >= argc) {
+      printf ("--track-tolerance requires that you specify a distance in meters.\n");
+      exit(1);
     }
-    if (strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "-O") == 0) {
-      onlyAddOld = 1;
-      continue;
+    trackTolerance = atof(argv[i]);
+    return i;
+  }
+  if (strcmp(argv[i], "--heatmap") == 0) {
+    i++;
+    if (i >= argc || (strcmp(argv[i], "bssid") != 0 && strcmp(argv[i], "essid") != 0)) {
+      printf ("--heatmap requires that you specify bssid or essid.\n");
+      exit(1);
     }
-    if (strcmp(argv[i], "-p") == 0) {
-      i++;
-      if (i >= argc) {
-        printf ("-p requires that you specify a minimum power level.\n");
-        exit(1);
-      }
-      minPower = atoi(argv[i]);
-      continue;
+    heatmapKey = strcmp(argv[i], "essid") == 0 ? HEATMAP_ESSID : HEATMAP_BSSID;
+    return i;
+  }
+  if (strcmp(argv[i], "--heatmap-max") == 0) {
+    i++;
+    if (i >= argc || atoi(argv[i]) < 1) {
+      printf ("--heatmap-max requires that you specify a number of heatmaps.\n");
+      exit(1);
+    }
+    heatmapMax = atoi(argv[i]);
+    return i;
+  }
+  if (strcmp(argv[i], "--heatmap-res") == 0) {
+    i++;
+    if (i >= argc || atof(argv[i]) <= 0) {
+      printf ("--heatmap-res requires that you specify a cell size in meters.\n");
+      exit(1);
+    }
+    heatmapRes = atof(argv[i]);
+    return i;
+  }
+  if (strcmp(argv[i], "--near") == 0) {
+    i++;
+    if (i >= argc || sscanf(argv[i], "%lf,%lf,%lf", &nearLat, &nearLon, &nearRadius) != 3) {
+      printf ("--near requires that you specify lat,lon,meters\n");
+      exit(1);
     }
-    if (strcmp(argv[i], "-P") == 0) {
+    nearQuery = 1;
+    return i;
+  }
+  if (strcmp(argv[i], "-f") == 0) {
+    char err[128];
+    filterprog *prog;
+    i++;
+    if (i >= argc) {
+      printf ("-f requires that you specify a filter expression.\n");
+      exit(1);
+    }
+    // Check it now rather than after the files are read
+    prog = filterCompile (argv[i], err, sizeof(err));
+    if (prog == NULL) {
+      fprintf (stderr, "Filter error: %s\n", err);
+      exit(1);
+    }
+    filterFree (prog);
+    filterExpr = argv[i];
+    return i;
+  }
+  if (strcmp(argv[i], "--watch") == 0) {
+    watchInterval = 5;
+    if (i+1 < argc && argv[i+1][0] >= '0' && argv[i+1][0] <= '9') {
       i++;
-      if (i >= argc) {
-        printf ("-P requires that you specify a maximum power level.\n");
-        exit(1);
-      }
-      maxPower = atoi(argv[i]);
-      continue;
+      watchInterval = atoi(argv[i]);
+      if (watchInterval < 1) watchInterval = 1;
     }
-    if (strcmp(argv[i], "-t") == 0) {
-      timeMin = 1;
-      continue;
+    return i;
+  }
+  if (strcmp(argv[i], "--events") == 0) {
+    i++;
+    if (i >= argc) {
+      printf ("--events requires that you specify a file, - or udp:host:port.\n");
+      exit(1);
     }
-    if (strcmp(argv[i], "-T") == 0) {
-      timeMax = 1;
-      continue;
+    eventsTarget = argv[i];
+    return i;
+  }
+  if (strcmp(argv[i], "--depart") == 0) {
+    i++;
+    if (i >= argc) {
+      printf ("--depart requires that you specify the number of seconds.\n");
+      exit(1);
     }
-    if (strcmp(argv[i], "-sf") == 0) {
-      sortBy = FIRSTSEEN;
-      continue;
+    departAfter = atoi(argv[i]);
+    if (departAfter < 1) departAfter = 1;
+    return i;
+  }
+  if (strcmp(argv[i], "--exec") == 0 || strcmp(argv[i], "--sound") == 0) {
+    i++;
+    if (i >= argc) {
+      printf ("%s requires that you specify a %s.\n", argv[i-1], strcmp(argv[i-1], "--exec") == 0 ? "command" : "file");
+      exit(1);
     }
-    if (strcmp(argv[i], "-sl") == 0) {
-      sortBy = LASTSEEN;
-      continue;
+    if (strcmp(argv[i-1], "--exec") == 0) execCommand = argv[i];
+    else soundFile = argv[i];
+    return i;
+  }
+  if (strcmp(argv[i], "--exec-max") == 0 || strcmp(argv[i], "--exec-debounce") == 0 || strcmp(argv[i], "--exec-rate") == 0) {
+    int n;
+    i++;
+    if (i >= argc) {
+      printf ("%s requires that you specify a number.\n", argv[i-1]);
+      exit(1);
     }
-    if (strcmp(argv[i], "-u") == 0) {
-      i++;
-      if (i+1 >= argc) {
-        printf ("-u requires that you specify a server and port");
-        exit(1);
-      }
-      remoteserver = argv[i];
-      i++;
-      remoteport = atoi(argv[i]);
-      continue;
+    n = atoi(argv[i]);
+    if (strcmp(argv[i-1], "--exec-max") == 0) execMax = n < 1 ? 1 : n;
+    else if (strcmp(argv[i-1], "--exec-debounce") == 0) execDebounce = n < 0 ? 0 : n;
+    else execRate = n < 1 ? 1 : n;
+    return i;
+  }
+  if (strcmp(argv[i], "--query-socket") == 0) {
+    i++;
+    if (i >= argc) {
+      printf ("--query-socket requires that you specify a path.\n");
+      exit(1);
     }
-    if (strcmp(argv[i], "-v") == 0) {
-      verbosity = 1;
-      continue;
+    querySocket = argv[i];
+    return i;
+  }
+  if (strcmp(argv[i], "--shm") == 0) {
+    i++;
+    if (i >= argc) {
+      printf ("--shm requires that you specify a name.\n");
+      exit(1);
     }
-    if (strcmp(argv[i], "-vv") == 0) {
-      verbosity = 2;
-      continue;
+    shmName = argv[i];
+    return i;
+  }
+  if (strcmp(argv[i], "--metrics") == 0) {
+    i++;
+    if (i >= argc) {
+      printf ("--metrics requires that you specify a file or :port.\n");
+      exit(1);
     }
-    if (strcmp(argv[i], "-w") == 0) {
-      i++;
-      if (i >= argc) {
-        printf ("-w requires that you specify an output prefix.\n");
-        continue;
-      }
-      filePrefix = argv[i];
-      continue;
+    metricsTarget = argv[i];
+    return i;
+  }
+  if (strcmp(argv[i], "--stats") == 0) {
+    i++;
+    if (i >= argc || (strcmp(argv[i], "text") != 0 && strcmp(argv[i], "json") != 0)) {
+      printf ("--stats requires that you specify text or json.\n");
+      exit(1);
     }
-    // Note the lack of a continue statement after -l - this option must be last
-    lastFile = 0;
-    if (strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "-L") == 0) {
-      lastFile = 1;
-      i++;
-      if (i >= argc) {
-        printf ("-l requires that you specify an input csv file.\n");
-        exit(1);
-      }
-      fileToMonitor = argv[i];
+    statsFormat = strcmp(argv[i], "json") == 0 ? STATS_JSON : STATS_TEXT;
+    return i;
+  }
+  if (strcmp(argv[i], "--trace") == 0) {
+    i++;
+    if (i >= argc) {
+      printf ("--trace requires that you specify a file.\n");
+      exit(1);
     }
-    if (verbosity) printf ("Reading CSV file: %s\n", argv[i]);
-    dset = readCSVFile (argv[i], firstAp, firstEnddev, lastFile);
-    firstAp = dset.s;
-    firstEnddev = dset.e;
-    numInputFiles++;
-    if (verbosity >= 2) printf ("Finished reading CSV file.\n");
+    traceFile = argv[i];
+    return i;
   }
+  if (strcmp(argv[i], "--trace-decode") == 0) {
+    i++;
+    if (i >= argc) {
+      printf ("--trace-decode requires that you specify a file.\n");
+      exit(1);
+    }
+    exit (traceDecode (argv[i]) ? 0 : 1);
+  }
+  if (strcmp(argv[i], "--profiles") == 0) {
+    i++;
+    if (i >= argc) {
+      printf ("--profiles requires that you specify a profile file.\n");
+      exit(1);
+    }
+    profilesFile = argv[i];
+    return i;
+  }
+  if (strcmp(argv[i], "--bbox") == 0) {
+    i++;
+    if (i >= argc || sscanf(argv[i], "%lf,%lf,%lf,%lf", bbox, bbox+1, bbox+2, bbox+3) != 4) {
+      printf ("--bbox requires that you specify south,west,north,east\n");
+      exit(1);
+    }
+    bboxQuery = 1;
+    return i;
+  }
+  return -1;
+}
 
-  // Check for show stoppers
-  if (numInputFiles == 0) {
-    fprintf (stderr, "Error: no input files specified.\n");
-    exit(1);
+// Free a linked list of macdb entries
+void free_macdb (macdb *m) {
+  if (m == NULL) return;
+  free_macdb(m->next);
+  memSub (MEM_ENRICH, sizeof(macdb));
+  free(m);
+}
+
+static struct stat loadedKnownMacsStat, loadedKnownIPsStat;
+
+// Returns 1 if a table file (fileName) is the one loaded (loaded) and
+// its size and modification time are still what they were then (st)
+static int sameTableFile (const char *fileName, const char *loaded, const struct stat *st) {
+  struct stat now;
+
+  if (fileName == NULL || loaded == NULL) return fileName == loaded;
+  if (strcmp(fileName, loaded) != 0) return 0;
+  // Gone: keep what was read
+  if (stat (fileName, &now) != 0) return 1;
+  return now.st_size == st->st_size && now.st_mtim.tv_sec == st->st_mtim.tv_sec &&
+    now.st_mtim.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+// Reads the known MAC (-k) and known IP (-i) files if they are not
+// the ones already loaded, or were changed since (--watch)
+// Returns 1 if either table changed
+int loadTables (void) {
+  int changed = 0;
+
+  if (!sameTableFile(knownMacsFile, loadedKnownMacs, &loadedKnownMacsStat)) {
+    if (known_macs) memSub (MEM_ENRICH, (known_macs_sz ? known_macs_sz : 1) * sizeof(macdb));
+    free(known_macs);
+    known_macs = NULL;
+    known_macs_sz = 0;
+    if (knownMacsFile) {
+      stat (knownMacsFile, &loadedKnownMacsStat);
+      if (verbosity) printf ("Reading known MACs.\n");
+      phaseBegin (PHASE_KNOWN_MACS);
+      readKnownMacs(knownMacsFile);
+      phaseEnd (PHASE_KNOWN_MACS);
+    }
+    loadedKnownMacs = knownMacsFile;
+    changed = 1;
+  }
+  if (!sameTableFile(knownIPsFile, loadedKnownIPs, &loadedKnownIPsStat)) {
+    free_macdb(known_ips);
+    known_ips = NULL;
+    if (knownIPsFile) {
+      stat (knownIPsFile, &loadedKnownIPsStat);
+      phaseBegin (PHASE_KNOWN_IPS);
+      readKnownIPs(knownIPsFile);
+      phaseEnd (PHASE_KNOWN_IPS);
+    }
+    loadedKnownIPs = knownIPsFile;
+    changed = 1;
+  }
+  if (changed) tableGeneration++;
+  return changed;
+}
+
+// Brings the description and IP address of every AP and Enddev up to date
+// (after the known MAC or IP tables change)
+void enrichDevices (ap *firstAp, enddev *firstEnddev) {
+  ap *a;
+  enddev *e;
+
+  for (a = firstAp; a != NULL; a = a->next) enrichAp (a);
+  for (e = firstEnddev; e != NULL; e = e->next) enrichEnddev (e);
+}
+
+// One output format to print, see renderOutput
+typedef struct renderjob {
+  int format; // OUT_TEXT, OUT_CSV, OUT_HTML, OUT_KML or OUT_JSON
+  int phase; // PHASE_RENDER_ for it
+  FILE *f;
+  ap **aps;
+  int apCount;
+  enddev **stas;
+  int staCount;
+} renderjob;
+
+// Prints a whole output file (job->f) in one format from the sorted,
+// selected devices.  Only reads the devices, so the formats can be
+// printed at the same time.
+static void renderOutput (renderjob *job) {
+  FILE *f = job->f;
+  int i;
+
+  phaseBegin (job->phase);
+  switch (job->format) {
+  case OUT_TEXT:
+    for (i=0; i < job->apCount; i++) printAPToFileText (job->aps[i], f);
+    for (i=0; i < job->staCount; i++) printEndDeviceToFileText (job->stas[i], f);
+    break;
+  case OUT_CSV:
+    if (showAPs) {
+      fprintf (f, "%sBSSID, First time seen, Last time seen, channel, Speed, Privacy, Cipher, Authentication, "
+        "Power, # beacons, # IV, LAN IP, ID-Length, ESSID, Key%s", CRLF, CRLF);
+      for (i=0; i < job->apCount; i++) printAPToFileCSV (job->aps[i], f);
+      fprintf (f, "%s", CRLF);
+    }
+    if (showEnddevs) {
+      fprintf (f, "Station MAC, First time seen, Last time seen, Power, # packets, BSSID, Probed ESSIDs%s", CRLF);
+      for (i=0; i < job->staCount; i++) printEndDeviceToFileCSV (job->stas[i], f);
+      fprintf (f, "%s", CRLF);
+    }
+    break;
+  case OUT_HTML:
+    if (htmlView) {
+      printHTMLView (f, job->aps, job->apCount, job->stas, job->staCount);
+      break;
+    }
+    if (showAPs) {
+      fprintf (f, "<html>%s<head></head><body>%s<table border=\"1\">%s", CRLF, CRLF, CRLF);
+      fprintf (f, "<tr><td>BSSID</td><td>Vendor</td><td>First time seen</td><td>Last time seen</td><td>Prev time seen</td><td>channel</td><td>Speed</td><td>Privacy</td><td>Cipher</td><td>Authentication</td>"
+        "<td>Power</td><td># beacons</td><td># IV</td><td>LAN IP</td><td>ID-Length</td><td>ESSID</td><td>Key</td><td>Description</td><td>IP Address</td></tr>%s", CRLF);
+      for (i=0; i < job->apCount; i++) printAPToFileHTML (job->aps[i], f);
+    }
+    if (showEnddevs) {
+      fprintf (f, "</table><table border=\"1\"><tr><td>Station MAC</td><td>Vendor</td><td>First time seen</td><td>Last time seen</td><td>Previous time seen</td><td>Power</td>"
+        "<td># packets</td><td>BSSID</td><td>channel</td><td>ESSID</td><td>Probes</td><td>Description</td><td>IP Address</td></tr>%s", CRLF);
+      for (i=0; i < job->staCount; i++) printEndDeviceToFileHTML (job->stas[i], f);
+    }
+    fprintf (f, "</table>%s</body>%s</html>", CRLF, CRLF);
+    break;
+  case OUT_KML:
+    fprintf (f, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\r\n<kml xmlns=\"http://www.opengis.net/kml/2.2\">\r\n<Document>\r\n");
+    for (i=0; i < job->apCount; i++) printAPToFileKML (job->aps[i], f);
+    for (i=0; i < job->staCount; i++) printEndDeviceToFileKML (job->stas[i], f);
+    if (showTrack) printTrackToFileKML (gpsFile, f, trackTolerance);
+    fprintf (f, "</Document>\r\n</kml>\r\n");
+    break;
+  case OUT_JSON:
+    printDevicesJSON (f, job->aps, job->apCount, job->stas, job->staCount);
+    break;
   }
+  phaseEnd (job->phase);
+}
+
+static void *renderThread (void *arg) {
+  renderOutput ((renderjob *) arg);
+  return NULL;
+}
+
+// Opens [prefix][ext] for writing
+// It is printed into memory and written by the writer thread (writer.c)
+static FILE *openOutput (const char *ext) {
+  char fileName[256];
+
+  snprintf (fileName, sizeof(fileName), "%s%s", filePrefix, ext);
+  if (verbosity) printf ("Opening %s\n", fileName);
+  return outputOpen (fileName);
+}
+
+// Closes a state file (f) that was written, counting its bytes
+static void closeStateFile (FILE *f) {
+  long n = ftell (f);
+
+  if (n > 0) __atomic_fetch_add (&counters[COUNTER_BYTES_WRITTEN], n, __ATOMIC_RELAXED);
+  fclose (f);
+}
+
+// Reads and writes the state files and writes the outputs for the
+// current options (-w prefix)
+void runProfile (ap *firstAp, enddev *firstEnddev) {
+  int i;
+  gps *gps1 = NULL;
+  FILE *tmpFile = NULL;
+  char buffer[256];
+
   if (filePrefix == NULL) {
     printf ("Please specify an output prefix (-w option).\n");
     exit(1);
@@ -2647,135 +3069,188 @@ int main (int argc, char **argv) {
   strcat (buffer, filePrefix);
   strcat (buffer, "-appower.csv");
   if (verbosity) printf ("Opening file: %s\n", buffer);
+  phaseBegin (PHASE_STATE_LOAD);
   tmpFile = fopen(buffer, "r");
   if (tmpFile) {
     readAPPowerFromFile (firstAp, tmpFile);
     fclose (tmpFile);
   }
+  phaseEnd (PHASE_STATE_LOAD);
+  phaseBegin (PHASE_STATE_SAVE);
   tmpFile = fopen(buffer, "w");
   printAPPowerToFileRec (firstAp, tmpFile);
   if (verbosity >= 2) printf("printAPPowerToFileRec done\n");
-  fclose(tmpFile);
+  closeStateFile (tmpFile);
+  phaseEnd (PHASE_STATE_SAVE);
 
   strcpy (buffer, "");
   strcat (buffer, filePrefix);
   strcat (buffer, "-stapower.csv");
   if (verbosity) printf ("Opening file: %s\n", buffer);
+  phaseBegin (PHASE_STATE_LOAD);
   tmpFile = fopen(buffer, "r");
   if (tmpFile) {
     readEnddevPowerFromFile (firstEnddev, tmpFile);
     fclose (tmpFile);
   }
+  phaseEnd (PHASE_STATE_LOAD);
+  phaseBegin (PHASE_STATE_SAVE);
   tmpFile = fopen(buffer, "w");
   printEndDevicesPowerToFileRec (firstEnddev, tmpFile);
-  fclose(tmpFile);
+  closeStateFile (tmpFile);
+  phaseEnd (PHASE_STATE_SAVE);
+
+  // Power and last time seen from the last run, in place of an older csv file
+  if (lastInputFile) {
+    strcpy (buffer, "");
+    strcat (buffer, filePrefix);
+    strcat (buffer, "-last.csv");
+    if (useLastState) {
+      if (verbosity) printf ("Opening file: %s\n", buffer);
+      phaseBegin (PHASE_STATE_LOAD);
+      tmpFile = fopen(buffer, "r");
+      if (tmpFile) {
+        readLastFromFile (tmpFile);
+        fclose (tmpFile);
+      }
+      phaseEnd (PHASE_STATE_LOAD);
+    }
+    phaseBegin (PHASE_STATE_SAVE);
+    tmpFile = fopen(buffer, "w");
+    if (tmpFile) {
+      printLastToFile (firstAp, firstEnddev, tmpFile);
+      closeStateFile (tmpFile);
+    } else {
+      fprintf (stderr, "Error opening %s\n", buffer);
+    }
+    phaseEnd (PHASE_STATE_SAVE);
+  }
 
   if (gpsFile) tmpFile = fopen(gpsFile, "r");
   if (gpsFile && tmpFile) {
     if (verbosity) printf ("Opening file: %s\n", gpsFile);
+    phaseBegin (PHASE_GPS);
     gps1 = readGPSFile(firstAp, firstEnddev, tmpFile);
+    phaseEnd (PHASE_GPS);
+    phaseBegin (PHASE_ADD_GPS);
     addGPSInfo (firstAp, firstEnddev, gps1);
+    phaseEnd (PHASE_ADD_GPS);
+    if (heatmapKey) writeHeatmaps (filePrefix, gps1);
     free_gps(gps1);
   }
 
+  if (nearQuery || bboxQuery) {
+    spatialindex *si;
+    spatialentry **res;
+    double *dist;
+    int n;
+
+    if (!gpsFile) fprintf (stderr, "Warning: --near and --bbox need GPS info (-g)\n");
+    si = spatialBuild (firstAp, firstEnddev, showAPs, showEnddevs);
+    if (nearQuery) {
+      n = spatialQueryRadius (si, nearLat, nearLon, nearRadius, &res, &dist);
+      for (i=0; i < n; i++) printSpatialEntry (res[i], dist[i], stdout);
+      free (res);
+      free (dist);
+    }
+    if (bboxQuery) {
+      n = spatialQueryBox (si, bbox[0], bbox[1], bbox[2], bbox[3], &res);
+      for (i=0; i < n; i++) printSpatialEntry (res[i], -1, stdout);
+      free (res);
+    }
+    spatialFree (si);
+  }
+
   // read last time displayed
   strcpy (buffer, "");
   strcat (buffer, filePrefix);
   strcat (buffer, "-printed.csv");
   if (verbosity) printf ("Opening file: %s\n", buffer);
+  phaseBegin (PHASE_STATE_LOAD);
   tmpFile = fopen(buffer, "r");
   if (tmpFile) {
     readEnddevDisplayedFromFile (firstEnddev, tmpFile);
     fclose (tmpFile);
   }
+  phaseEnd (PHASE_STATE_LOAD);
 
 //  csvFile = htmlFile = kmlFile = NULL;
 
-  if (textFile != stdout) {
+  // Decide once what every output shows
+  phaseBegin (PHASE_SELECT);
+  selectDevices (firstAp, firstEnddev);
+  phaseEnd (PHASE_SELECT);
+
+  if (textFile != stdout && (outputs & OUT_TEXT)) textFile = openOutput (".txt");
+  if (outputs & OUT_CSV) csvFile = openOutput (".csv");
+  if (outputs & OUT_HTML) htmlFile = openOutput (".html");
+  if ((outputs & OUT_KML) && gpsFile && !kmzOutput) kmlFile = openOutput (".kml");
+  if (outputs & OUT_JSON) jsonFile = openOutput (".jsonl");
+
+  if (csvFile || textFile || htmlFile || kmlFile || jsonFile) {
+    FILE *files[5] = { textFile, csvFile, htmlFile, kmlFile, jsonFile };
+    int formats[5] = { OUT_TEXT, OUT_CSV, OUT_HTML, OUT_KML, OUT_JSON };
+    int phases[5] = { PHASE_RENDER_TEXT, PHASE_RENDER_CSV, PHASE_RENDER_HTML, PHASE_RENDER_KML, PHASE_RENDER_JSON };
+    renderjob jobs[5];
+    pthread_t threads[5];
+    int started[5];
+    ap **aps = NULL;
+    enddev **stas = NULL;
+    int apCount = 0, staCount = 0, n = 0;
+
+    // Sorted once, then every format is printed from it by its own thread
+    phaseBegin (PHASE_SORT);
+    if (showAPs) aps = sortAPsToPrint (firstAp, &apCount);
+    if (showEnddevs) stas = sortEndDevicesToPrint (firstEnddev, &staCount);
+    phaseEnd (PHASE_SORT);
+    for (i=0; i < 5; i++) {
+      if (files[i] == NULL) continue;
+      jobs[n].format = formats[i];
+      jobs[n].phase = phases[i];
+      jobs[n].f = files[i];
+      jobs[n].aps = aps;
+      jobs[n].apCount = apCount;
+      jobs[n].stas = stas;
+      jobs[n].staCount = staCount;
+      n++;
+    }
+    if (verbosity) printf ("Printing %d APs and %d Stations to %d files\n", apCount, staCount, n);
+    for (i=1; i < n; i++) started[i] = pthread_create (&threads[i], NULL, renderThread, &jobs[i]) == 0;
+    renderOutput (&jobs[0]);
+    for (i=1; i < n; i++) {
+      if (started[i]) pthread_join (threads[i], NULL);
+      else renderOutput (&jobs[i]); // no thread for it, print it here
+    }
+    free (aps);
+    free (stas);
+  }
+  if (verbosity >= 2) printf("Done printing regular files\n");
+  if ((outputs & OUT_KML) && gpsFile && kmzOutput) {
     strcpy (buffer, "");
     strcat (buffer, filePrefix);
-    strcat (buffer, ".txt");
-    if (verbosity) printf ("Opening %s\n", buffer);
-    textFile = fopen(buffer, "w");
-  }
-
-  strcpy (buffer, "");
-  strcat (buffer, filePrefix);
-  strcat (buffer, ".csv");
-  if (verbosity) printf ("Opening %s\n", buffer);
-  csvFile = fopen(buffer, "w");
-
-  strcpy (buffer, "");
-  strcat (buffer, filePrefix);
-  strcat (buffer, ".html");
-  if (verbosity) printf ("Opening %s\n", buffer);
-  htmlFile = fopen(buffer, "w");
-
-  if (gpsFile) {
-    strcpy (buffer, "");
-    strcat (buffer, filePrefix);
-    strcat (buffer, ".kml");
-    if (verbosity) printf ("Opening %s\n", buffer);
-    kmlFile = fopen (buffer, "w");
-  }
-
-/*
-  if (textFile != NULL) {
-    if (showAPs) printAPsToFileText (firstAp, textFile);
-    if (showEnddevs) printEndDevicesToFileText (firstEnddev, textFile);
-    if (textFile != stdout) fclose (textFile);
-  }
-*/
-
-  if (csvFile && htmlFile && textFile) {
-    if (gpsFile) {
-      fprintf (kmlFile, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\r\n<kml xmlns=\"http://www.opengis.net/kml/2.2\">\r\n<Document>\r\n");
-    }
-    if (showAPs) {
-      fprintf (csvFile, "%sBSSID, First time seen, Last time seen, channel, Speed, Privacy, Cipher, Authentication, "
-      "Power, # beacons, # IV, LAN IP, ID-Length, ESSID, Key%s", CRLF, CRLF);
-      fprintf (htmlFile, "<html>%s<head></head><body>%s<table border=\"1\">%s", CRLF, CRLF, CRLF);
-      fprintf (htmlFile, "<tr><td>BSSID</td><td>Vendor</td><td>First time seen</td><td>Last time seen</td><td>Prev time seen</td><td>channel</td><td>Speed</td><td>Privacy</td><td>Cipher</td><td>Authentication</td>"
-        "<td>Power</td><td># beacons</td><td># IV</td><td>LAN IP</td><td>ID-Length</td><td>ESSID</td><td>Key</td><td>Description</td><td>IP Address</td></tr>%s", CRLF);
-
-      if (verbosity) printf ("Printing APs to files\n");
-      printAPsToFileRec (firstAp);
-    }
-    if (showEnddevs) {
-      fprintf (csvFile, "Station MAC, First time seen, Last time seen, Power, # packets, BSSID, Probed ESSIDs%s", CRLF);
-      fprintf (htmlFile, "</table><table border=\"1\"><tr><td>Station MAC</td><td>Vendor</td><td>First time seen</td><td>Last time seen</td><td>Previous time seen</td><td>Power</td>"
-        "<td># packets</td><td>BSSID</td><td>channel</td><td>ESSID</td><td>Probes</td><td>Description</td><td>IP Address</td></tr>%s", CRLF);
-      if (verbosity) printf ("Printing Stations to files\n");
-      printEndDevicesToFileRec (firstEnddev);
-    }
-    fprintf (htmlFile, "</table>%s</body>%s</html>", CRLF, CRLF);
-    if (verbosity >= 2) printf("Done printing regular files\n");
-    if (gpsFile) {
-      if (verbosity >= 2) printf("Closing KML file\n");
-      fprintf (kmlFile, "</Document>\r\n</kml>\r\n");
-      fclose (kmlFile);
-    }
-/*
-    fclose (csvFile);
-    fclose (htmlFile);
-    fclose (textFile);
-*/
-    if (verbosity) printf ("Closed files\n");
+    strcat (buffer, ".kmz");
+    if (verbosity) printf ("Writing %s\n", buffer);
+    phaseBegin (PHASE_RENDER_KMZ);
+    writeKMZ (buffer, firstAp, firstEnddev, showAPs, showEnddevs, showTrack ? gpsFile : NULL);
+    phaseEnd (PHASE_RENDER_KMZ);
   }
+  if (verbosity) printf ("Closed files\n");
 
   // write last time displayed
   strcpy (buffer, "");
   strcat (buffer, filePrefix);
   strcat (buffer, "-printed.csv");
   if (verbosity) printf ("Opening file for writing: %s\n", buffer);
+  phaseBegin (PHASE_STATE_SAVE);
   tmpFile = fopen(buffer, "w");
   if (tmpFile) {
     printEndDevicesDisplayedToFile (firstEnddev, tmpFile);
-    fclose(tmpFile);
+    closeStateFile (tmpFile);
   } else {
     fprintf (stderr, "Error opening %s\n", buffer);
     perror("main");
   }
+  phaseEnd (PHASE_STATE_SAVE);
 
 /*
   if (htmlFile != NULL) {
@@ -2810,6 +3285,251 @@ int main (int argc, char **argv) {
   }
 */
 //  printf("Collisions: %d\n", collisions);
+
+  // The writer thread writes them out while we carry on
+  outputCommit ();
+  csvFile = htmlFile = kmlFile = jsonFile = NULL;
+  if (textFile == stdout) {
+    fflush (stdout);
+  } else {
+    textFile = NULL;
+  }
+}
+
+// Writes the outputs, once for each profile if there are any
+static void runOutputs (int argc, char **argv, ap *firstAp, enddev *firstEnddev) {
+  if (profilesFile) {
+    runProfiles (profilesFile, argc, argv, firstAp, firstEnddev);
+  } else {
+    if (loadTables ()) enrichDevices (firstAp, firstEnddev);
+    runProfile (firstAp, firstEnddev);
+  }
+}
+
+// Goes through the options once to find the input files and works out
+// their stamp (see stamp.c), then sets the options back to their defaults
+// for the real pass.  stampFile is set to [prefix]-stamp, or "" if there
+// isn't a prefix or csvtools keeps running with --watch.
+// usesClock is set if the selection depends on the time (-t, -T, or age
+// or displayed in -f), in which case the same input can give new results.
+// Returns 1 if nothing changed since the run that wrote the stamp file
+static int stampInputs (int argc, char **argv, char *stampFile, size_t len, int *usesClock) {
+  int i, j, same = 0, verbose;
+
+  stampBegin (argc, argv);
+  for (i = 1; i < argc; i++) {
+    j = parseOption (argc, argv, i);
+    if (j >= 0) {
+      i = j;
+      continue;
+    }
+    if (strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "-L") == 0) i++;
+    if (i < argc) stampAddFile (argv[i]);
+  }
+  stampAddFile (gpsFile);
+  stampAddFile (knownMacsFile);
+  stampAddFile (knownIPsFile);
+  stampAddFile (profilesFile);
+  stampFile[0] = '\0';
+  if (filePrefix != NULL && watchInterval == 0) snprintf (stampFile, len, "%s-stamp", filePrefix);
+  verbose = verbosity;
+  *usesClock = profilesFile ? profilesStamp (profilesFile, argc, argv) : filterUsesClock ();
+  // Departures happen with nothing new in the files
+  if (eventsTarget) *usesClock = 1;
+
+  if (stampFile[0]) {
+    // Hashes the files now, before they are read, even without a stamp
+    stampLoad (stampFile);
+    same = stampUnchanged () && !*usesClock;
+    if (verbose && same) printf ("Input files unchanged since the last run, nothing to do\n");
+  }
+  setDefaultOptions ();
+  return same;
+}
+
+// Exits if options that only work together were given apart, before the
+// first pass writes anything
+static void checkOptions (int argc, char **argv) {
+  int i, j, last = 0;
+
+  for (i = 1; i < argc; i++) {
+    j = parseOption (argc, argv, i);
+    if (j >= 0) {
+      i = j;
+      continue;
+    }
+    if (strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "-L") == 0) last = 1;
+  }
+  if (watchInterval > 0 && !last) {
+    fprintf (stderr, "Error: --watch needs the file to watch (-l)\n");
+    exit(1);
+  }
+  if (querySocket && watchInterval == 0) {
+    fprintf (stderr, "Error: --query-socket needs --watch\n");
+    exit(1);
+  }
+  if (metricsTarget && metricsTarget[0] == ':' && watchInterval == 0) {
+    fprintf (stderr, "Error: --metrics :port needs --watch\n");
+    exit(1);
+  }
+  setDefaultOptions ();
+}
+
+// --stats with --watch
+static volatile sig_atomic_t statsWanted;
+
+static void onSigusr1 (int sig) {
+  statsWanted = 1;
+}
+
+// --trace with --watch
+static volatile sig_atomic_t traceWanted;
+
+static void onSigusr2 (int sig) {
+  traceWanted = 1;
+}
+
+int main (int argc, char **argv) {
+  int i, j, lastFile;
+  ap *firstAp = NULL;
+  enddev *firstEnddev = NULL;
+  devset dset;
+  FILE *tmpFile = NULL;
+  char *fileToMonitor = NULL;
+  char stampFile[256];
+  int usesClock;
+//  int continuous = 0; //boolean
+
+  // Set the default values
+  setDefaultOptions();
+  numInputFiles = 0;
+  ap_count = 0;
+  sta_count = 0;
+  extraStaCt = 0;
+  collisions = 0;
+  kmlFile = NULL; // 2018-03-24
+  memAdd (MEM_HASH, sizeof(aptable) + sizeof(statable));
+
+  if (argc < 2) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  checkOptions (argc, argv);
+  // Skip the whole run if tracker.sh calls us again with nothing new
+  if (stampInputs (argc, argv, stampFile, sizeof(stampFile), &usesClock)) return 0;
+
+  tmpFile = fopen("/usr/share/aircrack-ng/airodump-ng-oui.txt", "r");
+  if (tmpFile) {
+    fclose(tmpFile);
+    phaseBegin (PHASE_MAC_DB);
+    readMacDB ("/usr/share/aircrack-ng/airodump-ng-oui.txt");
+    phaseEnd (PHASE_MAC_DB);
+//    printf("reading /usr/share/aircrack-ng/airodump-ng-oui.txt\n");
+  } else if (tmpFile = fopen("/etc/aircrack-ng/airodump-ng-oui.txt", "r")) {
+    fclose(tmpFile);
+    phaseBegin (PHASE_MAC_DB);
+    readMacDB ("/etc/aircrack-ng/airodump-ng-oui.txt");
+    phaseEnd (PHASE_MAC_DB);
+//    printf("reading /etc/aircrack-ng/airodump-ng-oui.txt\n");
+  } 
+
+  phaseBegin (PHASE_PASS);
+
+  for (i = 1; i < argc; i++) {
+    j = parseOption (argc, argv, i);
+    if (j >= 0) {
+      i = j;
+      continue;
+    }
+    // Note the lack of a continue statement after -l - this option must be last
+    lastFile = 0;
+    if (strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "-L") == 0) {
+      lastFile = 1;
+      i++;
+      if (i >= argc) {
+        printf ("-l requires that you specify an input csv file.\n");
+        exit(1);
+      }
+      fileToMonitor = argv[i];
+      lastInputFile = argv[i];
+    }
+    // Pick up any -k/-i given before this file
+    loadTables ();
+    if (verbosity) printf ("Reading CSV file: %s\n", argv[i]);
+    dset = readCSVFile (argv[i], firstAp, firstEnddev, lastFile);
+    firstAp = dset.s;
+    firstEnddev = dset.e;
+    numInputFiles++;
+    if (verbosity >= 2) printf ("Finished reading CSV file.\n");
+  }
+
+  // Check for show stoppers
+  if (numInputFiles == 0) {
+    fprintf (stderr, "Error: no input files specified.\n");
+    exit(1);
+  }
+
+  // With only the -l file, the last run's state stands in for an older file
+  useLastState = numInputFiles == 1 && lastInputFile != NULL;
+  runOutputs (argc, argv, firstAp, firstEnddev);
+  if (eventsTarget) writeEvents ();
+  if (querySocket) queryPublish (firstAp, firstEnddev);
+  if (shmName) shmPublish (firstAp, firstEnddev);
+  udpFlush ();
+  execPoll ();
+  phaseEnd (PHASE_PASS);
+  metricsPass ();
+  if (stampFile[0]) {
+    // Only once the outputs are really there
+    outputFinish ();
+    stampSave (stampFile);
+  }
+
+  // The last read stays in memory, so each pass only reads the -l file
+  useLastState = 0;
+  if (statsFormat) signal (SIGUSR1, onSigusr1);
+  if (traceFile) signal (SIGUSR2, onSigusr2);
+  while (watchInterval > 0) {
+    execSleep (watchInterval);
+    if (statsWanted) {
+      statsWanted = 0;
+      printStats (stderr, statsFormat == STATS_JSON, firstAp, firstEnddev);
+    }
+    if (traceWanted) {
+      traceWanted = 0;
+      traceWrite ();
+    }
+    // Same check as [prefix]-stamp, but against the last pass
+    stampBegin (argc, argv);
+    stampAddFile (lastInputFile);
+    stampAddFile (knownMacsFile);
+    stampAddFile (knownIPsFile);
+    if (!usesClock && stampUnchanged ()) {
+      if (verbosity) printf ("%s unchanged\n", lastInputFile);
+      continue;
+    }
+    phaseBegin (PHASE_PASS);
+    startNextRead (firstAp, firstEnddev);
+    if (verbosity) printf ("Reading CSV file: %s\n", lastInputFile);
+    dset = readCSVFile (lastInputFile, firstAp, firstEnddev, 1);
+    firstAp = dset.s;
+    firstEnddev = dset.e;
+    runOutputs (argc, argv, firstAp, firstEnddev);
+    if (eventsTarget) writeEvents ();
+    if (querySocket) queryPublish (firstAp, firstEnddev);
+    if (shmName) shmPublish (firstAp, firstEnddev);
+    udpFlush ();
+    execPoll ();
+    phaseEnd (PHASE_PASS);
+    metricsPass ();
+  }
+
+  traceWrite ();
+  outputFinish ();
+  execFinish ();
+  if (querySocket) queryFinish ();
+  if (statsFormat) printStats (stderr, statsFormat == STATS_JSON, firstAp, firstEnddev);
   if (verbosity) printf ("Freeing up memory\n");
   free_ap(firstAp);
   free_enddev(firstEnddev);
@@ -21,8 +21,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h> // Initially added to see what time it is
+#include <math.h>
 
-// Added for execlp in the play_sound function
+// fork and exec (exec.c), sockets (udp.c)
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -33,6 +34,93 @@
 #define FIRSTSEEN 2
 #define LASTSEEN 3
 #define HASHTABLE_SZ 65535  // currently 2 bytes
+#define SPATIAL_CELL_SIZE 0.001 // degrees, about 110m of latitude
+#define HEATMAP_BSSID 1
+#define HEATMAP_ESSID 2
+#define MINTIME (30 * 60) // seconds, for -t
+#define MAXTIME (365 * 24 * 60 * 60) // seconds, for -T
+#define EVENT_DEPART_SECS 60 // --depart default
+#define EVENT_CLOSER_DB 10 // power rise for a closer event without -d
+#define HASH64_INIT 14695981039346656037ULL // FNV-1a offset basis, see hash64()
+#define OUT_TEXT 1 // --out formats
+#define OUT_CSV 2
+#define OUT_HTML 4
+#define OUT_KML 8 // or KMZ with --kmz
+#define OUT_JSON 16
+
+// Parts of a pass timed for --metrics and --stats (metrics.c)
+#define PHASE_PARSE 0 // readCSVFile
+#define PHASE_ENRICH 1 // vendor, description and IP lookups
+#define PHASE_STATE_LOAD 2 // power, last and printed files
+#define PHASE_STATE_SAVE 3
+#define PHASE_GPS 4 // readGPSFile
+#define PHASE_ADD_GPS 5 // addGPSInfo
+#define PHASE_SELECT 6
+#define PHASE_SORT 7
+#define PHASE_RENDER_TEXT 8
+#define PHASE_RENDER_CSV 9
+#define PHASE_RENDER_HTML 10
+#define PHASE_RENDER_KML 11
+#define PHASE_RENDER_JSON 12
+#define PHASE_RENDER_KMZ 13
+#define PHASE_EVENTS 14
+#define PHASE_MAC_DB 15 // readMacDB
+#define PHASE_KNOWN_MACS 16 // readKnownMacs
+#define PHASE_KNOWN_IPS 17 // readKnownIPs
+#define PHASE_PASS 18
+#define PHASE_COUNT 19
+
+// Counters for --metrics and --stats (counters[])
+#define COUNTER_PASSES 0
+#define COUNTER_UDP_ALERTS 1
+#define COUNTER_EXEC_ALERTS 2
+#define COUNTER_EVENTS 3
+#define COUNTER_HASH_LOOKUPS 4 // findApHT and findStaHT
+#define COUNTER_HASH_PROBES 5 // entries they compared
+#define COUNTER_BYTES_READ 6
+#define COUNTER_BYTES_WRITTEN 7 // by the writer thread too
+#define COUNTER_COUNT 8
+
+#define STATS_TEXT 1 // --stats formats
+#define STATS_JSON 2
+
+// Parts of csvtools whose memory --stats counts (memAdd, memSub)
+#define MEM_PARSER 0 // readCSVFile and readFileToString buffers
+#define MEM_DEVICES 1 // ap and enddev records
+#define MEM_HASH 2 // aptable, statable and their chains
+#define MEM_ENRICH 3 // the OUI table, known MACs and known IPs
+#define MEM_GPS 4 // readGPSFile
+#define MEM_STATE 5 // extraSta
+#define MEM_OUTPUT 6 // outputs waiting for the writer thread
+#define MEM_COUNT 7
+
+// --trace events (see trace.c)
+#define TRACE_PASS 1 // end of a pass, arg: passes so far
+#define TRACE_BEGIN 2 // arg: phase
+#define TRACE_END 3
+#define TRACE_FILE 4 // readCSVFile, arg: traceName of the file
+#define TRACE_FILE_DONE 5 // arg: rows
+#define TRACE_AP_ROW 6 // arg: 1 if the row hadn't changed
+#define TRACE_AP_NEW 7 // arg: new (only in the -l file)
+#define TRACE_STA_ROW 8
+#define TRACE_STA_NEW 9
+#define TRACE_AP_ADD 10 // arg: entries in the chain before it
+#define TRACE_STA_ADD 11
+#define TRACE_AP_HIT 12 // arg: entries compared
+#define TRACE_AP_MISS 13
+#define TRACE_STA_HIT 14
+#define TRACE_STA_MISS 15
+#define TRACE_BAD_MAC 16 // getMacHash, arg: the char that was wrong, 17 if short
+#define TRACE_AP_POWER 17 // a row of -appower.csv read back, arg: 1 if its AP was found
+#define TRACE_STA_POWER 18 // a row of -stapower.csv read back, arg: 1 if its station was found
+#define TRACE_PRINTED 19 // a row of -printed.csv read back, arg: 1 if its station was found
+#define TRACE_AP_POWER_OUT 20 // a row written to -appower.csv
+#define TRACE_PRINTED_OUT 21 // a row written to -printed.csv, arg: 1 for a station not in this run
+#define TRACE_STA_SORT 22 // sortEndDevicesToPrint, arg: index, no MAC if the list ended early
+#define TRACE_EVENTS 23
+
+// Costs a test of traceFile without --trace
+#define TRACE(event, mac, arg) do { if (traceFile) traceEvent ((event), (mac), (arg)); } while (0)
 
 /* I decided it was easier to write my own than use the library.
  * Used by the program to compare dates, not for output.
@@ -46,6 +134,23 @@ typedef struct datetime {
   int second;
 } datetime;
 
+// A timer in a timerwheel (wheel.c), kept in what it times
+typedef struct timer {
+  long long when; // second it goes off
+  struct timer *next;
+  struct timer **pprev; // NULL if not set
+} timer;
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4 // reaches 64^4 seconds, about 194 days
+
+typedef struct timerwheel {
+  long long now; // second it has got to
+  int count; // timers set
+  timer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+} timerwheel;
+
 typedef struct gps {
   datetime dt;
   double lat;
@@ -90,6 +195,11 @@ typedef struct ap {
   double lon;
   int new;
   int old;
+  int selected; // set by selectDevices
+  unsigned long long rowHash; // of the csv row it was last read from
+  int enrichGen; // tableGeneration when vendor, desc and ip were looked up, -1 never
+  int eventsQueued; // read since the last --events pass
+  timer departTimer; // --events, goes off when the AP departs
   struct ap *next;
 } ap;
 
@@ -101,6 +211,7 @@ typedef struct enddev {
   char last_time_seen[80];
   char prev_last_time_seen[80];
   char last_time_displayed[80];
+  char prev_last_time_displayed[80]; // before this run
   int power;
   char packets[80];
   char bssid[80];
@@ -122,6 +233,12 @@ typedef struct enddev {
   double lon;
   int new;
   int old;
+  int selected; // set by selectDevices
+  unsigned long long rowHash; // of the csv row it was last read from
+  int enrichGen; // tableGeneration when vendor, desc and ip were looked up, -1 never
+  int eventsQueued; // read since the last --events pass
+  timer departTimer; // --events, goes off when the station departs
+  long long execTime; // when --exec/--sound last ran for it, 0 never
   struct enddev *next;
 } enddev;
 
@@ -148,6 +265,81 @@ typedef struct stalist {
   struct stalist *next;
 } stalist;
 
+// Spatial index: devices bucketed into lat/lon grid cells
+typedef struct spatialentry {
+  double lat;
+  double lon;
+  ap *a;        // one of a or e is set
+  enddev *e;
+  int mark;     // free for the caller to use
+  struct spatialentry *next;
+} spatialentry;
+
+typedef struct spatialcell {
+  int ilat;
+  int ilon;
+  int count;
+  spatialentry *first;
+  struct spatialcell *hnext;  // next in the hash bucket
+  struct spatialcell *next;   // next occupied cell
+} spatialcell;
+
+typedef struct spatialindex {
+  double cellSize;
+  int nbuckets;
+  int ncells;
+  int count;
+  double south;
+  double west;
+  double north;
+  double east;
+  spatialcell **buckets;
+  spatialcell *cells;
+} spatialindex;
+
+// JSON being written to a file (json.c)
+typedef struct jsonbuf {
+  FILE *f;
+  size_t len;
+  char data[65536];
+} jsonbuf;
+
+// One step of a compiled filter (filter.c)
+typedef struct filterop {
+  int op;
+  int field;
+  double num;
+  char *str;
+} filterop;
+
+typedef struct filterprog {
+  filterop *ops;
+  int count;
+  int size;
+  int depth; // stack needed to run it
+} filterprog;
+
+// One file in a zip archive (KMZ output)
+typedef struct zipentry {
+  char name[64];
+  unsigned int crc;
+  unsigned int size;
+  unsigned int csize;
+  unsigned int offset;
+  int method;
+  struct zipentry *next;
+} zipentry;
+
+typedef struct zipfile {
+  FILE *f;
+  unsigned int offset;
+  unsigned int dosTime;
+  unsigned int dosDate;
+  int count;
+  zipentry *first;
+  zipentry *last;
+} zipfile;
+
 // Prototypes
 int compareApByMac ( const void *p1, const void *p2 );
 int compareApByPwr ( const void *p1, const void *p2 );
@@ -158,6 +350,7 @@ int compareStaByPwr ( const void *p1, const void *p2 );
 int compareStaFirstseen ( const void *p1, const void *p2 );
 int compareStaLastseen ( const void *p1, const void *p2 );
 int compareMacdb ( const void *p1, const void *p2 );
+int charToHex( char c );
 int getMacHash ( const char *mac );
 int addApToHT(aplist *ht, ap *a);
 ap *findApHT (aplist *aps, const char *mac);
@@ -166,7 +359,9 @@ enddev *findStaHT (stalist *stl, const char *mac);
 char *str_replace(char *s, char old, char new);
 int strToTime (datetime *dest, const char *str);
 char *timeToStr(const datetime *src, char *str);
+void dateDiff (datetime *delta, const datetime *d1, const datetime *d2);
 int compareDates (datetime *d1, datetime *d2);
+long long dateToSeconds (const datetime *d);
 int compareToNow (const char *lastTimeSeen, const char *thresh);
 void getNowStr (char * str);
 void free_ap (ap *s);
@@ -177,6 +372,8 @@ void free_stalist (stalist *s);
 void free_ht_sta (stalist *sts);
 void free_gps (gps *g);
 int isValidMacAddress(const char* mac);
+char *timeSinceDisplayed (enddev *e, char *str);
+unsigned long long hash64 (unsigned long long h, const char *data, long len);
 long getEssid(char *currWord, char *buffer, long i, long lSize);
 long getWord(char *currWord, char *buffer, long i, long lSize);
 ap *findApByBSSID (ap *s, char *key);
@@ -189,7 +386,10 @@ void readKnownIPs (char * fileName);
 void addGPSInfo (ap *firstap, enddev *firsted, gps *firstg);
 void printAPToFileKML (ap *a, FILE *f);
 void printEndDeviceToFileKML (enddev *e, FILE *f);
+int showAPInKML (ap *a);
+int showEndDeviceInKML (enddev *e);
 gps *readGPSFile (ap *firstap, enddev *firsted, FILE *f);
+char *readFileToString(FILE *pFile, long *sz);
 void readAPPowerFromFile (ap *first, FILE *f);
 void readEnddevPowerFromFile (enddev *first, FILE *f);
 void printAPPowerToFile (ap *a, FILE *f);
@@ -198,6 +398,9 @@ void printEndDevicesPowerToFile (enddev *e, FILE *f);
 void printEndDevicesPowerToFileRec (enddev *e, FILE *f);
 void readAPDisplayedFromFile (ap *first, FILE *f);
 void readEnddevDisplayedFromFile (enddev *first, FILE *f);
+void printLastToFile (ap *firstAp, enddev *firstEnddev, FILE *f);
+void readLastFromFile (FILE *f);
+void startNextRead (ap *firstAp, enddev *firstEnddev);
 void printAPDisplayedToFile (ap *a, FILE *f);
 void printEndDevicesDisplayedToFile (enddev *e, FILE *f);
 void printAPToFileText (ap *a, FILE *f);
@@ -205,10 +408,177 @@ void printAPToFileText (ap *a, FILE *f);
 void printEndDeviceToFileText (enddev *e, FILE *f);
 //void printEndDevicesToFileText (enddev *e, FILE *f);
 void printAPToFileCSV (ap *a, FILE *f);
-void printAPsToFileRec (ap *a);
+ap **sortAPsToPrint (ap *a, int *count);
 void printEndDeviceToFileCSV (enddev *e, FILE *f);
-void printEndDevicesToFileRec (enddev *e);
+enddev **sortEndDevicesToPrint (enddev *e, int *count);
 void printAPToFileHTML (ap *a, FILE *f);
 //void printAPsToFileHTML (ap *a, FILE *f);
 void printEndDeviceToFileHTML (enddev *e, FILE *f);
 //void printEndDevicesToFileHTML (enddev *e, FILE *f);
+void free_macdb (macdb *m);
+void setDefaultOptions (void);
+void printUsage (const char *prog);
+int parseOption (int argc, char **argv, int i);
+int loadTables (void);
+void enrichDevices (ap *firstAp, enddev *firstEnddev);
+void runProfile (ap *firstAp, enddev *firstEnddev);
+
+// zip.c
+unsigned int crc32Update (unsigned int crc, const unsigned char *buf, size_t len);
+unsigned int adler32Update (unsigned int adler, const unsigned char *buf, size_t len);
+unsigned char *deflateBuffer (const unsigned char *in, size_t len, size_t *outLen);
+zipfile *zipOpen (const char *fileName);
+int zipAdd (zipfile *z, const char *name, const char *data, size_t len);
+int zipClose (zipfile *z);
+
+// kmz.c
+int writeKMZ (const char *fileName, ap *firstAp, enddev *firstEnddev, int showAPs, int showEnddevs,
+    const char *gpsFileName);
+
+// track.c
+int printTrackToFileKML (const char *gpsFileName, FILE *f, double tolerance);
+
+// spatial.c
+double geoDistance (double lat1, double lon1, double lat2, double lon2);
+spatialindex *spatialNew (double cellSize);
+void spatialAdd (spatialindex *si, double lat, double lon, ap *a, enddev *e);
+spatialindex *spatialBuild (ap *firstAp, enddev *firstEnddev, int showAPs, int showEnddevs);
+int spatialQueryBox (spatialindex *si, double south, double west, double north, double east, spatialentry ***res);
+int spatialQueryRadius (spatialindex *si, double lat, double lon, double meters, spatialentry ***res, double **dist);
+void spatialFree (spatialindex *si);
+void printSpatialEntry (spatialentry *se, double dist, FILE *f);
+
+// heatmap.c
+void heatmapAddSample (ap *a);
+int writePNG (const char *fileName, const unsigned char *rgba, int width, int height);
+int writeHeatmaps (const char *prefix, gps *firstg);
+
+// filter.c
+filterprog *filterCompile (const char *expr, char *err, size_t errLen);
+void filterFree (filterprog *prog);
+void filterFromOptions (char *buf, size_t len);
+int selectDevices (ap *firstAp, enddev *firstEnddev);
+int filterUsesClock (void);
+
+// profile.c
+void runProfiles (const char *fileName, int argc, char **argv, ap *firstAp, enddev *firstEnddev);
+int profilesStamp (const char *fileName, int argc, char **argv);
+
+// json.c
+void jsonInit (jsonbuf *j, FILE *f);
+void jsonFlush (jsonbuf *j);
+void jsonRaw (jsonbuf *j, const char *s, size_t n);
+void jsonString (jsonbuf *j, const char *s);
+void jsonInt (jsonbuf *j, long long v);
+void jsonDouble (jsonbuf *j, double v);
+void printDeviceJSON (jsonbuf *j, ap *a, enddev *e);
+void printDevicesJSON (FILE *f, ap **aps, int apCount, enddev **stas, int staCount);
+
+// htmlview.c
+void printHTMLView (FILE *f, ap **aps, int apCount, enddev **stas, int staCount);
+
+// writer.c
+FILE *outputOpen (const char *fileName);
+void outputCommit (void);
+void outputFinish (void);
+
+// events.c
+void eventsQueueAp (ap *a);
+void eventsQueueEnddev (enddev *e);
+void writeEvents (void);
+
+// exec.c
+void execAlert (enddev *e);
+void execPoll (void);
+void execSleep (int secs);
+void execFinish (void);
+
+// query.c
+void queryPublish (ap *firstAp, enddev *firstEnddev);
+void queryFinish (void);
+
+// shm.c
+void shmPublish (ap *firstAp, enddev *firstEnddev);
+
+// metrics.c
+long long metricsClock (void);
+void phaseBegin (int phase);
+void phaseEnd (int phase);
+void metricsRows (const char *fileName, int rows, int unchanged, long bytes, long long ns);
+void memAdd (int part, long long bytes);
+void memSub (int part, long long bytes);
+void metricsPass (void);
+const char *phaseName (int phase);
+void printStats (FILE *f, int json, ap *firstAp, enddev *firstEnddev);
+
+// trace.c
+void traceEvent (int event, const char *mac, unsigned int arg);
+unsigned int traceName (const char *name);
+void traceWrite (void);
+int traceDecode (const char *fileName);
+
+// udp.c
+void udpQueue (const char *hostname, int portno, const char *msg, size_t len);
+void udpFlush (void);
+
+// wheel.c
+void wheelInit (timerwheel *w, long long now);
+void wheelSet (timerwheel *w, timer *t, long long when);
+void wheelCancel (timerwheel *w, timer *t);
+int wheelAdvance (timerwheel *w, long long now, void (*fire)(timer *t, void *arg), void *arg);
+
+// stamp.c
+void stampBegin (int argc, char **argv);
+void stampAddFile (const char *fileName);
+int stampLoad (const char *fileName);
+int stampUnchanged (void);
+void stampSave (const char *fileName);
+
+// Globals shared between the source files (defined in csvtools.c)
+extern int onlyAddNew;
+extern int onlyAddOld;
+extern int onlyShowKnown;
+extern int deltaSpecified;
+extern int verbosity;
+extern int minPower;
+extern int maxPower;
+extern int minPowerDelta;
+extern int kmlTileSize;
+extern double trackTolerance;
+extern int heatmapKey;
+extern int heatmapMax;
+extern double heatmapRes;
+extern int outputs;
+extern int htmlView;
+extern int showAPs;
+extern int showEnddevs;
+extern int timeMin;
+extern int timeMax;
+extern char *remoteserver;
+extern int remoteport;
+extern char *filterExpr;
+extern char *gpsFile;
+extern char *knownMacsFile;
+extern char *knownIPsFile;
+extern int tableGeneration;
+extern char *eventsTarget;
+extern int departAfter;
+extern long long lastStateTime;
+extern char *execCommand;
+extern char *soundFile;
+extern int execMax;
+extern int execDebounce;
+extern int execRate;
+extern char *querySocket;
+extern char *shmName;
+extern char *metricsTarget;
+extern int statsFormat;
+extern char *traceFile;
+extern long long counters[COUNTER_COUNT];
+extern int ap_count;
+extern int sta_count;
+extern macdb *extraSta;
+extern int extraStaCt;
+extern aplist aptable[HASHTABLE_SZ];
+extern stalist statable[HASHTABLE_SZ];
+extern int collisions;
@@ -0,0 +1,267 @@
+/*
+    Airodump CSV Tools
+    Events: what changed since the last pass (--events).
+    Copyright (C) 2013-2018 Christopher Bolduc
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Instead of diffing the csv outputs from one run to the next, --events
+ * writes a line of JSON each time a device changes state:
+ *
+ *   new         the device wasn't there before (the -n flag)
+ *   closer      power went up by more than -d (default EVENT_CLOSER_DB)
+ *   departed    not seen for --depart seconds
+ *   reappeared  seen again after being gone that long
+ *
+ *   {"event":"closer","time":"2018-09-07 10:13:23","type":"sta",
+ *    "mac":"00:11:22:33:44:55","power":-40,"old_power":-62,...}
+ *
+ * Every device is looked at, whatever -f, -a or -e say.  Only the rows
+ * readCSVFile actually parsed can be new, closer or reappeared, so it
+ * queues those devices here and nothing else is looked at.  Departures
+ * are timers (wheel.c) set to last time seen + the timeout, so on each
+ * pass only the devices that departed since the previous one are touched.
+ * Across runs, the wheel starts from the time of the previous run, the NOW
+ * line in [prefix]-last.csv.
+ */
+
+#include "csvtools.h"
+#include <stddef.h>
+
+static FILE *eventsFile;
+static char eventsHost[256]; // udp:host:port
+static int eventsPort;
+static long long lastTick; // time of the previous pass, 0 if none
+static char nowstr[26];
+
+// Devices read since the last pass
+static ap **queuedAps;
+static enddev **queuedStas;
+static int queuedApCount, queuedApSize, queuedStaCount, queuedStaSize;
+
+// Departures
+static timerwheel apWheel, staWheel;
+static int wheelsStarted;
+
+#define TIMER_OWNER(t, type) ((type *) ((char *) (t) - offsetof(type, departTimer)))
+
+// Grows a queue (list) to hold at least n
+static void *queueGrow (void *list, int *size, int n, size_t item) {
+  if (n <= *size) return list;
+  *size = *size ? *size * 2 : 256;
+  if (*size < n) *size = n;
+  list = realloc (list, *size * item);
+  if (list == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  return list;
+}
+
+// Called by readCSVFile for each AP (a) whose row it parsed
+void eventsQueueAp (ap *a) {
+  if (a->eventsQueued) return;
+  queuedAps = queueGrow (queuedAps, &queuedApSize, queuedApCount + 1, sizeof(ap *));
+  queuedAps[queuedApCount++] = a;
+  a->eventsQueued = 1;
+}
+
+// Same as eventsQueueAp for an Enddev (e)
+void eventsQueueEnddev (enddev *e) {
+  if (e->eventsQueued) return;
+  queuedStas = queueGrow (queuedStas, &queuedStaSize, queuedStaCount + 1, sizeof(enddev *));
+  queuedStas[queuedStaCount++] = e;
+  e->eventsQueued = 1;
+}
+
+// Opens where the events go
+static int eventsOpen (void) {
+  char *port;
+
+  if (eventsFile != NULL || eventsPort) return 1;
+  if (strcmp(eventsTarget, "-") == 0) {
+    eventsFile = stdout;
+  } else if (strncmp(eventsTarget, "udp:", 4) == 0) {
+    strncpy (eventsHost, eventsTarget + 4, sizeof(eventsHost) - 1);
+    port = strrchr (eventsHost, ':');
+    if (port == NULL || atoi(port + 1) <= 0) {
+      fprintf (stderr, "Error: --events udp: needs host:port\n");
+      exit(1);
+    }
+    *port++ = '\0';
+    eventsPort = atoi(port);
+  } else {
+    eventsFile = fopen (eventsTarget, "a");
+    if (eventsFile == NULL) {
+      fprintf (stderr, "eventsOpen - Error opening file: %s\n", eventsTarget);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Starts an event line (j) for an AP (a) or an Enddev (e)
+static void eventBegin (jsonbuf *j, const char *event, ap *a, enddev *e) {
+  jsonRaw (j, "{\"event\":", 9);
+  jsonString (j, event);
+  jsonRaw (j, ",\"time\":", 8);
+  jsonString (j, nowstr);
+  if (a) {
+    jsonRaw (j, ",\"type\":\"ap\",\"mac\":", 19);
+    jsonString (j, a->bssid);
+    jsonRaw (j, ",\"power\":", 9);
+    jsonInt (j, a->power);
+  } else {
+    jsonRaw (j, ",\"type\":\"sta\",\"mac\":", 20);
+    jsonString (j, e->station_mac);
+    jsonRaw (j, ",\"power\":", 9);
+    jsonInt (j, e->power);
+  }
+  jsonRaw (j, ",\"essid\":", 9);
+  jsonString (j, a ? a->essid : e->essid);
+  jsonRaw (j, ",\"vendor\":", 10);
+  jsonString (j, a ? a->vendor : e->vendor);
+  jsonRaw (j, ",\"desc\":", 8);
+  jsonString (j, a ? a->desc : e->desc);
+  jsonRaw (j, ",\"last_time_seen\":", 18);
+  jsonString (j, a ? a->last_time_seen : e->last_time_seen);
+}
+
+// Ends an event line, and queues it if the events go to a UDP server
+static void eventEnd (jsonbuf *j) {
+  jsonRaw (j, "}\n", 2);
+  if (eventsPort) {
+    // One datagram per event, sent by udpFlush
+    udpQueue (eventsHost, eventsPort, j->data, j->len);
+    j->len = 0;
+  }
+}
+
+static void eventInt (jsonbuf *j, const char *key, long long v) {
+  jsonRaw (j, ",\"", 2);
+  jsonRaw (j, key, strlen(key));
+  jsonRaw (j, "\":", 2);
+  jsonInt (j, v);
+}
+
+static long long timeSeconds (const char *str) {
+  datetime d;
+
+  if (!strToTime (&d, str) || d.year == 0) return 0;
+  return dateToSeconds (&d);
+}
+
+// Writes the events of one device that was read, an AP (a) or an Enddev
+// (e), and sets its departure timer
+// Returns how many there were
+static int deviceEvents (jsonbuf *j, ap *a, enddev *e, int closerDb) {
+  int isNew = a ? a->new : e->new;
+  int isOld = a ? a->old : e->old;
+  int power = a ? a->power : e->power;
+  int oldPower = a ? a->oldPower : e->oldPower;
+  long long lts = timeSeconds (a ? a->last_time_seen : e->last_time_seen);
+  long long plts = timeSeconds (a ? a->prev_last_time_seen : e->prev_last_time_seen);
+  timerwheel *w = a ? &apWheel : &staWheel;
+  timer *t = a ? &a->departTimer : &e->departTimer;
+  int count = 0;
+
+  if (lts == 0) return 0;
+  // If it departed before the wheel's time, it did so on an earlier pass
+  if (lts + departAfter > w->now) wheelSet (w, t, lts + departAfter);
+  else wheelCancel (w, t);
+
+  if (isNew) {
+    eventBegin (j, "new", a, e);
+    eventEnd (j);
+    return 1;
+  }
+  if (!isOld) return 0;
+
+  if (plts && lts - plts >= departAfter) {
+    // It went away and came back between two passes
+    if (lastTick && plts + departAfter > lastTick) {
+      eventBegin (j, "departed", a, e);
+      eventEnd (j);
+      count++;
+    }
+    eventBegin (j, "reappeared", a, e);
+    eventInt (j, "absent", lts - plts);
+    eventEnd (j);
+    count++;
+  }
+
+  // -d's delta, and like -d nothing without a previous power
+  if (oldPower < -1 && power - oldPower > closerDb) {
+    eventBegin (j, "closer", a, e);
+    eventInt (j, "old_power", oldPower);
+    eventInt (j, "delta", power - oldPower);
+    eventEnd (j);
+    count++;
+  }
+  return count;
+}
+
+static void apDeparted (timer *t, void *arg) {
+  eventBegin ((jsonbuf *) arg, "departed", TIMER_OWNER(t, ap), NULL);
+  eventEnd ((jsonbuf *) arg);
+}
+
+static void staDeparted (timer *t, void *arg) {
+  eventBegin ((jsonbuf *) arg, "departed", NULL, TIMER_OWNER(t, enddev));
+  eventEnd ((jsonbuf *) arg);
+}
+
+// Writes the events of this pass: for the devices readCSVFile queued, and
+// for the departure timers that went off since the last pass
+void writeEvents (void) {
+  jsonbuf j;
+  datetime d;
+  long long now;
+  int closerDb = deltaSpecified ? minPowerDelta : EVENT_CLOSER_DB;
+  int i, count = 0;
+
+  if (!eventsOpen ()) return;
+  phaseBegin (PHASE_EVENTS);
+  getNowStr (nowstr);
+  strToTime (&d, nowstr);
+  now = dateToSeconds (&d);
+  if (lastTick == 0) lastTick = lastStateTime;
+  if (!wheelsStarted) {
+    // With no earlier run, nothing departs until the next pass
+    wheelInit (&apWheel, lastTick ? lastTick : now);
+    wheelInit (&staWheel, lastTick ? lastTick : now);
+    wheelsStarted = 1;
+  }
+
+  jsonInit (&j, eventsFile);
+  for (i=0; i < queuedApCount; i++) {
+    queuedAps[i]->eventsQueued = 0;
+    count += deviceEvents (&j, queuedAps[i], NULL, closerDb);
+  }
+  for (i=0; i < queuedStaCount; i++) {
+    queuedStas[i]->eventsQueued = 0;
+    count += deviceEvents (&j, NULL, queuedStas[i], closerDb);
+  }
+  if (verbosity) printf ("Events for %d APs and %d Stations read\n", queuedApCount, queuedStaCount);
+  queuedApCount = queuedStaCount = 0;
+  count += wheelAdvance (&apWheel, now, apDeparted, &j);
+  count += wheelAdvance (&staWheel, now, staDeparted, &j);
+  jsonFlush (&j);
+  if (eventsFile) fflush (eventsFile);
+  if (verbosity) printf ("%d events\n", count);
+  counters[COUNTER_EVENTS] += count;
+  lastTick = now;
+  phaseEnd (PHASE_EVENTS);
+}
@@ -0,0 +1,210 @@
+/*
+    Airodump CSV Tools
+    Commands run for alerts (--exec, --sound).
+    Copyright (C) 2013-2018 Christopher Bolduc
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* play_sound forked mpg123 for every alert and never waited for it, and
+ * alert-webcam.sh started streamer for every hit.  With a crowd walking
+ * past, that is a lot of processes at once.
+ *
+ * Now each station that gets shown (the same ones -u alerts on) can run
+ * --exec [command] through /bin/sh, with CSVTOOLS_MAC, CSVTOOLS_POWER,
+ * CSVTOOLS_ESSID, CSVTOOLS_DESC and CSVTOOLS_VENDOR set, and/or play
+ * --sound [file].  At most --exec-max commands run at once; the rest wait
+ * in a short queue, and if that is full they are dropped.  A station
+ * doesn't run anything again for --exec-debounce seconds, and no more
+ * than --exec-rate commands start a minute.
+ *
+ * SIGCHLD only sets a flag.  execPoll reaps the children with waitpid and
+ * starts what is queued; it is called after each pass and while --watch
+ * sleeps.
+ */
+
+#include "csvtools.h"
+#include <signal.h>
+#include <errno.h>
+#include <sys/wait.h>
+
+#define EXEC_QUEUE_MAX 16
+#define EXEC_VARS 5
+
+typedef struct execjob {
+  int sound; // cmd is a file for mpg123, not a command
+  char cmd[512]; // as it was when queued; profiles have their own
+  char vars[EXEC_VARS][128]; // CSVTOOLS_...=value
+} execjob;
+
+extern char **environ;
+
+static execjob queue[EXEC_QUEUE_MAX];
+static int queueHead, queueCount;
+static int running;
+static int started;
+static volatile sig_atomic_t childExited;
+static double tokens; // for --exec-rate
+static long long tokensTime;
+static int dropped;
+
+static void onSigchld (int sig) {
+  childExited = 1;
+}
+
+static void execInit (void) {
+  struct sigaction sa;
+
+  memset (&sa, 0, sizeof(sa));
+  sa.sa_handler = onSigchld;
+  sigemptyset (&sa.sa_mask);
+  sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigaction (SIGCHLD, &sa, NULL);
+  tokens = execRate;
+  tokensTime = time(NULL);
+  started = 1;
+}
+
+// Forks and runs a job (j)
+// The environment is put together before the fork, so the child only has
+// to call execve (other threads may hold malloc's locks)
+static void execStart (execjob *j) {
+  char *argv[6];
+  char **envp;
+  int i, n;
+  pid_t pid;
+
+  for (n=0; environ[n] != NULL; n++);
+  envp = (char **) malloc ((n + EXEC_VARS + 1) * sizeof(char *));
+  if (envp == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  memcpy (envp, environ, n * sizeof(char *));
+  for (i=0; i < EXEC_VARS; i++) envp[n + i] = j->vars[i];
+  envp[n + EXEC_VARS] = NULL;
+
+  argv[0] = "sh";
+  argv[1] = "-c";
+  if (j->sound) {
+    argv[2] = "exec mpg123 -q \"$1\"";
+    argv[3] = "sh";
+    argv[4] = j->cmd;
+    argv[5] = NULL;
+  } else {
+    argv[2] = j->cmd;
+    argv[3] = NULL;
+  }
+
+  pid = fork();
+  if (pid == 0) {
+    signal (SIGCHLD, SIG_DFL);
+    execve ("/bin/sh", argv, envp);
+    _exit(127);
+  }
+  free (envp);
+  if (pid < 0) {
+    fprintf (stderr, "execStart - fork failed: %s\n", strerror(errno));
+    return;
+  }
+  running++;
+  counters[COUNTER_EXEC_ALERTS]++;
+  if (verbosity >= 2) printf ("Started %s (pid %d), %d running\n", j->cmd, (int) pid, running);
+}
+
+// Reaps the commands that finished and starts queued ones in their place
+void execPoll (void) {
+  pid_t pid;
+  int status;
+
+  if (!started) return;
+  childExited = 0;
+  while (running > 0 && (pid = waitpid (-1, &status, WNOHANG)) > 0) {
+    running--;
+    if (verbosity >= 2) printf ("pid %d done, %d running\n", (int) pid, running);
+  }
+  while (queueCount > 0 && running < execMax) {
+    execStart (&queue[queueHead]);
+    queueHead = (queueHead + 1) % EXEC_QUEUE_MAX;
+    queueCount--;
+  }
+}
+
+// Takes one --exec-rate token if there is one
+static int execToken (void) {
+  long long now = time(NULL);
+
+  tokens += (now - tokensTime) * execRate / 60.0;
+  if (tokens > execRate) tokens = execRate;
+  tokensTime = now;
+  if (tokens < 1.0) return 0;
+  tokens -= 1.0;
+  return 1;
+}
+
+// Queues a command (cmd, or a file to play if sound) for a station (e)
+static void execQueue (enddev *e, const char *cmd, int sound) {
+  execjob *j;
+
+  if (queueCount == EXEC_QUEUE_MAX || !execToken ()) {
+    dropped++;
+    if (verbosity) printf ("Not running an alert command for %s (too many)\n", e->station_mac);
+    return;
+  }
+  j = &queue[(queueHead + queueCount) % EXEC_QUEUE_MAX];
+  j->sound = sound;
+  strncpy (j->cmd, cmd, sizeof(j->cmd) - 1);
+  j->cmd[sizeof(j->cmd) - 1] = '\0';
+  snprintf (j->vars[0], sizeof(j->vars[0]), "CSVTOOLS_MAC=%s", e->station_mac);
+  snprintf (j->vars[1], sizeof(j->vars[1]), "CSVTOOLS_POWER=%d", e->power);
+  snprintf (j->vars[2], sizeof(j->vars[2]), "CSVTOOLS_ESSID=%s", e->essid);
+  snprintf (j->vars[3], sizeof(j->vars[3]), "CSVTOOLS_DESC=%s", e->desc);
+  snprintf (j->vars[4], sizeof(j->vars[4]), "CSVTOOLS_VENDOR=%s", e->vendor);
+  queueCount++;
+}
+
+// Runs --exec and --sound for a station (e) that was just selected
+void execAlert (enddev *e) {
+  long long now = time(NULL);
+
+  if (!started) execInit ();
+  if (e->execTime && now - e->execTime < execDebounce) return;
+  e->execTime = now;
+  if (execCommand) execQueue (e, execCommand, 0);
+  if (soundFile) execQueue (e, soundFile, 1);
+  execPoll ();
+}
+
+// Starts everything still queued before the program ends
+// Waits for running commands only as long as it needs slots for them
+void execFinish (void) {
+  if (!started) return;
+  while (queueCount > 0) {
+    execPoll ();
+    if (queueCount == 0) break;
+    if (waitpid (-1, NULL, 0) > 0) running--;
+    else if (errno == ECHILD) running = 0;
+  }
+  if (dropped && verbosity) printf ("%d alert commands dropped\n", dropped);
+}
+
+// Sleeps for secs seconds, reaping commands as they finish
+void execSleep (int secs) {
+  unsigned int left = secs;
+
+  while (left > 0) {
+    left = sleep (left);
+    execPoll ();
+  }
+}
@@ -0,0 +1,493 @@
+/*
+    Airodump CSV Tools
+    Filter expressions and device selection.
+    Copyright (C) 2013-2018 Christopher Bolduc
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Each output used to check the power, -m, -n/-o, -d and -t/-T options
+ * itself, a little differently each time.  Now the options (and -f) are
+ * turned into one expression, e.g.
+ *
+ *   power >= -60 && known && delta > 5 && age < 30s
+ *
+ * which is compiled once into a postfix program.  selectDevices() runs
+ * it once per device and sets ->selected, and every output just prints
+ * the selected devices.
+ */
+
+#include "csvtools.h"
+
+#define FILTER_MAX_EXPR 2048
+#define ALERT_WINDOW 30 // stations seen this many seconds ago are still here
+
+// Postfix operations
+enum {
+  FOP_CONST, FOP_FIELD, FOP_STREQ, FOP_STRNE, FOP_STRHAS,
+  FOP_LT, FOP_LE, FOP_GT, FOP_GE, FOP_EQ, FOP_NE,
+  FOP_AND, FOP_OR, FOP_NOT
+};
+
+// Fields
+enum {
+  FF_POWER, FF_OLDPOWER, FF_MAXPOWER, FF_DELTA, FF_CHANNEL, FF_AGE, FF_DISPLAYED,
+  FF_LAT, FF_LON, FF_KNOWN, FF_NEW, FF_OLD, FF_LOCATED, FF_RESEEN, FF_AP, FF_STA,
+  FF_ESSID, FF_BSSID, FF_MAC, FF_VENDOR, FF_DESC, FF_IP, FF_PROBES, FF_PRIVACY
+};
+
+static const struct {
+  const char *name;
+  int id;
+} fieldNames[] = {
+  {"power", FF_POWER}, {"oldpower", FF_OLDPOWER}, {"maxpower", FF_MAXPOWER},
+  {"delta", FF_DELTA}, {"channel", FF_CHANNEL}, {"age", FF_AGE},
+  {"displayed", FF_DISPLAYED}, {"lat", FF_LAT}, {"lon", FF_LON},
+  {"known", FF_KNOWN}, {"new", FF_NEW}, {"old", FF_OLD}, {"located", FF_LOCATED},
+  {"reseen", FF_RESEEN}, {"ap", FF_AP}, {"sta", FF_STA},
+  {"essid", FF_ESSID}, {"bssid", FF_BSSID}, {"mac", FF_MAC}, {"vendor", FF_VENDOR},
+  {"desc", FF_DESC}, {"ip", FF_IP}, {"probes", FF_PROBES}, {"privacy", FF_PRIVACY},
+  {NULL, 0}
+};
+
+// A device as the filter sees it, times are worked out once per device
+typedef struct filterdev {
+  ap *a;
+  enddev *e;
+  double age;       // seconds since last seen
+  double displayed; // seconds since last displayed
+  int reseen;       // seen again since last displayed
+} filterdev;
+
+typedef struct parser {
+  const char *s;
+  filterprog *prog;
+  int sp;
+  char *err;
+  size_t errLen;
+} parser;
+
+static int parseOr (parser *p);
+
+static int parseError (parser *p, const char *msg) {
+  snprintf (p->err, p->errLen, "%s at \"%.20s\"", msg, *p->s ? p->s : "end of filter");
+  return -1;
+}
+
+static void skipSpace (parser *p) {
+  while (*p->s == ' ' || *p->s == '\t') p->s++;
+}
+
+// Returns 1 and skips past (tok) if it's next
+static int acceptToken (parser *p, const char *tok) {
+  size_t n = strlen(tok);
+  skipSpace (p);
+  if (strncmp(p->s, tok, n) != 0) return 0;
+  p->s += n;
+  return 1;
+}
+
+// Adds an operation to the program, (push) is its effect on the stack
+static void emit (parser *p, int op, int field, double num, const char *str, int push) {
+  filterprog *prog = p->prog;
+  filterop *o;
+
+  if (prog->count == prog->size) {
+    prog->size = prog->size ? prog->size * 2 : 16;
+    prog->ops = (filterop *) realloc (prog->ops, prog->size * sizeof(filterop));
+    if (prog->ops == NULL) {
+      fputs ("Memory error\n", stderr);
+      exit(2);
+    }
+  }
+  o = prog->ops + prog->count++;
+  o->op = op;
+  o->field = field;
+  o->num = num;
+  o->str = NULL;
+  if (str && (o->str = strdup(str)) == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  p->sp += push;
+  if (p->sp > prog->depth) prog->depth = p->sp;
+}
+
+static int isStringField (int id) {
+  return id >= FF_ESSID;
+}
+
+// number, number with a s/m/h/d suffix, or a field name
+static int parseOperand (parser *p, int *strField) {
+  char name[32];
+  char *end;
+  double num;
+  int i;
+
+  skipSpace (p);
+  *strField = -1;
+  if ((*p->s >= '0' && *p->s <= '9') || *p->s == '-' || *p->s == '.') {
+    num = strtod (p->s, &end);
+    if (end == p->s) return parseError (p, "bad number");
+    p->s = end;
+    switch (*p->s) {
+    case 's': p->s++; break;
+    case 'm': num *= 60; p->s++; break;
+    case 'h': num *= 3600; p->s++; break;
+    case 'd': num *= 86400; p->s++; break;
+    }
+    emit (p, FOP_CONST, 0, num, NULL, 1);
+    return 0;
+  }
+  for (i=0; i < (int) sizeof(name) - 1 && ((*p->s >= 'a' && *p->s <= 'z') || *p->s == '_'); i++)
+    name[i] = *p->s++;
+  name[i] = '\0';
+  if (i == 0) return parseError (p, "expected a field or number");
+  for (i=0; fieldNames[i].name != NULL; i++) {
+    if (strcmp(name, fieldNames[i].name) == 0) break;
+  }
+  if (fieldNames[i].name == NULL) {
+    snprintf (p->err, p->errLen, "unknown field \"%s\"", name);
+    return -1;
+  }
+  if (isStringField(fieldNames[i].id)) *strField = fieldNames[i].id;
+  else emit (p, FOP_FIELD, fieldNames[i].id, 0, NULL, 1);
+  return 0;
+}
+
+// field "string" comparisons (==, != or ~ for contains)
+static int parseString (parser *p, int field) {
+  char buf[256];
+  int op, i;
+
+  if (acceptToken (p, "==")) op = FOP_STREQ;
+  else if (acceptToken (p, "!=")) op = FOP_STRNE;
+  else if (acceptToken (p, "~")) op = FOP_STRHAS;
+  else return parseError (p, "expected ==, != or ~ after a text field");
+  skipSpace (p);
+  if (*p->s != '"') return parseError (p, "expected a quoted string");
+  p->s++;
+  for (i=0; *p->s && *p->s != '"' && i < (int) sizeof(buf) - 1; i++) buf[i] = *p->s++;
+  buf[i] = '\0';
+  if (*p->s != '"') return parseError (p, "missing closing quote");
+  p->s++;
+  emit (p, op, field, 0, buf, 1);
+  return 0;
+}
+
+static int parseCompare (parser *p) {
+  int field, op;
+
+  if (parseOperand (p, &field) != 0) return -1;
+  if (field >= 0) return parseString (p, field);
+  if (acceptToken (p, "<=")) op = FOP_LE;
+  else if (acceptToken (p, ">=")) op = FOP_GE;
+  else if (acceptToken (p, "==")) op = FOP_EQ;
+  else if (acceptToken (p, "!=")) op = FOP_NE;
+  else if (acceptToken (p, "<")) op = FOP_LT;
+  else if (acceptToken (p, ">")) op = FOP_GT;
+  else return 0; // a field on its own is true if it's not 0
+  if (parseOperand (p, &field) != 0) return -1;
+  if (field >= 0) return parseError (p, "cannot compare a text field to a number");
+  emit (p, op, 0, 0, NULL, -1);
+  return 0;
+}
+
+static int parseUnary (parser *p) {
+  if (acceptToken (p, "!")) {
+    if (parseUnary (p) != 0) return -1;
+    emit (p, FOP_NOT, 0, 0, NULL, 0);
+    return 0;
+  }
+  if (acceptToken (p, "(")) {
+    if (parseOr (p) != 0) return -1;
+    if (!acceptToken (p, ")")) return parseError (p, "missing )");
+    return 0;
+  }
+  return parseCompare (p);
+}
+
+static int parseAnd (parser *p) {
+  if (parseUnary (p) != 0) return -1;
+  while (acceptToken (p, "&&")) {
+    if (parseUnary (p) != 0) return -1;
+    emit (p, FOP_AND, 0, 0, NULL, -1);
+  }
+  return 0;
+}
+
+static int parseOr (parser *p) {
+  if (parseAnd (p) != 0) return -1;
+  while (acceptToken (p, "||")) {
+    if (parseAnd (p) != 0) return -1;
+    emit (p, FOP_OR, 0, 0, NULL, -1);
+  }
+  return 0;
+}
+
+void filterFree (filterprog *prog) {
+  int i;
+  if (prog == NULL) return;
+  for (i=0; i < prog->count; i++) free (prog->ops[i].str);
+  free (prog->ops);
+  free (prog);
+}
+
+// Compiles a filter expression (expr)
+// Returns NULL and puts a message in err if it's not valid
+filterprog *filterCompile (const char *expr, char *err, size_t errLen) {
+  parser p;
+
+  p.prog = (filterprog *) calloc (1, sizeof(filterprog));
+  if (p.prog == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  p.s = expr;
+  p.sp = 0;
+  p.err = err;
+  p.errLen = errLen;
+  skipSpace (&p);
+  if (*p.s == '\0') {
+    emit (&p, FOP_CONST, 0, 1, NULL, 1); // empty filter matches everything
+    return p.prog;
+  }
+  if (parseOr (&p) == 0) {
+    skipSpace (&p);
+    if (*p.s == '\0') return p.prog;
+    parseError (&p, "unexpected text");
+  }
+  filterFree (p.prog);
+  return NULL;
+}
+
+static double fieldValue (int field, const filterdev *d) {
+  ap *a = d->a;
+  enddev *e = d->e;
+  int power = a ? a->power : e->power;
+  int oldPower = a ? a->oldPower : e->oldPower;
+
+  switch (field) {
+  case FF_POWER: return power;
+  case FF_OLDPOWER: return oldPower;
+  case FF_MAXPOWER: return a ? a->maxPwrLevel : e->maxPwrLevel;
+  // No previous power reading, so no comparison with delta is true
+  case FF_DELTA: return oldPower >= -1 ? NAN : power - oldPower;
+  case FF_CHANNEL: return atoi(a ? a->channel : e->channel);
+  case FF_AGE: return d->age;
+  case FF_DISPLAYED: return d->displayed;
+  case FF_LAT: return a ? a->lat : e->lat;
+  case FF_LON: return a ? a->lon : e->lon;
+  case FF_KNOWN: return strcmp(a ? a->desc : e->desc, "") != 0;
+  case FF_NEW: return a ? a->new : e->new;
+  case FF_OLD: return a ? a->old : e->old;
+  case FF_LOCATED: return (a ? a->lat : e->lat) != 0.0;
+  case FF_RESEEN: return d->reseen;
+  case FF_AP: return a != NULL;
+  case FF_STA: return e != NULL;
+  }
+  return 0;
+}
+
+static const char *fieldString (int field, const filterdev *d) {
+  ap *a = d->a;
+  enddev *e = d->e;
+
+  switch (field) {
+  case FF_ESSID: return a ? a->essid : e->essid;
+  case FF_BSSID: return a ? a->bssid : e->bssid;
+  case FF_MAC: return a ? a->bssid : e->station_mac;
+  case FF_VENDOR: return a ? a->vendor : e->vendor;
+  case FF_DESC: return a ? a->desc : e->desc;
+  case FF_IP: return a ? a->ip : e->ip;
+  case FF_PROBES: return a ? "" : e->probed_essids;
+  case FF_PRIVACY: return a ? a->privacy : "";
+  }
+  return "";
+}
+
+// NaN (delta with no previous power) is unknown: a comparison with it is
+// unknown, and so is !, && or || on it unless the other side decides
+// (unknown && false is false, unknown || true is true)
+static double compared (double x, double y, int result) {
+  return isnan(x) || isnan(y) ? NAN : result;
+}
+
+static double and (double x, double y) {
+  if (x == 0 || y == 0) return 0;
+  return isnan(x) || isnan(y) ? NAN : 1;
+}
+
+static double or (double x, double y) {
+  if ((x != 0 && !isnan(x)) || (y != 0 && !isnan(y))) return 1;
+  return isnan(x) || isnan(y) ? NAN : 0;
+}
+
+// Runs the program on one device, returns 1 if it matches
+static int filterMatch (const filterprog *prog, const filterdev *d) {
+  double stack[prog->depth + 1];
+  const filterop *o = prog->ops;
+  const filterop *end = prog->ops + prog->count;
+  int sp = 0;
+
+  for (; o < end; o++) {
+    switch (o->op) {
+    case FOP_CONST: stack[sp++] = o->num; break;
+    case FOP_FIELD: stack[sp++] = fieldValue(o->field, d); break;
+    case FOP_STREQ: stack[sp++] = strcmp(fieldString(o->field, d), o->str) == 0; break;
+    case FOP_STRNE: stack[sp++] = strcmp(fieldString(o->field, d), o->str) != 0; break;
+    case FOP_STRHAS: stack[sp++] = strstr(fieldString(o->field, d), o->str) != NULL; break;
+    case FOP_LT: sp--; stack[sp-1] = compared (stack[sp-1], stack[sp], stack[sp-1] < stack[sp]); break;
+    case FOP_LE: sp--; stack[sp-1] = compared (stack[sp-1], stack[sp], stack[sp-1] <= stack[sp]); break;
+    case FOP_GT: sp--; stack[sp-1] = compared (stack[sp-1], stack[sp], stack[sp-1] > stack[sp]); break;
+    case FOP_GE: sp--; stack[sp-1] = compared (stack[sp-1], stack[sp], stack[sp-1] >= stack[sp]); break;
+    case FOP_EQ: sp--; stack[sp-1] = compared (stack[sp-1], stack[sp], stack[sp-1] == stack[sp]); break;
+    case FOP_NE: sp--; stack[sp-1] = compared (stack[sp-1], stack[sp], stack[sp-1] != stack[sp]); break;
+    case FOP_AND: sp--; stack[sp-1] = and (stack[sp-1], stack[sp]); break;
+    case FOP_OR: sp--; stack[sp-1] = or (stack[sp-1], stack[sp]); break;
+    case FOP_NOT: if (!isnan(stack[sp-1])) stack[sp-1] = stack[sp-1] == 0; break;
+    }
+  }
+  // Unknown is not a match
+  return sp > 0 && stack[sp-1] != 0 && !isnan(stack[sp-1]);
+}
+
+// Builds the filter expression for the current options (-p, -P, -m, -n, -o, -d, -f)
+void filterFromOptions (char *buf, size_t len) {
+  size_t n;
+
+  n = snprintf (buf, len, "power >= %d && power <= %d", minPower, maxPower);
+  if (onlyShowKnown && n < len) n += snprintf (buf + n, len - n, " && known");
+  if (onlyAddNew && n < len) n += snprintf (buf + n, len - n, " && new");
+  else if (onlyAddOld && n < len) n += snprintf (buf + n, len - n, " && old");
+  if (deltaSpecified && n < len) n += snprintf (buf + n, len - n, " && delta > %d", minPowerDelta);
+  if (filterExpr && n < len) n += snprintf (buf + n, len - n, " && (%s)", filterExpr);
+  if (n >= len) {
+    fprintf (stderr, "Error: filter is too long\n");
+    exit(1);
+  }
+}
+
+// Returns 1 if the current options select devices by how long ago they
+// were seen or displayed, so the same input can give a different result
+// later on
+int filterUsesClock (void) {
+  char expr[FILTER_MAX_EXPR];
+  char err[128];
+  filterprog *prog;
+  int i, uses = 0;
+
+  if (timeMin || timeMax) return 1;
+  filterFromOptions (expr, sizeof(expr));
+  prog = filterCompile (expr, err, sizeof(err));
+  if (prog == NULL) return 1;
+  for (i=0; i < prog->count; i++) {
+    if (prog->ops[i].op == FOP_FIELD &&
+        (prog->ops[i].field == FF_AGE || prog->ops[i].field == FF_DISPLAYED)) uses = 1;
+  }
+  filterFree (prog);
+  return uses;
+}
+
+static double secondsSince (long long now, const datetime *d) {
+  if (d->year == 0) return 1e12; // never
+  return (double) (now - dateToSeconds(d));
+}
+
+// Queues a UDP alert for a station that was just selected
+static void sendAlert (enddev *e) {
+  char ltdstr[26];
+  char descbuf[sizeof(e->desc) + 2 + sizeof(ltdstr)];
+
+  if (strcmp(e->desc, "") == 0) return;
+  snprintf (descbuf, sizeof(descbuf), "%s, %s", e->desc, timeSinceDisplayed(e, ltdstr));
+  udpQueue (remoteserver, remoteport, descbuf, strlen(descbuf));
+  counters[COUNTER_UDP_ALERTS]++;
+}
+
+// Decides which devices the outputs show and sets ->selected on every
+// AP and Enddev.  Stations that are selected have their last time
+// displayed set to now.
+// Returns the number of devices selected
+int selectDevices (ap *firstAp, enddev *firstEnddev) {
+  char expr[FILTER_MAX_EXPR];
+  char err[128];
+  char nowstr[26];
+  filterprog *prog;
+  filterdev d;
+  datetime now, ltd;
+  long long nowSecs;
+  ap *a;
+  enddev *e;
+  int count = 0;
+
+  filterFromOptions (expr, sizeof(expr));
+  if (verbosity) printf ("Filter: %s\n", expr);
+  prog = filterCompile (expr, err, sizeof(err));
+  if (prog == NULL) {
+    fprintf (stderr, "Filter error: %s\n", err);
+    exit(1);
+  }
+  getNowStr (nowstr);
+  strToTime (&now, nowstr);
+  nowSecs = dateToSeconds (&now);
+
+  d.e = NULL;
+  for (a = firstAp; a != NULL; a = a->next) {
+    a->selected = 0;
+    if (!showAPs) continue;
+    d.a = a;
+    d.age = d.displayed = secondsSince (nowSecs, &a->time2);
+    d.reseen = 1;
+    if (!filterMatch (prog, &d)) continue;
+    if (timeMin && d.age < MINTIME) continue;
+    if (timeMax && d.age > MAXTIME) continue;
+    a->selected = 1;
+    count++;
+  }
+
+  d.a = NULL;
+  for (e = firstEnddev; e != NULL; e = e->next) {
+    e->selected = 0;
+    strcpy (e->prev_last_time_displayed, e->last_time_displayed);
+    if (!showEnddevs) continue;
+    if (!isValidMacAddress(e->station_mac)) {
+      fprintf (stderr, "selectDevices: Discarding invalid MAC: %s\n", e->station_mac);
+      continue;
+    }
+    if (!strToTime (&ltd, e->last_time_displayed)) continue;
+    d.e = e;
+    d.age = secondsSince (nowSecs, &e->time2);
+    d.displayed = secondsSince (nowSecs, &ltd);
+    d.reseen = ltd.year == 0 || compareDates(&e->time2, &ltd) >= 0;
+    if (!filterMatch (prog, &d)) continue;
+
+    // If we recently saw this device, set last time displayed to now, even if MINTIME/MAXTIME not met.
+    // May not always be desirable, but the goal is to prevent devices that
+    // remain in range from spamming the screen.
+    if (d.age < ALERT_WINDOW) strcpy (e->last_time_displayed, nowstr);
+    if (timeMin && (d.displayed <= MINTIME || !d.reseen)) continue;
+    if (timeMax && d.displayed > MAXTIME) continue;
+
+    strcpy (e->last_time_displayed, nowstr);
+    e->selected = 1;
+    count++;
+    if (remoteserver) sendAlert (e);
+    if (execCommand || soundFile) execAlert (e);
+  }
+
+  filterFree (prog);
+  if (verbosity) printf ("Selected %d devices\n", count);
+  return count;
+}
@@ -0,0 +1,509 @@
+/*
+    Airodump CSV Tools
+    Signal strength heatmaps (KML GroundOverlays) from GPS-tagged samples.
+    Copyright (C) 2013-2018 Christopher Bolduc
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Every AP row of every CSV file is one (time, power) sample.  Once the
+ * GPS file is read, each sample is placed at the GPS fix closest to its
+ * time and averaged into a grid for its BSSID or ESSID.  The samples are
+ * split between worker threads that each fill their own copy of the
+ * grids, and the copies are added together at the end.  Each grid is
+ * written out as a PNG and shown with a GroundOverlay.
+ */
+
+#include "csvtools.h"
+#include <pthread.h>
+
+#define HEAT_MAX_DIM 512      // largest grid (and image) side
+#define HEAT_MAX_GAP 30       // seconds between a sample and its GPS fix
+#define HEAT_MAX_THREADS 8
+#define HEAT_TARGET_HT 4096   // target hash table size
+#define METERS_PER_DEGREE 111320.0
+
+typedef struct heatsample {
+  int target;
+  int power;
+  long long when;
+} heatsample;
+
+typedef struct heattarget {
+  char key[80];
+  long samples;
+  int index;              // into targets
+  struct heattarget *next;
+} heattarget;
+
+typedef struct heatgrid {
+  int target;
+  int width;
+  int height;
+  long offset;            // first cell in the accumulators
+  long located;
+  double south;
+  double west;
+  double north;
+  double east;
+} heatgrid;
+
+typedef struct gpsfix {
+  long long when;
+  double lat;
+  double lon;
+} gpsfix;
+
+// Work for one accumulator thread
+typedef struct heatjob {
+  long first;
+  long last;
+  long cells;
+  int *sum;
+  int *count;
+} heatjob;
+
+static heatsample *samples;
+static long sampleCt, sampleCap;
+static heattarget **targets;     // by index
+static int targetCt, targetCap;
+static heattarget *targetHT[HEAT_TARGET_HT];
+static heatgrid *grids;
+static int gridCt;
+static int *gridOfTarget;
+static gpsfix *fixes;
+static long fixCt;
+
+static unsigned int keyHash (const char *s) {
+  unsigned int h = 5381;
+  while (*s) h = h * 33 + (unsigned char) *s++;
+  return h;
+}
+
+static int internTarget (const char *key) {
+  unsigned int h = keyHash(key) & (HEAT_TARGET_HT - 1);
+  heattarget *t;
+
+  for (t = targetHT[h]; t != NULL; t = t->next) {
+    if (strcmp(t->key, key) == 0) return t->index;
+  }
+  if (targetCt == targetCap) {
+    targetCap = targetCap ? targetCap * 2 : 256;
+    targets = (heattarget **) realloc (targets, targetCap * sizeof(heattarget *));
+    if (targets == NULL) {
+      fputs ("Memory error\n", stderr);
+      exit(2);
+    }
+  }
+  t = (heattarget *) malloc (sizeof(heattarget));
+  if (t == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  strncpy (t->key, key, sizeof(t->key) - 1);
+  t->key[sizeof(t->key) - 1] = '\0';
+  t->samples = 0;
+  t->index = targetCt;
+  t->next = targetHT[h];
+  targetHT[h] = t;
+  targets[targetCt] = t;
+  return targetCt++;
+}
+
+// Records one power sample for an AP, called for every AP row read
+void heatmapAddSample (ap *a) {
+  int target;
+
+  if (a->power >= -1) return; // no reading
+  if (heatmapKey == HEATMAP_ESSID) {
+    if (a->essid[0] == '\0') return;
+    target = internTarget (a->essid);
+  } else {
+    target = internTarget (a->bssid);
+  }
+  if (sampleCt == sampleCap) {
+    sampleCap = sampleCap ? sampleCap * 2 : 4096;
+    samples = (heatsample *) realloc (samples, sampleCap * sizeof(heatsample));
+    if (samples == NULL) {
+      fputs ("Memory error\n", stderr);
+      exit(2);
+    }
+  }
+  samples[sampleCt].target = target;
+  samples[sampleCt].power = a->power;
+  samples[sampleCt].when = dateToSeconds (&(a->time2));
+  sampleCt++;
+  targets[target]->samples++;
+}
+
+static int compareFixes ( const void *p1, const void *p2 ) {
+  const gpsfix *f1 = (const gpsfix *) p1;
+  const gpsfix *f2 = (const gpsfix *) p2;
+
+  if (f1->when < f2->when) return -1;
+  if (f1->when > f2->when) return 1;
+  return 0;
+}
+
+static int compareTargetsBySamples ( const void *p1, const void *p2 ) {
+  const heattarget *t1 = *(const heattarget **) p1;
+  const heattarget *t2 = *(const heattarget **) p2;
+
+  if (t1->samples > t2->samples) return -1;
+  if (t1->samples < t2->samples) return 1;
+  return 0;
+}
+
+// Returns the GPS fix closest in time to (when), or NULL if there isn't one close enough
+static const gpsfix *findFix (long long when) {
+  long lo = 0, hi = fixCt;
+  long mid;
+  const gpsfix *best = NULL;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (fixes[mid].when < when) lo = mid + 1;
+    else hi = mid;
+  }
+  if (lo < fixCt) best = fixes + lo;
+  if (lo > 0 && (best == NULL || when - fixes[lo-1].when < best->when - when)) best = fixes + lo - 1;
+  if (best == NULL) return NULL;
+  if (best->when - when > HEAT_MAX_GAP || when - best->when > HEAT_MAX_GAP) return NULL;
+  return best;
+}
+
+// Returns the cell for (lat, lon) in grid (g)
+static long gridCell (const heatgrid *g, double lat, double lon) {
+  int x = (int) ((lon - g->west) / (g->east - g->west) * g->width);
+  int y = (int) ((g->north - lat) / (g->north - g->south) * g->height);
+  if (x >= g->width) x = g->width - 1;
+  if (y >= g->height) y = g->height - 1;
+  return g->offset + (long) y * g->width + x;
+}
+
+static void *accumulate (void *arg) {
+  heatjob *job = (heatjob *) arg;
+  const gpsfix *fix;
+  const heatsample *s;
+  long i, cell;
+  int grid;
+
+  job->sum = (int *) calloc (job->cells, sizeof(int));
+  job->count = (int *) calloc (job->cells, sizeof(int));
+  if (job->sum == NULL || job->count == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  for (i = job->first; i < job->last; i++) {
+    s = samples + i;
+    grid = gridOfTarget[s->target];
+    if (grid < 0) continue;
+    fix = findFix (s->when);
+    if (fix == NULL) continue;
+    cell = gridCell (grids + grid, fix->lat, fix->lon);
+    job->sum[cell] += s->power;
+    job->count[cell]++;
+  }
+  return NULL;
+}
+
+// Maps -90 dBm (blue) through green and yellow to -30 dBm (red)
+static void powerColor (double power, unsigned char *rgb) {
+  double t = (power + 90) / 60;
+  if (t < 0) t = 0;
+  if (t > 1) t = 1;
+  if (t < 0.5) {
+    rgb[0] = 0;
+    rgb[1] = (unsigned char) (255 * t * 2);
+    rgb[2] = (unsigned char) (255 * (1 - t * 2));
+  } else {
+    rgb[0] = 255;
+    rgb[1] = (unsigned char) (255 * (2 - t * 2));
+    rgb[2] = 0;
+  }
+}
+
+static void putBE32 (unsigned char *p, unsigned int v) {
+  p[0] = v >> 24;
+  p[1] = (v >> 16) & 0xFF;
+  p[2] = (v >> 8) & 0xFF;
+  p[3] = v & 0xFF;
+}
+
+static void writeChunk (FILE *f, const char *type, const unsigned char *data, unsigned int len) {
+  unsigned char hdr[8];
+  unsigned int crc;
+
+  putBE32 (hdr, len);
+  memcpy (hdr + 4, type, 4);
+  fwrite (hdr, 1, 8, f);
+  if (len) fwrite (data, 1, len, f);
+  crc = crc32Update (0, (const unsigned char *) type, 4);
+  crc = crc32Update (crc, data, len);
+  putBE32 (hdr, crc);
+  fwrite (hdr, 1, 4, f);
+}
+
+// Writes an 8-bit RGBA image to a PNG file (fileName)
+// Returns -1 on error
+int writePNG (const char *fileName, const unsigned char *rgba, int width, int height) {
+  static const unsigned char sig[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+  unsigned char ihdr[13];
+  unsigned char *raw, *packed, *idat;
+  size_t rawLen = (size_t) height * (width * 4 + 1);
+  size_t packedLen;
+  int y, result;
+  FILE *f;
+
+  f = fopen (fileName, "wb");
+  if (f == NULL) {
+    fprintf (stderr, "writePNG - Error opening file: %s\n", fileName);
+    return -1;
+  }
+  // Each scanline starts with its filter type (0 = none)
+  raw = (unsigned char *) malloc (rawLen);
+  if (raw == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  for (y=0; y < height; y++) {
+    raw[(size_t) y * (width * 4 + 1)] = 0;
+    memcpy (raw + (size_t) y * (width * 4 + 1) + 1, rgba + (size_t) y * width * 4, width * 4);
+  }
+  packed = deflateBuffer (raw, rawLen, &packedLen);
+
+  // zlib wrapper around the deflate stream
+  idat = (unsigned char *) malloc (packedLen + 6);
+  if (idat == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  idat[0] = 0x78;
+  idat[1] = 0x01;
+  memcpy (idat + 2, packed, packedLen);
+  putBE32 (idat + 2 + packedLen, adler32Update (1, raw, rawLen));
+
+  putBE32 (ihdr, width);
+  putBE32 (ihdr + 4, height);
+  ihdr[8] = 8;  // bit depth
+  ihdr[9] = 6;  // RGBA
+  ihdr[10] = ihdr[11] = ihdr[12] = 0;
+  fwrite (sig, 1, 8, f);
+  writeChunk (f, "IHDR", ihdr, 13);
+  writeChunk (f, "IDAT", idat, packedLen + 6);
+  writeChunk (f, "IEND", NULL, 0);
+
+  result = ferror(f) ? -1 : 0;
+  fclose (f);
+  free (raw);
+  free (packed);
+  free (idat);
+  return result;
+}
+
+// Sets up the box and size of a grid from where its samples were taken
+static void sizeGrid (heatgrid *g) {
+  double midLat = (g->south + g->north) / 2;
+  double wm, hm, res = heatmapRes;
+
+  // Pad by half a cell so edge samples aren't lost
+  g->south -= res / METERS_PER_DEGREE / 2;
+  g->north += res / METERS_PER_DEGREE / 2;
+  g->west -= res / (METERS_PER_DEGREE * cos(midLat * M_PI / 180)) / 2;
+  g->east += res / (METERS_PER_DEGREE * cos(midLat * M_PI / 180)) / 2;
+  wm = (g->east - g->west) * METERS_PER_DEGREE * cos(midLat * M_PI / 180);
+  hm = (g->north - g->south) * METERS_PER_DEGREE;
+  // Use bigger cells if the grid would be too large
+  if (wm / res > HEAT_MAX_DIM) res = wm / HEAT_MAX_DIM;
+  if (hm / res > HEAT_MAX_DIM) res = hm / HEAT_MAX_DIM;
+  g->width = (int) ceil(wm / res);
+  g->height = (int) ceil(hm / res);
+  if (g->width < 1) g->width = 1;
+  if (g->height < 1) g->height = 1;
+}
+
+static const char *baseName (const char *path) {
+  const char *p = strrchr(path, '/');
+  return p ? p + 1 : path;
+}
+
+// Writes the heatmaps as [prefix]-heat-N.png and [prefix]-heatmap.kml
+// firstg is the list of GPS fixes from readGPSFile
+// Returns -1 on error
+int writeHeatmaps (const char *prefix, gps *firstg) {
+  heattarget **byCount;
+  heatjob jobs[HEAT_MAX_THREADS];
+  pthread_t threads[HEAT_MAX_THREADS];
+  const gpsfix *fix;
+  gps *g;
+  heatgrid *hg;
+  unsigned char *rgba;
+  char fileName[512];
+  char name[80];
+  FILE *kml;
+  long i, cells, chunk, c, sum, count;
+  int t, nthreads, y, x;
+  int result = 0;
+
+  if (sampleCt == 0 || firstg == NULL) {
+    if (verbosity) printf ("Heatmap: no samples\n");
+    return 0;
+  }
+
+  // Sorted array of GPS fixes for binary searches
+  fixCt = 0;
+  for (g = firstg; g != NULL; g = g->next) fixCt++;
+  fixes = (gpsfix *) malloc (fixCt * sizeof(gpsfix));
+  if (fixes == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  for (i = 0, g = firstg; g != NULL; g = g->next, i++) {
+    fixes[i].when = dateToSeconds (&(g->dt));
+    fixes[i].lat = g->lat;
+    fixes[i].lon = g->lon;
+  }
+  qsort (fixes, fixCt, sizeof(gpsfix), &compareFixes);
+
+  // Draw the targets with the most samples
+  byCount = (heattarget **) malloc (targetCt * sizeof(heattarget *));
+  gridOfTarget = (int *) malloc (targetCt * sizeof(int));
+  grids = (heatgrid *) malloc ((heatmapMax < targetCt ? heatmapMax : targetCt) * sizeof(heatgrid));
+  if (byCount == NULL || gridOfTarget == NULL || grids == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  memcpy (byCount, targets, targetCt * sizeof(heattarget *));
+  qsort (byCount, targetCt, sizeof(heattarget *), &compareTargetsBySamples);
+  for (t=0; t < targetCt; t++) gridOfTarget[t] = -1;
+  gridCt = 0;
+  for (t=0; t < targetCt && gridCt < heatmapMax; t++) {
+    hg = grids + gridCt;
+    hg->target = byCount[t]->index;
+    hg->located = 0;
+    hg->south = hg->west = 1000;
+    hg->north = hg->east = -1000;
+    gridOfTarget[hg->target] = gridCt++;
+  }
+  free (byCount);
+
+  // Find the area covered by each grid
+  for (i=0; i < sampleCt; i++) {
+    if (gridOfTarget[samples[i].target] < 0) continue;
+    fix = findFix (samples[i].when);
+    if (fix == NULL) continue;
+    hg = grids + gridOfTarget[samples[i].target];
+    hg->located++;
+    if (fix->lat < hg->south) hg->south = fix->lat;
+    if (fix->lat > hg->north) hg->north = fix->lat;
+    if (fix->lon < hg->west) hg->west = fix->lon;
+    if (fix->lon > hg->east) hg->east = fix->lon;
+  }
+  cells = 0;
+  for (t=0; t < gridCt; t++) {
+    if (grids[t].located == 0) {
+      grids[t].south = grids[t].north = grids[t].west = grids[t].east = 0;
+    }
+    sizeGrid (grids + t);
+    grids[t].offset = cells;
+    cells += (long) grids[t].width * grids[t].height;
+  }
+
+  // Each thread fills its own accumulators from a slice of the samples
+  nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads < 1) nthreads = 1;
+  if (nthreads > HEAT_MAX_THREADS) nthreads = HEAT_MAX_THREADS;
+  chunk = (sampleCt + nthreads - 1) / nthreads;
+  for (t=0; t < nthreads; t++) {
+    jobs[t].first = t * chunk;
+    jobs[t].last = (t + 1) * chunk < sampleCt ? (t + 1) * chunk : sampleCt;
+    jobs[t].cells = cells;
+    if (t == 0) continue; // the main thread does the first slice
+    if (pthread_create (threads + t, NULL, &accumulate, jobs + t) != 0) {
+      fprintf (stderr, "writeHeatmaps: could not start thread %d\n", t);
+      exit(1);
+    }
+  }
+  accumulate (jobs);
+  for (t=1; t < nthreads; t++) pthread_join (threads[t], NULL);
+  // Add the other threads' accumulators into the first
+  for (t=1; t < nthreads; t++) {
+    for (c=0; c < cells; c++) {
+      jobs[0].sum[c] += jobs[t].sum[c];
+      jobs[0].count[c] += jobs[t].count[c];
+    }
+    free (jobs[t].sum);
+    free (jobs[t].count);
+  }
+
+  sprintf (fileName, "%s-heatmap.kml", prefix);
+  kml = fopen (fileName, "w");
+  if (kml == NULL) {
+    fprintf (stderr, "writeHeatmaps - Error opening file: %s\n", fileName);
+    result = -1;
+  } else {
+    fprintf (kml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\r\n<kml xmlns=\"http://www.opengis.net/kml/2.2\">\r\n<Document>\r\n");
+  }
+
+  for (t=0; t < gridCt && kml != NULL; t++) {
+    hg = grids + t;
+    if (hg->located == 0) continue;
+    rgba = (unsigned char *) calloc ((size_t) hg->width * hg->height, 4);
+    if (rgba == NULL) {
+      fputs ("Memory error\n", stderr);
+      exit(2);
+    }
+    for (y=0; y < hg->height; y++) {
+      for (x=0; x < hg->width; x++) {
+        c = hg->offset + (long) y * hg->width + x;
+        sum = jobs[0].sum[c];
+        count = jobs[0].count[c];
+        if (count == 0) continue; // transparent
+        powerColor ((double) sum / count, rgba + ((size_t) y * hg->width + x) * 4);
+        rgba[((size_t) y * hg->width + x) * 4 + 3] = 190;
+      }
+    }
+    sprintf (fileName, "%s-heat-%d.png", prefix, t);
+    if (writePNG (fileName, rgba, hg->width, hg->height) != 0) result = -1;
+    free (rgba);
+    strcpy (name, targets[hg->target]->key);
+    str_replace (str_replace (name, '&', ' '), '<', ' ');
+    fprintf (kml, "<GroundOverlay>%s<name>%s (%ld samples)</name>%s"
+      "<Icon><href>%s</href></Icon>%s"
+      "<LatLonBox><north>%lf</north><south>%lf</south><east>%lf</east><west>%lf</west></LatLonBox>%s"
+      "</GroundOverlay>%s", CRLF, name, hg->located, CRLF, baseName(fileName), CRLF,
+      hg->north, hg->south, hg->east, hg->west, CRLF, CRLF);
+    if (verbosity) printf ("Heatmap %s: %s, %d x %d, %ld samples\n", fileName, targets[hg->target]->key,
+      hg->width, hg->height, hg->located);
+  }
+  if (kml != NULL) {
+    fprintf (kml, "</Document>\r\n</kml>\r\n");
+    fclose (kml);
+  }
+
+  free (jobs[0].sum);
+  free (jobs[0].count);
+  free (fixes);
+  free (grids);
+  free (gridOfTarget);
+  for (t=0; t < targetCt; t++) free (targets[t]);
+  free (targets);
+  free (samples);
+  targets = NULL;
+  samples = NULL;
+  targetCt = targetCap = 0;
+  sampleCt = sampleCap = 0;
+  memset (targetHT, 0, sizeof(targetHT));
+  return result;
+}
@@ -0,0 +1,170 @@
+/*
+    Airodump CSV Tools
+    HTML report that scrolls through any number of devices (--html-view).
+    Copyright (C) 2013-2018 Christopher Bolduc
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* The regular html output is one <tr> per device, which browsers can't
+ * cope with past a few tens of thousands of rows.  With --html-view the
+ * devices are put in the page once as JSON, column names first and then
+ * one array per device:
+ *
+ *   {"aps":{"cols":["BSSID",...],"rows":[["00:11:22:33:44:55",...],...]},
+ *    "stas":{...}}
+ *
+ * and a short script only builds the rows that are on screen.  Clicking
+ * a column heading sorts by it, and the box at the top filters the rows.
+ */
+
+#include "csvtools.h"
+
+static const char *apCols[] = {
+  "BSSID", "Vendor", "First time seen", "Last time seen", "Prev time seen", "channel", "Speed",
+  "Privacy", "Cipher", "Authentication", "Power", "# beacons", "# IV", "LAN IP", "ID-Length",
+  "ESSID", "Key", "Description", "IP Address", NULL
+};
+
+static const char *staCols[] = {
+  "Station MAC", "Vendor", "First time seen", "Last time seen", "Previous time seen", "Power",
+  "# packets", "BSSID", "channel", "ESSID", "Probes", "Description", "IP Address", NULL
+};
+
+static const char *pageHead =
+  "<!DOCTYPE html>\r\n<html><head><meta charset=\"utf-8\"><title>csvtools</title>\r\n"
+  "<style>\r\n"
+  "body{font:13px sans-serif;margin:8px}\r\n"
+  "#bar{margin-bottom:6px}\r\n"
+  "#scroll{height:85vh;overflow:auto;border:1px solid #999}\r\n"
+  "table{border-collapse:collapse}\r\n"
+  "td,th{border:1px solid #ccc;padding:0 4px;height:19px;white-space:nowrap;max-width:24em;overflow:hidden;text-overflow:ellipsis}\r\n"
+  "th{background:#eee;cursor:pointer;position:sticky;top:0}\r\n"
+  "</style></head><body>\r\n"
+  "<div id=\"bar\"><select id=\"which\"></select> <input id=\"q\" placeholder=\"filter\" size=\"30\"> <span id=\"count\"></span></div>\r\n"
+  "<div id=\"scroll\"><table><thead id=\"head\"></thead><tbody id=\"rows\"></tbody></table></div>\r\n"
+  "<script id=\"data\" type=\"application/json\">";
+
+static const char *pageTail =
+  "</script>\r\n<script>\r\n"
+  "var D=JSON.parse(document.getElementById('data').textContent),H=20,set,idx,col=-1,dir=1;\r\n"
+  "var sc=document.getElementById('scroll'),hd=document.getElementById('head'),bd=document.getElementById('rows'),\r\n"
+  "  q=document.getElementById('q'),w=document.getElementById('which'),ct=document.getElementById('count');\r\n"
+  "[['aps','APs'],['stas','Stations']].forEach(function(k){if(!D[k[0]])return;var o=document.createElement('option');\r\n"
+  "  o.value=k[0];o.textContent=k[1]+' ('+D[k[0]].rows.length+')';w.appendChild(o);});\r\n"
+  "function cell(t,s){var c=document.createElement(t);c.textContent=s;return c}\r\n"
+  "function pad(h){var r=document.createElement('tr');r.style.height=h+'px';return r}\r\n"
+  "function pick(){set=D[w.value];col=-1;hd.innerHTML='';if(!set)return;var r=document.createElement('tr');\r\n"
+  "  set.cols.forEach(function(c,i){var th=cell('th',c);th.onclick=function(){sort(i)};r.appendChild(th)});hd.appendChild(r);filter()}\r\n"
+  "function filter(){var s=q.value.toLowerCase(),r=set.rows;idx=[];\r\n"
+  "  if(!set.lc)set.lc=r.map(function(x){return x.join('\\t').toLowerCase()});\r\n"
+  "  for(var i=0;i<r.length;i++)if(!s||set.lc[i].indexOf(s)>=0)idx.push(i);\r\n"
+  "  if(col>=0)order();ct.textContent=idx.length+' shown';sc.scrollTop=0;draw()}\r\n"
+  "function order(){var r=set.rows,c=col;idx.sort(function(a,b){var x=r[a][c],y=r[b][c];return (x<y?-1:x>y?1:0)*dir||a-b})}\r\n"
+  "function sort(c){dir=c==col?-dir:1;col=c;order();draw()}\r\n"
+  "function draw(){var first=Math.max(0,Math.floor(sc.scrollTop/H)-5),last=Math.min(idx.length,first+Math.ceil(sc.clientHeight/H)+10),\r\n"
+  "  f=document.createDocumentFragment(),r=set.rows,i,j,tr,row;f.appendChild(pad(first*H));\r\n"
+  "  for(i=first;i<last;i++){tr=document.createElement('tr');row=r[idx[i]];for(j=0;j<row.length;j++)tr.appendChild(cell('td',row[j]));f.appendChild(tr)}\r\n"
+  "  f.appendChild(pad((idx.length-last)*H));bd.innerHTML='';bd.appendChild(f)}\r\n"
+  "sc.onscroll=draw;q.oninput=filter;w.onchange=pick;pick();\r\n"
+  "</script></body></html>\r\n";
+
+static void printCols (jsonbuf *j, const char **cols) {
+  int i;
+
+  jsonRaw (j, "\"cols\":[", 8);
+  for (i=0; cols[i] != NULL; i++) {
+    if (i) jsonRaw (j, ",", 1);
+    jsonString (j, cols[i]);
+  }
+  jsonRaw (j, "],\"rows\":[", 10);
+}
+
+// Adds strings (s...) to a row, each after a comma
+static void printStrings (jsonbuf *j, int n, const char **s) {
+  int i;
+
+  for (i=0; i < n; i++) {
+    jsonRaw (j, ",", 1);
+    jsonString (j, s[i]);
+  }
+}
+
+static void printAPRow (jsonbuf *j, ap *a) {
+  const char *before[] = { a->vendor, a->first_time_seen, a->last_time_seen, a->prev_last_time_seen,
+    a->channel, a->speed, a->privacy, a->cipher, a->authentication };
+  const char *after[] = { a->beacons, a->ivs, a->lan_ip, a->id_length, a->essid, a->key, a->desc, a->ip };
+
+  jsonRaw (j, "[", 1);
+  jsonString (j, a->bssid);
+  printStrings (j, 9, before);
+  jsonRaw (j, ",", 1);
+  jsonInt (j, a->power);
+  printStrings (j, 8, after);
+  jsonRaw (j, "]", 1);
+}
+
+static void printEndDeviceRow (jsonbuf *j, enddev *e) {
+  datetime delta, d1, d2;
+  char deltastr[80];
+  const char *before[] = { e->vendor, e->first_time_seen, e->last_time_seen, deltastr };
+  const char *after[] = { e->packets, e->bssid, e->channel, e->essid, e->probed_essids, e->desc, e->ip };
+
+  // Same as the regular html output: how long it has been around
+  strToTime(&d1, e->last_time_seen);
+  strToTime(&d2, e->first_time_seen);
+  dateDiff(&delta, &d1, &d2);
+  timeToStr(&delta, deltastr);
+
+  jsonRaw (j, "[", 1);
+  jsonString (j, e->station_mac);
+  printStrings (j, 4, before);
+  jsonRaw (j, ",", 1);
+  jsonInt (j, e->power);
+  printStrings (j, 7, after);
+  jsonRaw (j, "]", 1);
+}
+
+// Prints the --html-view page for the devices (aps and stas, already
+// selected and sorted) to a file (f)
+void printHTMLView (FILE *f, ap **aps, int apCount, enddev **stas, int staCount) {
+  jsonbuf j;
+  int i;
+
+  fputs (pageHead, f);
+  jsonInit (&j, f);
+  jsonRaw (&j, "{", 1);
+  if (showAPs) {
+    jsonRaw (&j, "\"aps\":{", 7);
+    printCols (&j, apCols);
+    for (i=0; i < apCount; i++) {
+      if (i) jsonRaw (&j, ",\r\n", 3);
+      printAPRow (&j, aps[i]);
+    }
+    jsonRaw (&j, "]}", 2);
+  }
+  if (showEnddevs) {
+    if (showAPs) jsonRaw (&j, ",\r\n", 3);
+    jsonRaw (&j, "\"stas\":{", 8);
+    printCols (&j, staCols);
+    for (i=0; i < staCount; i++) {
+      if (i) jsonRaw (&j, ",\r\n", 3);
+      printEndDeviceRow (&j, stas[i]);
+    }
+    jsonRaw (&j, "]}", 2);
+  }
+  jsonRaw (&j, "}", 1);
+  jsonFlush (&j);
+  fputs (pageTail, f);
+}
@@ -0,0 +1,251 @@
+/*
+    Airodump CSV Tools
+    JSON writer.
+    Copyright (C) 2013-2018 Christopher Bolduc
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* JSON is built up in a fixed buffer (jsonbuf) that goes to its file
+ * whenever it fills up, so nothing is allocated along the way.  < > and &
+ * in strings are escaped as \u003c etc. too, so the output can also go
+ * inside an html <script> tag.  ESSIDs are whatever bytes the AP sent, so
+ * anything that isn't valid UTF-8 is written as \ufffd.
+ *
+ * --out json writes [prefix].jsonl with one device per line (JSON Lines),
+ * see printDevicesJSON.
+ */
+
+#include "csvtools.h"
+
+static const char hexDigits[] = "0123456789abcdef";
+
+void jsonInit (jsonbuf *j, FILE *f) {
+  j->f = f;
+  j->len = 0;
+}
+
+// Writes out what is in the buffer
+void jsonFlush (jsonbuf *j) {
+  if (j->len) fwrite (j->data, 1, j->len, j->f);
+  j->len = 0;
+}
+
+// Adds n bytes (s) as they are
+void jsonRaw (jsonbuf *j, const char *s, size_t n) {
+  if (j->len + n > sizeof(j->data)) {
+    jsonFlush (j);
+    if (n > sizeof(j->data)) {
+      fwrite (s, 1, n, j->f);
+      return;
+    }
+  }
+  memcpy (j->data + j->len, s, n);
+  j->len += n;
+}
+
+// Returns the length of the UTF-8 character at p, or 0 if it isn't one
+static int utf8Length (const unsigned char *p) {
+  int n, i;
+
+  if (*p >= 0xc2 && *p <= 0xdf) n = 2;
+  else if (*p >= 0xe0 && *p <= 0xef) n = 3;
+  else if (*p >= 0xf0 && *p <= 0xf4) n = 4;
+  else return 0;
+  for (i=1; i < n; i++) {
+    if ((p[i] & 0xc0) != 0x80) return 0;
+  }
+  // Overlong, surrogate or past U+10FFFF
+  if ((p[0] == 0xe0 && p[1] < 0xa0) || (p[0] == 0xed && p[1] >= 0xa0) ||
+      (p[0] == 0xf0 && p[1] < 0x90) || (p[0] == 0xf4 && p[1] >= 0x90)) return 0;
+  return n;
+}
+
+// Adds a quoted, escaped string (s)
+void jsonString (jsonbuf *j, const char *s) {
+  const unsigned char *p = (const unsigned char *) s;
+  const unsigned char *run;
+  char esc[6] = { '\\', 'u', '0', '0', 0, 0 };
+  int n;
+
+  jsonRaw (j, "\"", 1);
+  for (;;) {
+    run = p;
+    while (*p >= 0x20 && *p < 0x80 && *p != '"' && *p != '\\' && *p != '<' && *p != '>' && *p != '&') p++;
+    if (p > run) jsonRaw (j, (const char *) run, p - run);
+    if (*p == '\0') break;
+    if (*p >= 0x80) {
+      n = utf8Length (p);
+      if (n) {
+        jsonRaw (j, (const char *) p, n);
+        p += n;
+      } else {
+        jsonRaw (j, "\\ufffd", 6);
+        p++;
+      }
+      continue;
+    }
+    switch (*p) {
+    case '"': jsonRaw (j, "\\\"", 2); break;
+    case '\\': jsonRaw (j, "\\\\", 2); break;
+    case '\n': jsonRaw (j, "\\n", 2); break;
+    case '\r': jsonRaw (j, "\\r", 2); break;
+    case '\t': jsonRaw (j, "\\t", 2); break;
+    default:
+      esc[4] = hexDigits[*p >> 4];
+      esc[5] = hexDigits[*p & 15];
+      jsonRaw (j, esc, 6);
+    }
+    p++;
+  }
+  jsonRaw (j, "\"", 1);
+}
+
+// Adds an integer (v)
+void jsonInt (jsonbuf *j, long long v) {
+  char buf[24];
+  char *p = buf + sizeof(buf);
+  unsigned long long u = v < 0 ? -(unsigned long long) v : (unsigned long long) v;
+
+  do {
+    *--p = '0' + u % 10;
+    u /= 10;
+  } while (u);
+  if (v < 0) *--p = '-';
+  jsonRaw (j, p, buf + sizeof(buf) - p);
+}
+
+// Adds a number (v) with up to 7 decimals, enough for GPS positions
+void jsonDouble (jsonbuf *j, double v) {
+  char buf[48];
+  int n;
+
+  n = snprintf (buf, sizeof(buf), "%.7f", v);
+  if (n <= 0 || n >= (int) sizeof(buf) || v != v) {
+    jsonRaw (j, "null", 4);
+    return;
+  }
+  // 12.5000000 -> 12.5
+  while (buf[n-1] == '0') n--;
+  if (buf[n-1] == '.') n--;
+  jsonRaw (j, buf, n);
+}
+
+// Adds ,"key": to an object
+static void jsonKey (jsonbuf *j, const char *key) {
+  jsonRaw (j, ",\"", 2);
+  jsonRaw (j, key, strlen(key));
+  jsonRaw (j, "\":", 2);
+}
+
+static void jsonStringField (jsonbuf *j, const char *key, const char *value) {
+  jsonKey (j, key);
+  jsonString (j, value);
+}
+
+static void jsonIntField (jsonbuf *j, const char *key, long long value) {
+  jsonKey (j, key);
+  jsonInt (j, value);
+}
+
+static void jsonBoolField (jsonbuf *j, const char *key, int value) {
+  jsonKey (j, key);
+  if (value) jsonRaw (j, "true", 4);
+  else jsonRaw (j, "false", 5);
+}
+
+// lat and lon, or null for both if the device has no GPS position
+static void jsonPosition (jsonbuf *j, double lat, double lon) {
+  jsonKey (j, "lat");
+  if (lat != 0.0) jsonDouble (j, lat);
+  else jsonRaw (j, "null", 4);
+  jsonKey (j, "lon");
+  if (lat != 0.0) jsonDouble (j, lon);
+  else jsonRaw (j, "null", 4);
+}
+
+static void printAPJSON (jsonbuf *j, ap *a) {
+  jsonRaw (j, "{\"type\":\"ap\"", 12);
+  jsonStringField (j, "bssid", a->bssid);
+  jsonStringField (j, "vendor", a->vendor);
+  jsonStringField (j, "first_time_seen", a->first_time_seen);
+  jsonStringField (j, "last_time_seen", a->last_time_seen);
+  jsonStringField (j, "prev_last_time_seen", a->prev_last_time_seen);
+  jsonStringField (j, "last_time_displayed", a->last_time_displayed);
+  jsonStringField (j, "channel", a->channel);
+  jsonStringField (j, "speed", a->speed);
+  jsonStringField (j, "privacy", a->privacy);
+  jsonStringField (j, "cipher", a->cipher);
+  jsonStringField (j, "authentication", a->authentication);
+  jsonIntField (j, "power", a->power);
+  jsonIntField (j, "old_power", a->oldPower);
+  jsonIntField (j, "max_power", a->maxPwrLevel);
+  jsonStringField (j, "max_power_time", a->maxPwrTime);
+  jsonStringField (j, "beacons", a->beacons);
+  jsonStringField (j, "ivs", a->ivs);
+  jsonStringField (j, "lan_ip", a->lan_ip);
+  jsonStringField (j, "id_length", a->id_length);
+  jsonStringField (j, "essid", a->essid);
+  jsonStringField (j, "key", a->key);
+  jsonStringField (j, "desc", a->desc);
+  jsonStringField (j, "ip", a->ip);
+  jsonPosition (j, a->lat, a->lon);
+  jsonBoolField (j, "new", a->new);
+  jsonBoolField (j, "old", a->old);
+  jsonRaw (j, "}\n", 2);
+}
+
+static void printEndDeviceJSON (jsonbuf *j, enddev *e) {
+  jsonRaw (j, "{\"type\":\"sta\"", 13);
+  jsonStringField (j, "station_mac", e->station_mac);
+  jsonStringField (j, "vendor", e->vendor);
+  jsonStringField (j, "first_time_seen", e->first_time_seen);
+  jsonStringField (j, "last_time_seen", e->last_time_seen);
+  jsonStringField (j, "prev_last_time_seen", e->prev_last_time_seen);
+  jsonStringField (j, "last_time_displayed", e->last_time_displayed);
+  jsonStringField (j, "prev_last_time_displayed", e->prev_last_time_displayed);
+  jsonIntField (j, "power", e->power);
+  jsonIntField (j, "old_power", e->oldPower);
+  jsonIntField (j, "max_power", e->maxPwrLevel);
+  jsonStringField (j, "max_power_time", e->maxPwrTime);
+  jsonStringField (j, "packets", e->packets);
+  jsonStringField (j, "bssid", e->bssid);
+  jsonStringField (j, "essid", e->essid);
+  jsonStringField (j, "channel", e->channel);
+  jsonStringField (j, "probed_essids", e->probed_essids);
+  jsonStringField (j, "desc", e->desc);
+  jsonStringField (j, "ip", e->ip);
+  jsonPosition (j, e->lat, e->lon);
+  jsonBoolField (j, "new", e->new);
+  jsonBoolField (j, "old", e->old);
+  jsonRaw (j, "}\n", 2);
+}
+
+// Adds the line of an AP (a) or an Enddev (e)
+void printDeviceJSON (jsonbuf *j, ap *a, enddev *e) {
+  if (a) printAPJSON (j, a);
+  else printEndDeviceJSON (j, e);
+}
+
+// Prints the devices (aps and stas, already selected and sorted) to a
+// file (f), one JSON object per line
+void printDevicesJSON (FILE *f, ap **aps, int apCount, enddev **stas, int staCount) {
+  jsonbuf j;
+  int i;
+
+  jsonInit (&j, f);
+  for (i=0; i < apCount; i++) printAPJSON (&j, aps[i]);
+  for (i=0; i < staCount; i++) printEndDeviceJSON (&j, stas[i]);
+  jsonFlush (&j);
+}
@@ -0,0 +1,209 @@
+/*
+    Airodump CSV Tools
+    Tiled KMZ output for large surveys.
+    Copyright (C) 2013-2018 Christopher Bolduc
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Google Earth chokes on a flat KML with tens of thousands of placemarks.
+ * Instead, the located devices are split up with a quadtree.  Each tile
+ * holds the strongest few devices in its area and links to its four
+ * children with a NetworkLink/Region, so a child is only loaded once
+ * you zoom in far enough to see it.  Everything is zipped into one KMZ.
+ */
+
+#include "csvtools.h"
+
+#define KML_MAX_DEPTH 20
+#define KML_MIN_LOD 128  // pixels a tile must cover on screen before it loads
+
+static int entryPower (const spatialentry *se) {
+  return se->a ? se->a->maxPwrLevel : se->e->maxPwrLevel;
+}
+
+static int compareEntriesByPwr ( const void *p1, const void *p2 ) {
+  const spatialentry *se1 = *(const spatialentry **) p1;
+  const spatialentry *se2 = *(const spatialentry **) p2;
+
+  return entryPower(se2) - entryPower(se1); // sort highest to lowest
+}
+
+static void printKMLHeader (FILE *f) {
+  fprintf (f, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\r\n<kml xmlns=\"http://www.opengis.net/kml/2.2\">\r\n<Document>\r\n");
+}
+
+static void printKMLFooter (FILE *f) {
+  fprintf (f, "</Document>\r\n</kml>\r\n");
+}
+
+static void printRegion (FILE *f, double south, double west, double north, double east, int minLod) {
+  fprintf (f, "<Region>%s"
+    "<LatLonAltBox><north>%lf</north><south>%lf</south><east>%lf</east><west>%lf</west></LatLonAltBox>%s"
+    "<Lod><minLodPixels>%d</minLodPixels><maxLodPixels>-1</maxLodPixels></Lod>%s"
+    "</Region>%s", CRLF, north, south, east, west, CRLF, minLod, CRLF, CRLF);
+}
+
+static void printEntryKML (spatialentry *se, FILE *f) {
+  if (se->a) printAPToFileKML (se->a, f);
+  else printEndDeviceToFileKML (se->e, f);
+  se->mark = 1; // placed in a tile
+}
+
+// Writes the tile for quadkey (key) covering the given box, then its children
+// Devices already placed in a parent tile are marked and skipped
+// Returns -1 on error
+static int writeTile (zipfile *z, spatialindex *si, double south, double west,
+    double north, double east, const char *key, int depth) {
+  FILE *f;
+  char *buf = NULL;
+  size_t sz = 0;
+  char name[64];
+  char childKey[KML_MAX_DEPTH + 2];
+  spatialentry **pts, **child;
+  double midLat = (south + north) / 2;
+  double midLon = (west + east) / 2;
+  double cs, cw, cn, ce;
+  int i, n, q, keep, childCt;
+  int result = 0;
+
+  n = spatialQueryBox (si, south, west, north, east, &pts);
+  for (i = q = 0; i < n; i++) {
+    if (!pts[i]->mark) pts[q++] = pts[i];
+  }
+  n = q;
+
+  f = open_memstream (&buf, &sz);
+  if (f == NULL) {
+    perror ("writeTile");
+    free (pts);
+    return -1;
+  }
+  printKMLHeader (f);
+  fprintf (f, "<name>%s</name>%s", key, CRLF);
+
+  if (n <= kmlTileSize || depth >= KML_MAX_DEPTH) {
+    for (i=0; i < n; i++) printEntryKML (pts[i], f);
+  } else {
+    // Keep the strongest devices here so something shows when zoomed out
+    qsort (pts, n, sizeof(spatialentry *), &compareEntriesByPwr);
+    keep = kmlTileSize / 4;
+    if (keep < 1) keep = 1;
+    for (i=0; i < keep; i++) printEntryKML (pts[i], f);
+
+    // Quadrants: 0 = SW, 1 = SE, 2 = NW, 3 = NE
+    for (q=0; q < 4 && result == 0; q++) {
+      cs = (q & 2) ? midLat : south;
+      cn = (q & 2) ? north : midLat;
+      cw = (q & 1) ? midLon : west;
+      ce = (q & 1) ? east : midLon;
+      childCt = spatialQueryBox (si, cs, cw, cn, ce, &child);
+      for (i=0; i < childCt && child[i]->mark; i++);
+      free (child);
+      if (i == childCt) continue; // nothing left in this quadrant
+      sprintf (childKey, "%s%d", key, q);
+      fprintf (f, "<NetworkLink>%s<name>%s</name>%s", CRLF, childKey, CRLF);
+      printRegion (f, cs, cw, cn, ce, KML_MIN_LOD);
+      fprintf (f, "<Link><href>tile-%s.kml</href><viewRefreshMode>onRegion</viewRefreshMode></Link>%s"
+        "</NetworkLink>%s", childKey, CRLF, CRLF);
+      result = writeTile (z, si, cs, cw, cn, ce, childKey, depth + 1);
+    }
+  }
+  free (pts);
+
+  printKMLFooter (f);
+  fclose (f);
+  if (verbosity >= 2) printf ("writeTile: %s has %d devices\n", key, n);
+  sprintf (name, "tile-%s.kml", key);
+  if (result == 0) result = zipAdd (z, name, buf, sz);
+  free (buf);
+  return result;
+}
+
+// Writes the located APs and Enddevs to a tiled KMZ file (fileName)
+// If gpsFileName is not NULL, the GPS track goes in the top level document
+// Returns -1 on error
+int writeKMZ (const char *fileName, ap *firstAp, enddev *firstEnddev, int showAPs, int showEnddevs,
+    const char *gpsFileName) {
+  zipfile *z;
+  FILE *f;
+  char *buf = NULL;
+  size_t sz = 0;
+  char title[256];
+  spatialindex *si;
+  ap *a;
+  enddev *e;
+  int result;
+  double south, west, north, east;
+
+  // Same selection as the flat KML file (selectDevices)
+  si = spatialNew (SPATIAL_CELL_SIZE);
+  for (a = showAPs ? firstAp : NULL; a != NULL; a = a->next) {
+    if (showAPInKML(a)) spatialAdd (si, a->lat, a->lon, a, NULL);
+  }
+  for (e = showEnddevs ? firstEnddev : NULL; e != NULL; e = e->next) {
+    if (showEndDeviceInKML(e)) spatialAdd (si, e->lat, e->lon, NULL, e);
+  }
+
+  if (si->count == 0) {
+    south = north = west = east = 0;
+  } else {
+    south = si->south;
+    west = si->west;
+    north = si->north;
+    east = si->east;
+  }
+  // Pad the box so a single location still has an area
+  south -= 0.0001;
+  west -= 0.0001;
+  north += 0.0001;
+  east += 0.0001;
+
+  z = zipOpen (fileName);
+  if (z == NULL) {
+    fprintf (stderr, "writeKMZ - Error opening file: %s\n", fileName);
+    spatialFree (si);
+    return -1;
+  }
+
+  // Google Earth opens the first KML file in the archive
+  f = open_memstream (&buf, &sz);
+  if (f == NULL) {
+    perror ("writeKMZ");
+    zipClose (z);
+    spatialFree (si);
+    return -1;
+  }
+  printKMLHeader (f);
+  // A copy, like the vendor in printAPToFileKML, so the name is valid XML
+  snprintf (title, sizeof(title), "%s", fileName);
+  str_replace (str_replace (title, '&', ' '), '<', ' ');
+  fprintf (f, "<name>%s</name>%s", title, CRLF);
+  fprintf (f, "<NetworkLink>%s<name>Devices (%d)</name>%s", CRLF, si->count, CRLF);
+  printRegion (f, south, west, north, east, 0);
+  fprintf (f, "<Link><href>tile-0.kml</href><viewRefreshMode>onRegion</viewRefreshMode></Link>%s"
+    "</NetworkLink>%s", CRLF, CRLF);
+  if (gpsFileName) printTrackToFileKML (gpsFileName, f, trackTolerance);
+  printKMLFooter (f);
+  fclose (f);
+  result = zipAdd (z, "doc.kml", buf, sz);
+  free (buf);
+
+  if (result == 0) result = writeTile (z, si, south, west, north, east, "0", 0);
+  if (zipClose (z) != 0) result = -1;
+  if (result != 0) fprintf (stderr, "writeKMZ - Error writing file: %s\n", fileName);
+  if (verbosity) printf ("Wrote %d devices to %s\n", si->count, fileName);
+  spatialFree (si);
+  return result;
+}
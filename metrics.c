@@ -0,0 +1,555 @@
+/*
+    Airodump CSV Tools
+    Metrics (--metrics).
+    Copyright (C) 2013-2018 Christopher Bolduc
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Where each pass spends its time, and how much it does, in the
+ * Prometheus text format.  --metrics [file] writes it after every pass
+ * (for node_exporter's textfile collector, say); --metrics :[port], with
+ * --watch, serves it over HTTP on 127.0.0.1.  --stats prints the same
+ * numbers for the whole run as text or JSON when csvtools ends (or, with
+ * --watch, after the pass following a SIGUSR1).
+ *
+ * The parts of a pass are timed with phaseBegin and phaseEnd, which add up
+ * the monotonic clock time of a phase over the pass; a phase can be begun
+ * and ended many times in one pass (enrich is, once for each new row).
+ * metricsPass puts each phase's total for the pass in its histogram.  The
+ * render phases each belong to one render thread, so they never share a
+ * slot.
+ *
+ * memAdd and memSub keep track of the bytes the big parts of csvtools
+ * (MEM_PARSER and so on) have allocated, now and at most, for --stats.
+ * The writer thread uses them too, so they're atomic.  --stats uses them to
+ * guess how many devices would fit in the memory that is still available.
+ */
+
+#define _GNU_SOURCE // accept4
+#include "csvtools.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sys/sysinfo.h>
+
+#define METRICS_BUCKETS 14
+
+typedef struct filerows {
+  char name[256];
+  long long rows;
+  long long unchanged;
+  long long bytes;
+  long long ns; // reading it
+  int reads;
+  struct filerows *next;
+} filerows;
+
+static const char *phaseNames[PHASE_COUNT] = {
+  "parse", "enrich", "state_load", "state_save", "gps", "add_gps", "select", "sort",
+  "render_text", "render_csv", "render_html", "render_kml", "render_json", "render_kmz",
+  "events", "mac_db", "known_macs", "known_ips", "pass"
+};
+
+static const char *counterNames[COUNTER_COUNT] = {
+  "csvtools_passes_total", "csvtools_udp_alerts_total", "csvtools_exec_alerts_total",
+  "csvtools_events_total", "csvtools_hash_lookups_total", "csvtools_hash_probes_total",
+  "csvtools_read_bytes_total", "csvtools_written_bytes_total"
+};
+
+static const double bucketBounds[METRICS_BUCKETS] = {
+  0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5
+};
+
+static long long phaseTotal[PHASE_COUNT]; // ns over the whole run
+static long long phaseCalls[PHASE_COUNT];
+static long long phaseMax[PHASE_COUNT]; // longest pass
+static long long phaseStart[PHASE_COUNT];
+static long long phasePass[PHASE_COUNT]; // ns this pass
+static int phaseUsed[PHASE_COUNT];
+static long long buckets[PHASE_COUNT][METRICS_BUCKETS]; // not cumulative
+static long long observed[PHASE_COUNT];
+static filerows *files;
+
+static const char *memNames[MEM_COUNT] = {
+  "parser", "devices", "hash", "enrich", "gps", "state", "output"
+};
+
+static long long memNow[MEM_COUNT];
+static long long memPeak[MEM_COUNT];
+static long long memAllocs[MEM_COUNT];
+static long long memTotal, memTotalPeak;
+
+// The text as of the last pass, for the HTTP thread
+static char *published;
+static size_t publishedLen;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t server;
+static int listenFd = -1;
+
+// Nanoseconds on the monotonic clock
+long long metricsClock (void) {
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+const char *phaseName (int phase) {
+  return phaseNames[phase];
+}
+
+void phaseBegin (int phase) {
+  TRACE (TRACE_BEGIN, NULL, phase);
+  phaseStart[phase] = metricsClock ();
+}
+
+void phaseEnd (int phase) {
+  TRACE (TRACE_END, NULL, phase);
+  phasePass[phase] += metricsClock () - phaseStart[phase];
+  phaseCalls[phase]++;
+  phaseUsed[phase] = 1;
+}
+
+// Counts the rows (of which unchanged were the same as last time) and
+// bytes readCSVFile read from a file (fileName), and the time it took (ns)
+void metricsRows (const char *fileName, int rows, int unchanged, long bytes, long long ns) {
+  filerows *r;
+
+  for (r = files; r != NULL; r = r->next) {
+    if (strcmp(r->name, fileName) == 0) break;
+  }
+  if (r == NULL) {
+    r = (filerows *) calloc (1, sizeof(filerows));
+    if (r == NULL) {
+      fputs ("Memory error\n", stderr);
+      exit(2);
+    }
+    strncpy (r->name, fileName, sizeof(r->name) - 1);
+    r->next = files;
+    files = r;
+  }
+  r->rows += rows;
+  r->unchanged += unchanged;
+  r->bytes += bytes;
+  r->ns += ns;
+  r->reads++;
+  counters[COUNTER_BYTES_READ] += bytes;
+}
+
+static void raisePeak (long long *peak, long long now) {
+  long long was = __atomic_load_n (peak, __ATOMIC_RELAXED);
+
+  while (now > was && !__atomic_compare_exchange_n (peak, &was, now, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// Counts an allocation of bytes by a part of csvtools (MEM_PARSER...)
+void memAdd (int part, long long bytes) {
+  __atomic_add_fetch (&memAllocs[part], 1, __ATOMIC_RELAXED);
+  raisePeak (&memPeak[part], __atomic_add_fetch (&memNow[part], bytes, __ATOMIC_RELAXED));
+  raisePeak (&memTotalPeak, __atomic_add_fetch (&memTotal, bytes, __ATOMIC_RELAXED));
+}
+
+// Counts bytes a part of csvtools freed
+void memSub (int part, long long bytes) {
+  __atomic_sub_fetch (&memNow[part], bytes, __ATOMIC_RELAXED);
+  __atomic_sub_fetch (&memTotal, bytes, __ATOMIC_RELAXED);
+}
+
+// Returns a figure in kB (key, e.g. "MemAvailable:") from a /proc file in
+// bytes, or -1 if it isn't there
+static long long procBytes (const char *fileName, const char *key) {
+  FILE *f;
+  char line[256];
+  long long kb = -1;
+  size_t len = strlen(key);
+
+  f = fopen (fileName, "r");
+  if (f == NULL) return -1;
+  while (fgets (line, sizeof(line), f) != NULL) {
+    if (strncmp(line, key, len) == 0) {
+      kb = atoll (line + len);
+      break;
+    }
+  }
+  fclose (f);
+  return kb < 0 ? -1 : kb * 1024;
+}
+
+// Memory the system could still give csvtools, in bytes
+static long long memAvailable (void) {
+  struct sysinfo si;
+  long long bytes = procBytes ("/proc/meminfo", "MemAvailable:");
+
+  // Older kernels don't have MemAvailable
+  if (bytes < 0 && sysinfo (&si) == 0) bytes = ((long long) si.freeram + si.bufferram) * si.mem_unit;
+  return bytes;
+}
+
+// What each device costs: its record and hash chain entry, and its share
+// of the biggest parser, state and output buffers, which all grow with the
+// number of devices
+static long long bytesPerDevice (void) {
+  long long bytes, devices = ap_count + sta_count;
+
+  if (devices == 0) return 0;
+  bytes = memNow[MEM_DEVICES] + memNow[MEM_HASH] - sizeof(aptable) - sizeof(statable) +
+    memPeak[MEM_PARSER] + memPeak[MEM_STATE] + memPeak[MEM_OUTPUT];
+  return bytes / devices;
+}
+
+// Writes a file name (s) as a label value
+static void printLabel (FILE *f, const char *s) {
+  fputc ('"', f);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') fputc ('\\', f);
+    if (*s == '\n') fputs ("\\n", f);
+    else fputc (*s, f);
+  }
+  fputc ('"', f);
+}
+
+// Longest chain in a hash table (aptable or statable)
+static int longestApChain (void) {
+  aplist *l;
+  int i, n, longest = 0;
+
+  for (i=0; i < HASHTABLE_SZ; i++) {
+    if (aptable[i].data == NULL) continue;
+    for (n = 0, l = &aptable[i]; l != NULL; l = l->next) n++;
+    if (n > longest) longest = n;
+  }
+  return longest;
+}
+
+static int longestStaChain (void) {
+  stalist *l;
+  int i, n, longest = 0;
+
+  for (i=0; i < HASHTABLE_SZ; i++) {
+    if (statable[i].data == NULL) continue;
+    for (n = 0, l = &statable[i]; l != NULL; l = l->next) n++;
+    if (n > longest) longest = n;
+  }
+  return longest;
+}
+
+static void printMetrics (FILE *f) {
+  filerows *r;
+  long long cumulative;
+  int i, b;
+
+  fprintf (f, "# HELP csvtools_phase_seconds Time spent in each part of a pass.\n");
+  fprintf (f, "# TYPE csvtools_phase_seconds histogram\n");
+  for (i=0; i < PHASE_COUNT; i++) {
+    cumulative = 0;
+    for (b=0; b < METRICS_BUCKETS; b++) {
+      cumulative += buckets[i][b];
+      fprintf (f, "csvtools_phase_seconds_bucket{phase=\"%s\",le=\"%g\"} %lld\n", phaseNames[i], bucketBounds[b], cumulative);
+    }
+    fprintf (f, "csvtools_phase_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %lld\n", phaseNames[i], observed[i]);
+    fprintf (f, "csvtools_phase_seconds_sum{phase=\"%s\"} %.6f\n", phaseNames[i], phaseTotal[i] / 1e9);
+    fprintf (f, "csvtools_phase_seconds_count{phase=\"%s\"} %lld\n", phaseNames[i], observed[i]);
+  }
+
+  fprintf (f, "# TYPE csvtools_rows_total counter\n");
+  for (r = files; r != NULL; r = r->next) {
+    fprintf (f, "csvtools_rows_total{file=");
+    printLabel (f, r->name);
+    fprintf (f, "} %lld\n", r->rows);
+  }
+  fprintf (f, "# TYPE csvtools_rows_unchanged_total counter\n");
+  for (r = files; r != NULL; r = r->next) {
+    fprintf (f, "csvtools_rows_unchanged_total{file=");
+    printLabel (f, r->name);
+    fprintf (f, "} %lld\n", r->unchanged);
+  }
+  fprintf (f, "# TYPE csvtools_file_read_bytes_total counter\n");
+  for (r = files; r != NULL; r = r->next) {
+    fprintf (f, "csvtools_file_read_bytes_total{file=");
+    printLabel (f, r->name);
+    fprintf (f, "} %lld\n", r->bytes);
+  }
+
+  for (i=0; i < COUNTER_COUNT; i++) {
+    fprintf (f, "# TYPE %s counter\n%s %lld\n", counterNames[i], counterNames[i], counters[i]);
+  }
+  fprintf (f, "# TYPE csvtools_hash_collisions_total counter\ncsvtools_hash_collisions_total %d\n", collisions);
+
+  fprintf (f, "# TYPE csvtools_devices gauge\n");
+  fprintf (f, "csvtools_devices{table=\"ap\"} %d\n", ap_count);
+  fprintf (f, "csvtools_devices{table=\"sta\"} %d\n", sta_count);
+  fprintf (f, "# TYPE csvtools_hash_chain_max gauge\n");
+  fprintf (f, "csvtools_hash_chain_max{table=\"ap\"} %d\n", longestApChain ());
+  fprintf (f, "csvtools_hash_chain_max{table=\"sta\"} %d\n", longestStaChain ());
+}
+
+// Serves the metrics to anything that connects, one request each
+static void *serverMain (void *arg) {
+  struct timeval tv = { 2, 0 };
+  char req[1024], head[128];
+  char *text;
+  size_t len;
+  ssize_t n;
+  int fd, hl;
+
+  for (;;) {
+    fd = accept4 (listenFd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      break;
+    }
+    setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    // Whatever it asks for, it gets the metrics
+    n = recv (fd, req, sizeof(req), 0);
+    if (n > 0) {
+      pthread_mutex_lock (&lock);
+      len = publishedLen;
+      text = (char *) malloc (len + 1);
+      if (text) memcpy (text, published, len);
+      pthread_mutex_unlock (&lock);
+      if (text) {
+        hl = snprintf (head, sizeof(head), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+          "Content-Length: %ld\r\n\r\n", (long) len);
+        if (send (fd, head, hl, MSG_NOSIGNAL) == hl) send (fd, text, len, MSG_NOSIGNAL);
+        free (text);
+      }
+    }
+    close (fd);
+  }
+  return NULL;
+}
+
+// Listens on 127.0.0.1:port
+static void metricsListen (int port) {
+  struct sockaddr_in addr;
+  int on = 1;
+
+  listenFd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listenFd < 0) {
+    fprintf (stderr, "metricsListen - Error making a socket: %s\n", strerror(errno));
+    return;
+  }
+  setsockopt (listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  memset (&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  addr.sin_port = htons (port);
+  if (bind (listenFd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen (listenFd, 8) != 0) {
+    fprintf (stderr, "metricsListen - Error listening on port %d: %s\n", port, strerror(errno));
+    close (listenFd);
+    listenFd = -1;
+    return;
+  }
+  if (pthread_create (&server, NULL, serverMain, NULL) != 0) {
+    fprintf (stderr, "Error: could not start the metrics thread\n");
+    exit(1);
+  }
+  if (verbosity) printf ("Serving metrics on 127.0.0.1:%d\n", port);
+}
+
+// Ends a pass: puts the time of each phase used in it in its histogram,
+// and writes or serves the metrics if --metrics asks for them
+void metricsPass (void) {
+  static int listening;
+  double secs;
+  FILE *f;
+  char *text;
+  size_t len;
+  int i, b;
+
+  counters[COUNTER_PASSES]++;
+  TRACE (TRACE_PASS, NULL, counters[COUNTER_PASSES]);
+  for (i=0; i < PHASE_COUNT; i++) {
+    if (!phaseUsed[i]) continue;
+    secs = phasePass[i] / 1e9;
+    for (b=0; b < METRICS_BUCKETS && secs > bucketBounds[b]; b++);
+    if (b < METRICS_BUCKETS) buckets[i][b]++;
+    observed[i]++;
+    phaseTotal[i] += phasePass[i];
+    if (phasePass[i] > phaseMax[i]) phaseMax[i] = phasePass[i];
+    phasePass[i] = 0;
+    phaseUsed[i] = 0;
+  }
+  if (metricsTarget == NULL) return;
+
+  if (metricsTarget[0] != ':') {
+    f = outputOpen (metricsTarget);
+    printMetrics (f);
+    outputCommit ();
+    return;
+  }
+  if (!listening) {
+    metricsListen (atoi(metricsTarget + 1));
+    listening = 1;
+  }
+  f = open_memstream (&text, &len);
+  if (f == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  printMetrics (f);
+  fclose (f);
+  pthread_mutex_lock (&lock);
+  free (published);
+  published = text;
+  publishedLen = len;
+  pthread_mutex_unlock (&lock);
+}
+
+// Prints the --stats report (text, or JSON if json) to a file (f), for
+// the whole run so far and the devices as they are now
+void printStats (FILE *f, int json, ap *firstAp, enddev *firstEnddev) {
+  filerows *r;
+  jsonbuf *j;
+  ap *a;
+  enddev *e;
+  int i, apNew = 0, apOld = 0, staNew = 0, staOld = 0;
+  long long rss = procBytes ("/proc/self/status", "VmRSS:");
+  long long rssPeak = procBytes ("/proc/self/status", "VmHWM:");
+  long long available = memAvailable ();
+  long long perDevice = bytesPerDevice ();
+  long long capacity = perDevice > 0 && available >= 0 ? ap_count + sta_count + available / perDevice : -1;
+
+  for (a = firstAp; a != NULL; a = a->next) {
+    apNew += a->new;
+    apOld += a->old;
+  }
+  for (e = firstEnddev; e != NULL; e = e->next) {
+    staNew += e->new;
+    staOld += e->old;
+  }
+
+  if (!json) {
+    fprintf (f, "%lld passes\n", counters[COUNTER_PASSES]);
+    fprintf (f, "%-12s %8s %12s %12s\n", "phase", "calls", "total ms", "max ms/pass");
+    for (i=0; i < PHASE_COUNT; i++) {
+      if (phaseCalls[i] == 0) continue;
+      fprintf (f, "%-12s %8lld %12.3f %12.3f\n", phaseNames[i], phaseCalls[i], phaseTotal[i] / 1e6, phaseMax[i] / 1e6);
+    }
+    for (r = files; r != NULL; r = r->next) {
+      fprintf (f, "%s: read %d times, %lld rows (%lld unchanged), %lld bytes, %.3f ms\n",
+        r->name, r->reads, r->rows, r->unchanged, r->bytes, r->ns / 1e6);
+    }
+    fprintf (f, "APs: %d (%d new, %d old)\n", ap_count, apNew, apOld);
+    fprintf (f, "Stations: %d (%d new, %d old)\n", sta_count, staNew, staOld);
+    fprintf (f, "Bytes read: %lld, written: %lld\n", counters[COUNTER_BYTES_READ], counters[COUNTER_BYTES_WRITTEN]);
+    fprintf (f, "Hash lookups: %lld, entries compared: %lld, collisions: %d\n",
+      counters[COUNTER_HASH_LOOKUPS], counters[COUNTER_HASH_PROBES], collisions);
+    fprintf (f, "Alerts: %lld udp, %lld exec, %lld events\n",
+      counters[COUNTER_UDP_ALERTS], counters[COUNTER_EXEC_ALERTS], counters[COUNTER_EVENTS]);
+    fprintf (f, "%-12s %12s %12s %10s\n", "memory", "bytes", "peak", "allocs");
+    for (i=0; i < MEM_COUNT; i++) {
+      fprintf (f, "%-12s %12lld %12lld %10lld\n", memNames[i], memNow[i], memPeak[i], memAllocs[i]);
+    }
+    fprintf (f, "%-12s %12lld %12lld\n", "total", memTotal, memTotalPeak);
+    fprintf (f, "RSS: %lld bytes, peak %lld\n", rss, rssPeak);
+    if (capacity >= 0) {
+      fprintf (f, "Capacity: %lld bytes a device, %lld bytes available, room for about %lld devices\n",
+        perDevice, available, capacity);
+    }
+    fflush (f);
+    return;
+  }
+
+  j = (jsonbuf *) malloc (sizeof(jsonbuf));
+  if (j == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  jsonInit (j, f);
+  jsonRaw (j, "{\"passes\":", 10);
+  jsonInt (j, counters[COUNTER_PASSES]);
+  jsonRaw (j, ",\"phases\":{", 11);
+  for (i=0; i < PHASE_COUNT; i++) {
+    if (i) jsonRaw (j, ",", 1);
+    jsonString (j, phaseNames[i]);
+    jsonRaw (j, ":{\"calls\":", 10);
+    jsonInt (j, phaseCalls[i]);
+    jsonRaw (j, ",\"total_ms\":", 12);
+    jsonDouble (j, phaseTotal[i] / 1e6);
+    jsonRaw (j, ",\"max_ms\":", 10);
+    jsonDouble (j, phaseMax[i] / 1e6);
+    jsonRaw (j, "}", 1);
+  }
+  jsonRaw (j, "},\"files\":[", 11);
+  for (r = files; r != NULL; r = r->next) {
+    if (r != files) jsonRaw (j, ",", 1);
+    jsonRaw (j, "{\"name\":", 8);
+    jsonString (j, r->name);
+    jsonRaw (j, ",\"reads\":", 9);
+    jsonInt (j, r->reads);
+    jsonRaw (j, ",\"rows\":", 8);
+    jsonInt (j, r->rows);
+    jsonRaw (j, ",\"unchanged\":", 13);
+    jsonInt (j, r->unchanged);
+    jsonRaw (j, ",\"bytes\":", 9);
+    jsonInt (j, r->bytes);
+    jsonRaw (j, ",\"ms\":", 6);
+    jsonDouble (j, r->ns / 1e6);
+    jsonRaw (j, "}", 1);
+  }
+  jsonRaw (j, "],\"aps\":{\"count\":", 17);
+  jsonInt (j, ap_count);
+  jsonRaw (j, ",\"new\":", 7);
+  jsonInt (j, apNew);
+  jsonRaw (j, ",\"old\":", 7);
+  jsonInt (j, apOld);
+  jsonRaw (j, "},\"stations\":{\"count\":", 22);
+  jsonInt (j, sta_count);
+  jsonRaw (j, ",\"new\":", 7);
+  jsonInt (j, staNew);
+  jsonRaw (j, ",\"old\":", 7);
+  jsonInt (j, staOld);
+  jsonRaw (j, "}", 1);
+  for (i = COUNTER_PASSES + 1; i < COUNTER_COUNT; i++) {
+    // csvtools_udp_alerts_total -> "udp_alerts"
+    jsonRaw (j, ",\"", 2);
+    jsonRaw (j, counterNames[i] + 9, strlen(counterNames[i]) - 15);
+    jsonRaw (j, "\":", 2);
+    jsonInt (j, counters[i]);
+  }
+  jsonRaw (j, ",\"hash_collisions\":", 19);
+  jsonInt (j, collisions);
+  jsonRaw (j, ",\"memory\":{", 11);
+  for (i=0; i < MEM_COUNT; i++) {
+    jsonString (j, memNames[i]);
+    jsonRaw (j, ":{\"bytes\":", 10);
+    jsonInt (j, memNow[i]);
+    jsonRaw (j, ",\"peak\":", 8);
+    jsonInt (j, memPeak[i]);
+    jsonRaw (j, ",\"allocs\":", 10);
+    jsonInt (j, memAllocs[i]);
+    jsonRaw (j, "},", 2);
+  }
+  jsonRaw (j, "\"total\":{\"bytes\":", 17);
+  jsonInt (j, memTotal);
+  jsonRaw (j, ",\"peak\":", 8);
+  jsonInt (j, memTotalPeak);
+  jsonRaw (j, "},\"rss\":", 8);
+  jsonInt (j, rss);
+  jsonRaw (j, ",\"rss_peak\":", 12);
+  jsonInt (j, rssPeak);
+  jsonRaw (j, ",\"available\":", 13);
+  jsonInt (j, available);
+  jsonRaw (j, ",\"bytes_per_device\":", 20);
+  jsonInt (j, perDevice);
+  jsonRaw (j, ",\"device_capacity\":", 19);
+  jsonInt (j, capacity);
+  jsonRaw (j, "}", 1);
+  jsonRaw (j, "}\n", 2);
+  jsonFlush (j);
+  free (j);
+  fflush (f);
+}
@@ -0,0 +1,281 @@
+/*
+    Airodump CSV Tools
+    Several output profiles from one parse of the input files.
+    Copyright (C) 2013-2018 Christopher Bolduc
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Scripts used to run csvtools once per alert rule, reading the same
+ * airodump files every time.  A profile file lists the rules instead,
+ * one per line:
+ *
+ *   # name   options
+ *   known    -w /tmp/known -k known.csv -m -t
+ *   strong   -w /tmp/strong -p -40 -u 10.0.0.5 5000
+ *
+ * The input files are read once.  Each profile starts from the options
+ * given on the command line, adds its own, and gets its own -w prefix
+ * (so its own power, printed and last state files).  The fields a profile
+ * changes are put back before the next one runs, and the command line's
+ * options once they have all run.
+ */
+
+#include "csvtools.h"
+
+#define PROFILE_MAX_ARGS 64
+
+typedef struct profile {
+  char name[80];
+  char *line;  // tokens point into this
+  int argc;
+  char *argv[PROFILE_MAX_ARGS];
+  struct profile *next;
+} profile;
+
+// Per-device fields a profile changes (from its own state files)
+typedef struct devstate {
+  int maxPwrLevel;
+  char maxPwrTime[80];
+  char essid[80];
+  int new;
+  int old;
+  int oldPower;
+  char prev_last_time_seen[80];
+} devstate;
+
+static devstate *apState, *staState;
+
+// Splits a line into tokens in place, "double quotes" group words
+// Returns the number of tokens
+static int tokenize (char *s, char **tok, int max, const char *fileName, int lineNo) {
+  int n = 0;
+  char *out;
+
+  while (*s) {
+    while (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n') s++;
+    if (*s == '\0' || *s == '#') break;
+    if (n == max) {
+      fprintf (stderr, "%s:%d: too many options\n", fileName, lineNo);
+      exit(1);
+    }
+    tok[n++] = out = s;
+    while (*s && *s != ' ' && *s != '\t' && *s != '\r' && *s != '\n') {
+      if (*s == '"') {
+        s++;
+        while (*s && *s != '"') *out++ = *s++;
+        if (*s != '"') {
+          fprintf (stderr, "%s:%d: missing closing quote\n", fileName, lineNo);
+          exit(1);
+        }
+        s++;
+      } else {
+        *out++ = *s++;
+      }
+    }
+    if (*s) s++;
+    *out = '\0';
+  }
+  return n;
+}
+
+// Reads a profile file (fileName)
+// Returns a linked list of profiles in file order
+static profile *readProfiles (const char *fileName) {
+  FILE *f;
+  char buffer[1024];
+  char *tok[PROFILE_MAX_ARGS + 1];
+  profile *first = NULL, *last = NULL, *p;
+  int n, i, lineNo = 0;
+
+  f = fopen (fileName, "r");
+  if (f == NULL) {
+    fprintf (stderr, "readProfiles - Error opening file: %s\n", fileName);
+    exit(1);
+  }
+  while (fgets (buffer, sizeof(buffer), f) != NULL) {
+    lineNo++;
+    p = (profile *) malloc (sizeof(profile));
+    if (p == NULL || (p->line = strdup(buffer)) == NULL) {
+      fputs ("Memory error\n", stderr);
+      exit(2);
+    }
+    n = tokenize (p->line, tok, PROFILE_MAX_ARGS + 1, fileName, lineNo);
+    if (n == 0) {
+      free (p->line);
+      free (p);
+      continue;
+    }
+    strncpy (p->name, tok[0], sizeof(p->name) - 1);
+    p->name[sizeof(p->name) - 1] = '\0';
+    p->argc = n - 1;
+    for (i=1; i < n; i++) p->argv[i-1] = tok[i];
+    p->next = NULL;
+    if (last) last->next = p;
+    else first = p;
+    last = p;
+  }
+  fclose (f);
+  return first;
+}
+
+static void freeProfiles (profile *p) {
+  profile *next;
+  for (; p != NULL; p = next) {
+    next = p->next;
+    free (p->line);
+    free (p);
+  }
+}
+
+static void saveState (ap *firstAp, enddev *firstEnddev) {
+  ap *a;
+  enddev *e;
+  int i;
+
+  apState = (devstate *) malloc ((ap_count + 1) * sizeof(devstate));
+  staState = (devstate *) malloc ((sta_count + 1) * sizeof(devstate));
+  if (apState == NULL || staState == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  for (a = firstAp, i = 0; a != NULL && i < ap_count; a = a->next, i++) {
+    apState[i].maxPwrLevel = a->maxPwrLevel;
+    strcpy (apState[i].maxPwrTime, a->maxPwrTime);
+    apState[i].new = a->new;
+    apState[i].old = a->old;
+    apState[i].oldPower = a->oldPower;
+    strcpy (apState[i].prev_last_time_seen, a->prev_last_time_seen);
+  }
+  for (e = firstEnddev, i = 0; e != NULL && i < sta_count; e = e->next, i++) {
+    staState[i].maxPwrLevel = e->maxPwrLevel;
+    strcpy (staState[i].maxPwrTime, e->maxPwrTime);
+    strcpy (staState[i].essid, e->essid);
+    staState[i].new = e->new;
+    staState[i].old = e->old;
+    staState[i].oldPower = e->oldPower;
+    strcpy (staState[i].prev_last_time_seen, e->prev_last_time_seen);
+  }
+}
+
+// Puts the devices back the way they were after the input files were read
+static void restoreState (ap *firstAp, enddev *firstEnddev) {
+  ap *a;
+  enddev *e;
+  int i;
+
+  for (a = firstAp, i = 0; a != NULL && i < ap_count; a = a->next, i++) {
+    a->maxPwrLevel = apState[i].maxPwrLevel;
+    strcpy (a->maxPwrTime, apState[i].maxPwrTime);
+    a->new = apState[i].new;
+    a->old = apState[i].old;
+    a->oldPower = apState[i].oldPower;
+    strcpy (a->prev_last_time_seen, apState[i].prev_last_time_seen);
+    a->lat = a->lon = 0.0;
+  }
+  for (e = firstEnddev, i = 0; e != NULL && i < sta_count; e = e->next, i++) {
+    e->maxPwrLevel = staState[i].maxPwrLevel;
+    strcpy (e->maxPwrTime, staState[i].maxPwrTime);
+    strcpy (e->essid, staState[i].essid);
+    e->new = staState[i].new;
+    e->old = staState[i].old;
+    e->oldPower = staState[i].oldPower;
+    strcpy (e->prev_last_time_seen, staState[i].prev_last_time_seen);
+    strcpy (e->last_time_displayed, "0000-00-00 00:00:00");
+    e->lat = e->lon = 0.0;
+  }
+  free (extraSta);
+  extraSta = NULL;
+  extraStaCt = 0;
+}
+
+// Sets the options given on the command line (argc/argv), and only those
+static void applyCommandLine (int argc, char **argv) {
+  int i, j;
+
+  setDefaultOptions ();
+  for (i = 1; i < argc; i++) {
+    j = parseOption (argc, argv, i);
+    if (j >= 0) i = j;
+    else if (strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "-L") == 0) i++;
+  }
+}
+
+// Sets the options for a profile (p): the command line, then its own
+static void applyOptions (profile *p, int argc, char **argv) {
+  int i, j;
+
+  applyCommandLine (argc, argv);
+  for (i = 0; i < p->argc; i++) {
+    j = parseOption (p->argc, p->argv, i);
+    if (j < 0) {
+      fprintf (stderr, "Profile %s: unknown option %s\n", p->name, p->argv[i]);
+      exit(1);
+    }
+    i = j;
+  }
+}
+
+// Adds the files each profile in a profile file (fileName) reads to the
+// stamp (see stamp.c)
+// Returns 1 if any profile selects devices by time (see filterUsesClock)
+int profilesStamp (const char *fileName, int argc, char **argv) {
+  profile *profiles, *p;
+  int uses = 0;
+
+  profiles = readProfiles (fileName);
+  for (p = profiles; p != NULL; p = p->next) {
+    applyOptions (p, argc, argv);
+    stampAddFile (gpsFile);
+    stampAddFile (knownMacsFile);
+    stampAddFile (knownIPsFile);
+    if (filterUsesClock ()) uses = 1;
+  }
+  freeProfiles (profiles);
+  return uses;
+}
+
+// Runs every profile in a profile file (fileName) over the devices that
+// were read from the input files
+// argc/argv are the command line, whose options every profile starts with
+void runProfiles (const char *fileName, int argc, char **argv, ap *firstAp, enddev *firstEnddev) {
+  profile *profiles, *p;
+
+  profiles = readProfiles (fileName);
+  if (profiles == NULL) {
+    fprintf (stderr, "Error: no profiles in %s\n", fileName);
+    exit(1);
+  }
+  saveState (firstAp, firstEnddev);
+
+  for (p = profiles; p != NULL; p = p->next) {
+    applyOptions (p, argc, argv);
+    if (verbosity) printf ("Running profile %s\n", p->name);
+    if (loadTables ()) enrichDevices (firstAp, firstEnddev);
+    // Each profile starts from the devices as the input files left them
+    restoreState (firstAp, firstEnddev);
+    runProfile (firstAp, firstEnddev);
+  }
+  // The rest of the pass (--events, --query-socket, --shm, --metrics...)
+  // and the next --watch pass go by the command line and the input files,
+  // not by the last profile's options and state files
+  applyCommandLine (argc, argv);
+  if (loadTables ()) enrichDevices (firstAp, firstEnddev);
+  restoreState (firstAp, firstEnddev);
+
+  free (apState);
+  free (staState);
+  apState = staState = NULL;
+  freeProfiles (profiles);
+}
@@ -0,0 +1,440 @@
+/*
+    Airodump CSV Tools
+    Queries over a Unix socket (--query-socket).
+    Copyright (C) 2013-2018 Christopher Bolduc
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* With --watch, other programs can ask csvtools about the devices it has
+ * in memory instead of running it again and grepping its output.  They
+ * connect to --query-socket [path] and send one query a line:
+ *
+ *   mac [MAC]          the AP and/or station with that MAC
+ *   power [n]          every device with power >= n, strongest first
+ *   clients [BSSID]    the stations associated with an AP
+ *   top [n]            the n strongest devices
+ *   count              {"aps":..,"stations":..,"time":..}
+ *
+ * The answer is one line of JSON per device, the same as --out json,
+ * followed by an empty line.  Every device is there, whatever -f, -a or -e
+ * say.
+ *
+ * After each pass, queryPublish renders all the devices once into a
+ * snapshot, with the JSON lines and indexes by MAC, power and BSSID, and
+ * swaps it in.  The query thread only ever reads snapshots, so answering
+ * never holds up reading the csv files, and a slow client only holds on to
+ * an old snapshot until it is done with it.
+ */
+
+#define _GNU_SOURCE // accept4
+#include "csvtools.h"
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define QUERY_LINE_MAX 256
+#define QUERY_TIMEOUT 2 // seconds a client has to send its next query
+
+// A device in a snapshot
+typedef struct querydev {
+  char mac[18];
+  char bssid[18]; // an AP's own, or the AP a station is associated with
+  int power;
+  int sta;
+  size_t off; // its line in the snapshot's text
+  int len;
+} querydev;
+
+typedef struct snapshot {
+  int refs; // the current one has one for being current
+  int apCount;
+  int staCount;
+  querydev *devs; // by MAC
+  querydev **byPower; // strongest first
+  querydev **byBssid; // the stations, by the BSSID they are associated with
+  char *text;
+  size_t textLen;
+  char time[26];
+} snapshot;
+
+static snapshot *current;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t server;
+static int listenFd = -1;
+static int started, quit;
+
+static int compareQueryMac (const void *p1, const void *p2) {
+  const querydev *d1 = (const querydev *) p1;
+  const querydev *d2 = (const querydev *) p2;
+  int c = strcmp (d1->mac, d2->mac);
+
+  return c ? c : d1->sta - d2->sta;
+}
+
+static int compareQueryPwr (const void *p1, const void *p2) {
+  const querydev *d1 = *(querydev **) p1;
+  const querydev *d2 = *(querydev **) p2;
+
+  return d2->power - d1->power; // sort highest to lowest
+}
+
+static int compareQueryBssid (const void *p1, const void *p2) {
+  const querydev *d1 = *(querydev **) p1;
+  const querydev *d2 = *(querydev **) p2;
+  int c = strcmp (d1->bssid, d2->bssid);
+
+  return c ? c : d2->power - d1->power;
+}
+
+static void snapshotFree (snapshot *s) {
+  free (s->devs);
+  free (s->byPower);
+  free (s->byBssid);
+  free (s->text);
+  free (s);
+}
+
+// Gives up a reference to a snapshot (s)
+static void snapshotRelease (snapshot *s) {
+  int last;
+
+  pthread_mutex_lock (&lock);
+  last = --s->refs == 0;
+  pthread_mutex_unlock (&lock);
+  if (last) snapshotFree (s);
+}
+
+static snapshot *snapshotGet (void) {
+  snapshot *s;
+
+  pthread_mutex_lock (&lock);
+  s = current;
+  if (s) s->refs++;
+  pthread_mutex_unlock (&lock);
+  return s;
+}
+
+// Copies a MAC (src) in upper case, the way airodump writes them
+static void copyMac (char *dest, const char *src) {
+  int i;
+
+  for (i=0; i < 17 && src[i]; i++) dest[i] = toupper((unsigned char) src[i]);
+  dest[i] = '\0';
+}
+
+static snapshot *snapshotBuild (ap *firstAp, enddev *firstEnddev) {
+  snapshot *s;
+  querydev *d;
+  jsonbuf *j;
+  FILE *f;
+  ap *a;
+  enddev *e;
+  int i, n, count = 0;
+
+  for (a = firstAp; a != NULL; a = a->next) count++;
+  for (e = firstEnddev; e != NULL; e = e->next) count++;
+  s = (snapshot *) calloc (1, sizeof(snapshot));
+  j = (jsonbuf *) malloc (sizeof(jsonbuf));
+  if (s == NULL || j == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  s->devs = (querydev *) malloc ((count + 1) * sizeof(querydev));
+  s->byPower = (querydev **) malloc ((count + 1) * sizeof(querydev *));
+  s->byBssid = (querydev **) malloc ((count + 1) * sizeof(querydev *));
+  f = open_memstream (&s->text, &s->textLen);
+  if (s->devs == NULL || s->byPower == NULL || s->byBssid == NULL || f == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  getNowStr (s->time);
+
+  jsonInit (j, f);
+  d = s->devs;
+  for (a = firstAp; a != NULL; a = a->next, d++) {
+    copyMac (d->mac, a->bssid);
+    copyMac (d->bssid, a->bssid);
+    d->power = a->power;
+    d->sta = 0;
+    d->off = ftell (f) + j->len;
+    printDeviceJSON (j, a, NULL);
+    d->len = ftell (f) + j->len - d->off;
+    s->apCount++;
+  }
+  for (e = firstEnddev; e != NULL; e = e->next, d++) {
+    copyMac (d->mac, e->station_mac);
+    copyMac (d->bssid, e->bssid);
+    d->power = e->power;
+    d->sta = 1;
+    d->off = ftell (f) + j->len;
+    printDeviceJSON (j, NULL, e);
+    d->len = ftell (f) + j->len - d->off;
+    s->staCount++;
+  }
+  jsonFlush (j);
+  fclose (f);
+  free (j);
+
+  qsort (s->devs, count, sizeof(querydev), compareQueryMac);
+  n = 0;
+  for (i=0; i < count; i++) {
+    s->byPower[i] = &s->devs[i];
+    if (s->devs[i].sta) s->byBssid[n++] = &s->devs[i];
+  }
+  qsort (s->byPower, count, sizeof(querydev *), compareQueryPwr);
+  qsort (s->byBssid, n, sizeof(querydev *), compareQueryBssid);
+  s->refs = 1;
+  return s;
+}
+
+// First device in a snapshot (s) with a MAC not before mac
+static int lowerMac (snapshot *s, const char *mac) {
+  int lo = 0, hi = s->apCount + s->staCount, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (strcmp (s->devs[mid].mac, mac) < 0) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+// Same as lowerMac for the stations by BSSID
+static int lowerBssid (snapshot *s, const char *bssid) {
+  int lo = 0, hi = s->staCount, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (strcmp (s->byBssid[mid]->bssid, bssid) < 0) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+static void addDevice (jsonbuf *j, snapshot *s, querydev *d) {
+  jsonRaw (j, s->text + d->off, d->len);
+}
+
+static void queryError (jsonbuf *j, const char *msg) {
+  jsonRaw (j, "{\"error\":", 9);
+  jsonString (j, msg);
+  jsonRaw (j, "}\n", 2);
+}
+
+// Answers one query (line) from a snapshot (s) into j
+static void answer (jsonbuf *j, snapshot *s, char *line) {
+  char *arg, key[18];
+  int i, n, count = s->apCount + s->staCount;
+
+  arg = strchr (line, ' ');
+  if (arg) {
+    *arg++ = '\0';
+    while (*arg == ' ') arg++;
+  } else {
+    arg = "";
+  }
+  if (strcmp(line, "mac") == 0) {
+    copyMac (key, arg);
+    for (i = lowerMac (s, key); i < count && strcmp(s->devs[i].mac, key) == 0; i++)
+      addDevice (j, s, &s->devs[i]);
+  } else if (strcmp(line, "power") == 0 && *arg) {
+    n = atoi(arg);
+    for (i=0; i < count && s->byPower[i]->power >= n; i++) addDevice (j, s, s->byPower[i]);
+  } else if (strcmp(line, "clients") == 0) {
+    copyMac (key, arg);
+    for (i = lowerBssid (s, key); i < s->staCount && strcmp(s->byBssid[i]->bssid, key) == 0; i++)
+      addDevice (j, s, s->byBssid[i]);
+  } else if (strcmp(line, "top") == 0) {
+    n = *arg ? atoi(arg) : 10;
+    for (i=0; i < count && i < n; i++) addDevice (j, s, s->byPower[i]);
+  } else if (strcmp(line, "count") == 0) {
+    jsonRaw (j, "{\"aps\":", 7);
+    jsonInt (j, s->apCount);
+    jsonRaw (j, ",\"stations\":", 12);
+    jsonInt (j, s->staCount);
+    jsonRaw (j, ",\"time\":", 8);
+    jsonString (j, s->time);
+    jsonRaw (j, "}\n", 2);
+  } else {
+    queryError (j, "unknown query, try mac, power, clients, top or count");
+  }
+  jsonRaw (j, "\n", 1);
+}
+
+// Sends all of buf, without SIGPIPE if the client went away
+static int sendAll (int fd, const char *buf, size_t len) {
+  ssize_t n;
+
+  while (len > 0) {
+    n = send (fd, buf, len, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return 0;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 1;
+}
+
+// Answers the queries of one client (fd) until it hangs up
+static void serveClient (int fd) {
+  char line[QUERY_LINE_MAX];
+  char *buf = NULL;
+  size_t bufLen, used = 0;
+  char *nl;
+  ssize_t n;
+  jsonbuf *j;
+  snapshot *s;
+  FILE *f;
+  int ok = 1;
+
+  j = (jsonbuf *) malloc (sizeof(jsonbuf));
+  if (j == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  while (ok) {
+    n = recv (fd, line + used, sizeof(line) - 1 - used, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    used += n;
+    line[used] = '\0';
+    while (ok && (nl = strchr (line, '\n')) != NULL) {
+      *nl = '\0';
+      if (nl > line && nl[-1] == '\r') nl[-1] = '\0';
+      f = open_memstream (&buf, &bufLen);
+      if (f == NULL) {
+        fputs ("Memory error\n", stderr);
+        exit(2);
+      }
+      jsonInit (j, f);
+      s = snapshotGet ();
+      answer (j, s, line);
+      jsonFlush (j);
+      fclose (f);
+      snapshotRelease (s);
+      ok = sendAll (fd, buf, bufLen);
+      free (buf);
+      buf = NULL;
+      used -= nl + 1 - line;
+      memmove (line, nl + 1, used + 1);
+    }
+    if (used == sizeof(line) - 1) {
+      // A line that long isn't a query
+      f = open_memstream (&buf, &bufLen);
+      if (f == NULL) {
+        fputs ("Memory error\n", stderr);
+        exit(2);
+      }
+      jsonInit (j, f);
+      queryError (j, "query too long");
+      jsonRaw (j, "\n", 1);
+      jsonFlush (j);
+      fclose (f);
+      sendAll (fd, buf, bufLen);
+      free (buf);
+      buf = NULL;
+      break;
+    }
+  }
+  free (j);
+}
+
+static void *serverMain (void *arg) {
+  struct timeval tv = { QUERY_TIMEOUT, 0 };
+  int fd;
+
+  for (;;) {
+    fd = accept4 (listenFd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (quit) break;
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      fprintf (stderr, "serverMain - Error accepting a query: %s\n", strerror(errno));
+      break;
+    }
+    // One client at a time; one that stops talking is dropped
+    setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    serveClient (fd);
+    close (fd);
+  }
+  return NULL;
+}
+
+// Listens on --query-socket and starts the thread that answers
+static void queryStart (void) {
+  struct sockaddr_un addr;
+  struct stat st;
+
+  started = 1;
+  if (strlen(querySocket) >= sizeof(addr.sun_path)) {
+    fprintf (stderr, "Error: --query-socket path is too long: %s\n", querySocket);
+    return;
+  }
+  memset (&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, querySocket);
+  listenFd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listenFd < 0) {
+    fprintf (stderr, "queryStart - Error making a socket: %s\n", strerror(errno));
+    return;
+  }
+  // Left over from a run that didn't end cleanly, but only if it is a socket
+  if (lstat (querySocket, &st) == 0 && S_ISSOCK(st.st_mode)) unlink (querySocket);
+  if (bind (listenFd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen (listenFd, 16) != 0) {
+    fprintf (stderr, "queryStart - Error listening on %s: %s\n", querySocket, strerror(errno));
+    close (listenFd);
+    listenFd = -1;
+    return;
+  }
+  if (pthread_create (&server, NULL, serverMain, NULL) != 0) {
+    fprintf (stderr, "Error: could not start the query thread\n");
+    exit(1);
+  }
+  if (verbosity) printf ("Answering queries on %s\n", querySocket);
+}
+
+// Puts the devices as they are after this pass in a new snapshot for the
+// queries, and starts answering them if it isn't already
+void queryPublish (ap *firstAp, enddev *firstEnddev) {
+  snapshot *s = snapshotBuild (firstAp, firstEnddev);
+  snapshot *old;
+
+  pthread_mutex_lock (&lock);
+  old = current;
+  current = s;
+  pthread_mutex_unlock (&lock);
+  if (old) snapshotRelease (old);
+  if (verbosity >= 2) printf ("Query snapshot: %d APs, %d Stations, %ld bytes\n",
+    s->apCount, s->staCount, (long) s->textLen);
+  if (!started) queryStart ();
+}
+
+// Stops answering queries and removes the socket
+void queryFinish (void) {
+  if (listenFd >= 0) {
+    quit = 1;
+    shutdown (listenFd, SHUT_RDWR);
+    pthread_join (server, NULL);
+    close (listenFd);
+    unlink (querySocket);
+    listenFd = -1;
+  }
+  if (current) snapshotRelease (current);
+  current = NULL;
+}
@@ -17,7 +17,6 @@ while [ 1 ]; do
     cp /mnt/ramdisk/alert2-printed.csv /home/chris/
   fi
   COUNTER2=$((COUNTER2+1))
-  cp $OUTPATH/packets-01.csv $OUTPATH/packets-01-old2.csv
   sleep 5
   rm $OUTPATH/alert2.log
   cat $OUTPATH/alert2.txt >> $OUTPATH/alert2.history
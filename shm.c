@@ -0,0 +1,264 @@
+/*
+    Airodump CSV Tools
+    Shared memory device list (--shm).
+    Copyright (C) 2013-2018 Christopher Bolduc
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Writes the segment described in csvshm.h after each pass.  The devices
+ * and strings are put together in memory first, so seq is only odd for
+ * the two memcpys into the segment.  ESSIDs and vendors repeat a lot, so
+ * each string is only stored once (a small hash table of what is already
+ * in the strings).
+ *
+ * The segment is left there when csvtools ends, with the last pass in it.
+ */
+
+#include "csvtools.h"
+#include "csvshm.h"
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static int shmFd = -1;
+static unsigned char *shmMap;
+static size_t shmSize;
+static uint32_t shmSeq;
+
+static csvshmdev *devs;
+static int devsSize;
+static char *strs;
+static size_t strsLen, strsSize;
+static uint32_t *interned; // offsets in strs, 0 empty
+static size_t internedSize, internedCount;
+
+// Opens (or makes) the segment and maps it
+static int shmOpen (void) {
+  struct stat st;
+  csvshmheader *h;
+
+  if (shmMap) return 1;
+  shmFd = shm_open (shmName, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (shmFd < 0) {
+    fprintf (stderr, "shmOpen - Error opening shared memory: %s: %s\n", shmName, strerror(errno));
+    return 0;
+  }
+  fstat (shmFd, &st);
+  shmSize = st.st_size;
+  if (shmSize < CSVSHM_DEVS_OFF) {
+    shmSize = sysconf (_SC_PAGESIZE);
+    if (ftruncate (shmFd, shmSize) != 0) {
+      fprintf (stderr, "shmOpen - Error sizing shared memory: %s: %s\n", shmName, strerror(errno));
+      close (shmFd);
+      return 0;
+    }
+  }
+  shmMap = mmap (NULL, shmSize, PROT_READ | PROT_WRITE, MAP_SHARED, shmFd, 0);
+  if (shmMap == MAP_FAILED) {
+    fprintf (stderr, "shmOpen - Error mapping shared memory: %s: %s\n", shmName, strerror(errno));
+    shmMap = NULL;
+    close (shmFd);
+    return 0;
+  }
+  h = (csvshmheader *) shmMap;
+  // Left by an earlier run: carry on from its seq so readers see a change
+  if (h->magic == CSVSHM_MAGIC) shmSeq = (h->seq + 1) & ~1U;
+  h->magic = CSVSHM_MAGIC;
+  h->version = CSVSHM_VERSION;
+  h->devSize = sizeof(csvshmdev);
+  h->size = shmSize;
+  return 1;
+}
+
+// Makes the segment at least size bytes
+static int shmGrow (size_t size) {
+  long page = sysconf (_SC_PAGESIZE);
+  unsigned char *map;
+
+  if (size <= shmSize) return 1;
+  // A bit extra so it doesn't have to grow again on every pass
+  size = (size + size / 4 + page - 1) / page * page;
+  if (ftruncate (shmFd, size) != 0) {
+    fprintf (stderr, "shmGrow - Error sizing shared memory: %s: %s\n", shmName, strerror(errno));
+    return 0;
+  }
+  map = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shmFd, 0);
+  if (map == MAP_FAILED) {
+    fprintf (stderr, "shmGrow - Error mapping shared memory: %s: %s\n", shmName, strerror(errno));
+    return 0;
+  }
+  munmap (shmMap, shmSize);
+  shmMap = map;
+  shmSize = size;
+  return 1;
+}
+
+// Returns where a string (s) is in strs, adding it if it isn't there yet
+static uint32_t intern (const char *s) {
+  unsigned long long h;
+  size_t i, len, n;
+  uint32_t off, *old;
+
+  if (s[0] == '\0') return 0;
+  if (internedCount * 2 >= internedSize) {
+    // Twice as big, and everything put back in
+    old = interned;
+    n = internedSize;
+    internedSize = internedSize ? internedSize * 2 : 1024;
+    interned = (uint32_t *) calloc (internedSize, sizeof(uint32_t));
+    if (interned == NULL) {
+      fputs ("Memory error\n", stderr);
+      exit(2);
+    }
+    for (i=0; i < n; i++) {
+      if (old[i] == 0) continue;
+      h = hash64 (HASH64_INIT, strs + old[i], strlen(strs + old[i]));
+      for (h &= internedSize - 1; interned[h]; h = (h + 1) & (internedSize - 1));
+      interned[h] = old[i];
+    }
+    free (old);
+  }
+
+  len = strlen(s);
+  h = hash64 (HASH64_INIT, s, len) & (internedSize - 1);
+  for (; interned[h]; h = (h + 1) & (internedSize - 1)) {
+    if (strcmp(strs + interned[h], s) == 0) return interned[h];
+  }
+  if (strsLen + len + 1 > strsSize) {
+    strsSize = (strsLen + len + 1) * 2;
+    strs = (char *) realloc (strs, strsSize);
+    if (strs == NULL) {
+      fputs ("Memory error\n", stderr);
+      exit(2);
+    }
+  }
+  off = strsLen;
+  memcpy (strs + off, s, len + 1);
+  strsLen += len + 1;
+  interned[h] = off;
+  internedCount++;
+  return off;
+}
+
+// Reads a MAC (str) into 6 bytes, all 0 if it isn't one
+static void macBytes (uint8_t *mac, const char *str) {
+  int i;
+
+  if (!isValidMacAddress (str)) {
+    memset (mac, 0, 6);
+    return;
+  }
+  for (i=0; i < 6; i++) mac[i] = charToHex (str[i*3]) << 4 | charToHex (str[i*3+1]);
+}
+
+// Seconds since 1970 for a time the way airodump writes it (local time),
+// utcOffset being how far local time is ahead of UTC
+static int64_t epochSeconds (const char *str, long long utcOffset) {
+  datetime d;
+
+  if (!strToTime (&d, str) || d.year == 0) return 0;
+  return dateToSeconds (&d) - utcOffset;
+}
+
+static void fillDevice (csvshmdev *d, ap *a, enddev *e, long long utcOffset) {
+  memset (d, 0, sizeof(*d));
+  if (a) {
+    d->lastSeen = epochSeconds (a->last_time_seen, utcOffset);
+    macBytes (d->mac, a->bssid);
+    macBytes (d->bssid, a->bssid);
+    d->power = a->power;
+    d->maxPower = a->maxPwrLevel;
+    d->flags = CSVSHM_AP | (a->new ? CSVSHM_NEW : 0) | (a->old ? CSVSHM_OLD : 0) |
+      (a->selected ? CSVSHM_SELECTED : 0) | (a->desc[0] ? CSVSHM_KNOWN : 0) | (a->lat != 0.0 ? CSVSHM_LOCATED : 0);
+    d->essid = intern (a->essid);
+    d->vendor = intern (a->vendor);
+    d->desc = intern (a->desc);
+  } else {
+    d->lastSeen = epochSeconds (e->last_time_seen, utcOffset);
+    macBytes (d->mac, e->station_mac);
+    macBytes (d->bssid, e->bssid);
+    d->power = e->power;
+    d->maxPower = e->maxPwrLevel;
+    d->flags = (e->new ? CSVSHM_NEW : 0) | (e->old ? CSVSHM_OLD : 0) |
+      (e->selected ? CSVSHM_SELECTED : 0) | (e->desc[0] ? CSVSHM_KNOWN : 0) | (e->lat != 0.0 ? CSVSHM_LOCATED : 0);
+    d->essid = intern (e->essid);
+    d->vendor = intern (e->vendor);
+    d->desc = intern (e->desc);
+  }
+}
+
+// Writes every AP and Enddev to the --shm segment
+void shmPublish (ap *firstAp, enddev *firstEnddev) {
+  csvshmheader *h;
+  ap *a;
+  enddev *e;
+  int count = 0;
+  size_t devsLen, stringsOff;
+  char nowstr[26];
+  datetime d;
+  long long now = time(NULL), utcOffset;
+
+  if (!shmOpen ()) return;
+  getNowStr (nowstr);
+  strToTime (&d, nowstr);
+  utcOffset = dateToSeconds (&d) - now;
+
+  for (a = firstAp; a != NULL; a = a->next) count++;
+  for (e = firstEnddev; e != NULL; e = e->next) count++;
+  if (count > devsSize) {
+    devsSize = count * 2;
+    devs = (csvshmdev *) realloc (devs, devsSize * sizeof(csvshmdev));
+    if (devs == NULL) {
+      fputs ("Memory error\n", stderr);
+      exit(2);
+    }
+  }
+  if (interned) memset (interned, 0, internedSize * sizeof(uint32_t));
+  internedCount = 0;
+  if (strs == NULL) {
+    strsSize = 4096;
+    strs = (char *) malloc (strsSize);
+    if (strs == NULL) {
+      fputs ("Memory error\n", stderr);
+      exit(2);
+    }
+  }
+  // Offset 0 is ""
+  strs[0] = '\0';
+  strsLen = 1;
+
+  count = 0;
+  for (a = firstAp; a != NULL; a = a->next) fillDevice (&devs[count++], a, NULL, utcOffset);
+  for (e = firstEnddev; e != NULL; e = e->next) fillDevice (&devs[count++], NULL, e, utcOffset);
+
+  devsLen = count * sizeof(csvshmdev);
+  stringsOff = CSVSHM_DEVS_OFF + devsLen;
+  if (!shmGrow (stringsOff + strsLen)) return;
+
+  h = (csvshmheader *) shmMap;
+  __atomic_store_n (&h->seq, shmSeq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+  h->count = count;
+  h->size = shmSize;
+  h->stringsOff = stringsOff;
+  h->stringsLen = strsLen;
+  h->time = now;
+  memcpy (shmMap + CSVSHM_DEVS_OFF, devs, devsLen);
+  memcpy (shmMap + stringsOff, strs, strsLen);
+  shmSeq += 2;
+  __atomic_store_n (&h->seq, shmSeq, __ATOMIC_RELEASE);
+  if (verbosity >= 2) printf ("Shared memory: %d devices, %ld bytes of strings\n", count, (long) strsLen);
+}
@@ -0,0 +1,289 @@
+/*
+    Airodump CSV Tools
+    Spatial index over located APs and stations.
+    Copyright (C) 2013-2018 Christopher Bolduc
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Devices are dropped into fixed-size lat/lon grid cells, and the cells
+ * are kept in a hash table.  A box query only visits the cells that
+ * overlap the box (or every occupied cell, if that is fewer), so it
+ * doesn't have to look at every device.
+ */
+
+#include "csvtools.h"
+
+#define EARTH_RADIUS 6371008.8 // meters
+#define METERS_PER_DEGREE 111320.0
+
+static unsigned int cellHash (int ilat, int ilon) {
+  return ((unsigned int) ilat * 73856093U) ^ ((unsigned int) ilon * 19349663U);
+}
+
+static spatialcell *findCell (spatialindex *si, int ilat, int ilon) {
+  spatialcell *c = si->buckets[cellHash(ilat, ilon) & (si->nbuckets - 1)];
+  while (c != NULL) {
+    if (c->ilat == ilat && c->ilon == ilon) return c;
+    c = c->hnext;
+  }
+  return NULL;
+}
+
+static void growBuckets (spatialindex *si) {
+  spatialcell *c;
+  unsigned int h;
+  int nb = si->nbuckets * 2;
+
+  free (si->buckets);
+  si->buckets = (spatialcell **) calloc (nb, sizeof(spatialcell *));
+  if (si->buckets == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  si->nbuckets = nb;
+  for (c = si->cells; c != NULL; c = c->next) {
+    h = cellHash(c->ilat, c->ilon) & (nb - 1);
+    c->hnext = si->buckets[h];
+    si->buckets[h] = c;
+  }
+}
+
+// Great circle distance in meters
+double geoDistance (double lat1, double lon1, double lat2, double lon2) {
+  double dlat = (lat2 - lat1) * M_PI / 180;
+  double dlon = (lon2 - lon1) * M_PI / 180;
+  double h = sin(dlat/2) * sin(dlat/2) +
+    cos(lat1 * M_PI / 180) * cos(lat2 * M_PI / 180) * sin(dlon/2) * sin(dlon/2);
+  return 2 * EARTH_RADIUS * asin(sqrt(h));
+}
+
+// cellSize is in degrees
+spatialindex *spatialNew (double cellSize) {
+  spatialindex *si = (spatialindex *) malloc (sizeof(spatialindex));
+  if (si == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  si->cellSize = cellSize;
+  si->nbuckets = 256;
+  si->buckets = (spatialcell **) calloc (si->nbuckets, sizeof(spatialcell *));
+  if (si->buckets == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  si->cells = NULL;
+  si->ncells = 0;
+  si->count = 0;
+  si->south = si->west = 1000;
+  si->north = si->east = -1000;
+  return si;
+}
+
+void spatialAdd (spatialindex *si, double lat, double lon, ap *a, enddev *e) {
+  int ilat = (int) floor(lat / si->cellSize);
+  int ilon = (int) floor(lon / si->cellSize);
+  spatialcell *c = findCell(si, ilat, ilon);
+  spatialentry *se;
+  unsigned int h;
+
+  if (c == NULL) {
+    c = (spatialcell *) malloc (sizeof(spatialcell));
+    if (c == NULL) {
+      fputs ("Memory error\n", stderr);
+      exit(2);
+    }
+    c->ilat = ilat;
+    c->ilon = ilon;
+    c->first = NULL;
+    c->count = 0;
+    h = cellHash(ilat, ilon) & (si->nbuckets - 1);
+    c->hnext = si->buckets[h];
+    si->buckets[h] = c;
+    c->next = si->cells;
+    si->cells = c;
+    si->ncells++;
+    if (si->ncells > si->nbuckets * 2) growBuckets(si);
+  }
+  se = (spatialentry *) malloc (sizeof(spatialentry));
+  if (se == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  se->lat = lat;
+  se->lon = lon;
+  se->a = a;
+  se->e = e;
+  se->mark = 0;
+  se->next = c->first;
+  c->first = se;
+  c->count++;
+  si->count++;
+  if (lat < si->south) si->south = lat;
+  if (lat > si->north) si->north = lat;
+  if (lon < si->west) si->west = lon;
+  if (lon > si->east) si->east = lon;
+}
+
+// Indexes every AP and Enddev that has GPS coordinates
+spatialindex *spatialBuild (ap *firstAp, enddev *firstEnddev, int showAPs, int showEnddevs) {
+  spatialindex *si = spatialNew(SPATIAL_CELL_SIZE);
+  ap *a;
+  enddev *e;
+
+  for (a = showAPs ? firstAp : NULL; a != NULL; a = a->next) {
+    if (a->lat != 0.0) spatialAdd(si, a->lat, a->lon, a, NULL);
+  }
+  for (e = showEnddevs ? firstEnddev : NULL; e != NULL; e = e->next) {
+    if (e->lat != 0.0) spatialAdd(si, e->lat, e->lon, NULL, e);
+  }
+  return si;
+}
+
+static void addResult (spatialentry ***res, int *n, int *cap, spatialentry *se) {
+  if (*n == *cap) {
+    *cap = *cap ? *cap * 2 : 64;
+    *res = (spatialentry **) realloc (*res, *cap * sizeof(spatialentry *));
+    if (*res == NULL) {
+      fputs ("Memory error\n", stderr);
+      exit(2);
+    }
+  }
+  (*res)[(*n)++] = se;
+}
+
+static void scanCell (spatialcell *c, double south, double west, double north, double east,
+    spatialentry ***res, int *n, int *cap) {
+  spatialentry *se;
+  for (se = c->first; se != NULL; se = se->next) {
+    if (se->lat >= south && se->lat < north && se->lon >= west && se->lon < east)
+      addResult(res, n, cap, se);
+  }
+}
+
+// Finds every entry with south <= lat < north and west <= lon < east
+// Places a malloc'd array of entries in res and returns how many there are
+int spatialQueryBox (spatialindex *si, double south, double west, double north, double east, spatialentry ***res) {
+  int n = 0, cap = 0;
+  int ilat, ilon;
+  int lat0 = (int) floor(south / si->cellSize);
+  int lat1 = (int) floor(north / si->cellSize);
+  int lon0 = (int) floor(west / si->cellSize);
+  int lon1 = (int) floor(east / si->cellSize);
+  double span = ((double) lat1 - lat0 + 1) * ((double) lon1 - lon0 + 1);
+  spatialcell *c;
+
+  *res = NULL;
+  if (span > si->ncells) {
+    // Big box, cheaper to look at every occupied cell
+    for (c = si->cells; c != NULL; c = c->next) {
+      if (c->ilat >= lat0 && c->ilat <= lat1 && c->ilon >= lon0 && c->ilon <= lon1)
+        scanCell(c, south, west, north, east, res, &n, &cap);
+    }
+    return n;
+  }
+  for (ilat = lat0; ilat <= lat1; ilat++) {
+    for (ilon = lon0; ilon <= lon1; ilon++) {
+      c = findCell(si, ilat, ilon);
+      if (c != NULL) scanCell(c, south, west, north, east, res, &n, &cap);
+    }
+  }
+  return n;
+}
+
+typedef struct distsort {
+  double dist;
+  spatialentry *se;
+} distsort;
+
+static int compareDist ( const void *p1, const void *p2 ) {
+  const distsort *d1 = (const distsort *) p1;
+  const distsort *d2 = (const distsort *) p2;
+
+  if (d1->dist < d2->dist) return -1;
+  if (d1->dist > d2->dist) return 1;
+  return 0;
+}
+
+// Finds every entry within (meters) of lat, lon, closest first
+// If dist is not NULL, it gets a malloc'd array of the distances
+int spatialQueryRadius (spatialindex *si, double lat, double lon, double meters, spatialentry ***res, double **dist) {
+  spatialentry **box;
+  distsort *ds;
+  double dlat = meters / METERS_PER_DEGREE;
+  double coslat = cos(lat * M_PI / 180);
+  double dlon = coslat > 0.000001 ? meters / (METERS_PER_DEGREE * coslat) : 360;
+  double d;
+  int i, n, found = 0;
+
+  n = spatialQueryBox(si, lat - dlat, lon - dlon, lat + dlat, lon + dlon, &box);
+  ds = (distsort *) malloc ((n ? n : 1) * sizeof(distsort));
+  if (ds == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  for (i=0; i < n; i++) {
+    d = geoDistance(lat, lon, box[i]->lat, box[i]->lon);
+    if (d <= meters) {
+      ds[found].dist = d;
+      ds[found].se = box[i];
+      found++;
+    }
+  }
+  qsort(ds, found, sizeof(distsort), &compareDist);
+  for (i=0; i < found; i++) box[i] = ds[i].se;
+  if (dist) {
+    *dist = (double *) malloc ((found ? found : 1) * sizeof(double));
+    if (*dist == NULL) {
+      fputs ("Memory error\n", stderr);
+      exit(2);
+    }
+    for (i=0; i < found; i++) (*dist)[i] = ds[i].dist;
+  }
+  free (ds);
+  *res = box;
+  return found;
+}
+
+void spatialFree (spatialindex *si) {
+  spatialcell *c, *cnext;
+  spatialentry *se, *snext;
+
+  if (si == NULL) return;
+  for (c = si->cells; c != NULL; c = cnext) {
+    cnext = c->next;
+    for (se = c->first; se != NULL; se = snext) {
+      snext = se->next;
+      free (se);
+    }
+    free (c);
+  }
+  free (si->buckets);
+  free (si);
+}
+
+// Prints one query result to a file (f)
+void printSpatialEntry (spatialentry *se, double dist, FILE *f) {
+  if (se->a) {
+    fprintf (f, "AP:  %s ESSID: %s PWR: %d MAXPWR: %d LAT: %lf LON: %lf", se->a->bssid, se->a->essid,
+      se->a->power, se->a->maxPwrLevel, se->lat, se->lon);
+    if (dist >= 0) fprintf (f, " DIST: %.0lfm", dist);
+    fprintf (f, " DESC: %s VEN: %s%s", se->a->desc, se->a->vendor, CRLF);
+  } else {
+    fprintf (f, "STA: %s ESSID: %s PWR: %d MAXPWR: %d LAT: %lf LON: %lf", se->e->station_mac, se->e->essid,
+      se->e->power, se->e->maxPwrLevel, se->lat, se->lon);
+    if (dist >= 0) fprintf (f, " DIST: %.0lfm", dist);
+    fprintf (f, " DESC: %s VEN: %s%s", se->e->desc, se->e->vendor, CRLF);
+  }
+}
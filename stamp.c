@@ -0,0 +1,216 @@
+/*
+    Airodump CSV Tools
+    Stamp of the input files, to skip runs that would change nothing.
+    Copyright (C) 2013-2018 Christopher Bolduc
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* tracker.sh runs csvtools every five seconds whether or not airodump
+ * has seen anything new.  [prefix]-stamp holds the size, modification
+ * time and a hash of every input file, plus a hash of the options.  If
+ * nothing differs on the next run, the outputs would come out the same,
+ * so the run stops before reading or writing anything.  A file is only
+ * hashed when its size is the same as before but its modification time
+ * isn't (a file that grew has changed, whatever it holds now), and always
+ * before the run reads it, so the hash in the stamp is never of something
+ * newer than what was read.  A hash of 0 in the stamp means the file
+ * wasn't hashed.
+ *
+ * The stamp file looks like this (the file name goes last, it may have
+ * spaces in it):
+ *
+ *   options 5f0e8c1a9d2b7c44
+ *   1219011 1536314400.123456789 a1b2c3d4e5f60718 /tmp/packets-01.csv
+ */
+
+#include "csvtools.h"
+#include <sys/stat.h>
+
+typedef struct stampentry {
+  char name[256];
+  long long size;
+  long long mtime;
+  long mtimeNsec;
+  unsigned long long hash;
+  int hashed;
+} stampentry;
+
+typedef struct stamp {
+  unsigned long long options;
+  int count;
+  stampentry *files;
+} stamp;
+
+static stamp cur, prev;
+static int havePrev;
+
+static void addEntry (stamp *s, const stampentry *se) {
+  s->files = (stampentry *) realloc (s->files, (s->count + 1) * sizeof(stampentry));
+  if (s->files == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  s->files[s->count++] = *se;
+}
+
+static void freeStamp (stamp *s) {
+  free (s->files);
+  s->files = NULL;
+  s->count = 0;
+}
+
+// Hashes the contents of a file (fileName)
+// Returns 0 if it can't be read
+static unsigned long long hashFile (const char *fileName) {
+  FILE *f;
+  char buffer[65536];
+  size_t n;
+  unsigned long long h = HASH64_INIT;
+
+  f = fopen (fileName, "r");
+  if (f == NULL) return 0;
+  while ((n = fread (buffer, 1, sizeof(buffer), f)) > 0) h = hash64 (h, buffer, n);
+  fclose (f);
+  return h;
+}
+
+// Starts a new stamp with the options (argv), stampAddFile adds the files
+// The one worked out before is kept to compare against
+void stampBegin (int argc, char **argv) {
+  unsigned long long h = HASH64_INIT;
+  int i;
+
+  freeStamp (&prev);
+  prev = cur;
+  havePrev = cur.files != NULL || cur.options != 0;
+  memset (&cur, 0, sizeof(cur));
+  for (i=1; i < argc; i++) h = hash64 (h, argv[i], strlen(argv[i]) + 1);
+  cur.options = h;
+}
+
+// Adds a file (fileName, may be NULL) to the stamp
+void stampAddFile (const char *fileName) {
+  stampentry se;
+  struct stat st;
+
+  if (fileName == NULL) return;
+  memset (&se, 0, sizeof(se));
+  strncpy (se.name, fileName, sizeof(se.name) - 1);
+  if (stat (fileName, &st) == 0) {
+    se.size = st.st_size;
+    se.mtime = st.st_mtim.tv_sec;
+    se.mtimeNsec = st.st_mtim.tv_nsec;
+  } else {
+    se.size = -1;
+  }
+  addEntry (&cur, &se);
+}
+
+// Reads a stamp file (fileName) to compare the current stamp against
+// Returns -1 if there isn't one
+int stampLoad (const char *fileName) {
+  FILE *f;
+  char line[512];
+  stampentry se;
+  int n;
+
+  f = fopen (fileName, "r");
+  if (f == NULL) return -1;
+  freeStamp (&prev);
+  memset (&prev, 0, sizeof(prev));
+  havePrev = 1;
+  while (fgets (line, sizeof(line), f) != NULL) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (sscanf (line, "options %llx", &prev.options) == 1) continue;
+    memset (&se, 0, sizeof(se));
+    if (sscanf (line, "%lld %lld.%ld %llx %n", &se.size, &se.mtime, &se.mtimeNsec, &se.hash, &n) < 4) continue;
+    strncpy (se.name, line + n, sizeof(se.name) - 1);
+    se.hashed = se.hash != 0;
+    addEntry (&prev, &se);
+  }
+  fclose (f);
+  return 0;
+}
+
+// Returns the entry for a file (name) in the previous stamp, or NULL
+static stampentry *findPrev (const char *name, int i) {
+  if (i < prev.count && strcmp(prev.files[i].name, name) == 0) return prev.files + i;
+  for (i=0; i < prev.count; i++) {
+    if (strcmp(prev.files[i].name, name) == 0) return prev.files + i;
+  }
+  return NULL;
+}
+
+// Hashes the files in the current stamp whose size is the same as in the
+// previous stamp but whose modification time isn't.  A file whose size and
+// modification time are the same takes the previous hash (or lack of one),
+// and any other file has changed, so it isn't hashed.
+static void hashFiles (void) {
+  stampentry *c, *p;
+  int i;
+
+  for (i=0; i < cur.count; i++) {
+    c = cur.files + i;
+    if (c->hashed || c->size < 0) continue;
+    p = havePrev ? findPrev (c->name, i) : NULL;
+    if (p == NULL || c->size != p->size) continue;
+    if (c->mtime == p->mtime && c->mtimeNsec == p->mtimeNsec) {
+      c->hash = p->hash;
+      c->hashed = p->hashed;
+    } else {
+      c->hash = hashFile (c->name);
+      c->hashed = 1;
+    }
+  }
+}
+
+// Returns 1 if the current stamp matches the one before it (a file
+// rewritten with the same contents is still unchanged)
+// Call it before the files are read: it hashes them for stampSave too
+int stampUnchanged (void) {
+  stampentry *c, *p;
+  int i;
+
+  hashFiles ();
+  if (!havePrev) return 0;
+  if (cur.options != prev.options || cur.count != prev.count) return 0;
+  for (i=0; i < cur.count; i++) {
+    c = cur.files + i;
+    p = prev.files + i;
+    if (strcmp(c->name, p->name) != 0) return 0;
+    if (c->size < 0 || c->size != p->size) return 0;
+    // Not hashed here means the size and modification time are the same
+    if (c->hashed && c->hash != p->hash) return 0;
+  }
+  return 1;
+}
+
+// Writes the current stamp to a file (fileName)
+void stampSave (const char *fileName) {
+  FILE *f;
+  int i;
+
+  f = fopen (fileName, "w");
+  if (f == NULL) {
+    fprintf (stderr, "stampSave - Error opening file: %s\n", fileName);
+    return;
+  }
+  fprintf (f, "options %016llx\n", cur.options);
+  for (i=0; i < cur.count; i++) {
+    fprintf (f, "%lld %lld.%09ld %016llx %s\n", cur.files[i].size, cur.files[i].mtime,
+      cur.files[i].mtimeNsec, cur.files[i].hash, cur.files[i].name);
+  }
+  fclose (f);
+}
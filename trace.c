@@ -0,0 +1,341 @@
+/*
+    Airodump CSV Tools
+    Binary trace (--trace, --trace-decode).
+    Copyright (C) 2013-2018 Christopher Bolduc
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* -vv printed a line for every hash table lookup and every row read, which
+ * made a pass many times slower and went to stdout (where the -to alerts
+ * go).  With --trace [file], the same things are kept as 24 byte records in
+ * a ring of TRACE_RING records for each thread instead, so only the last
+ * ones are kept and nothing is formatted while csvtools runs.  The rings
+ * are written to [file] when csvtools ends, and with --watch on a SIGUSR2.
+ * --trace-decode [file] prints one as text.
+ *
+ * Only the thread a ring belongs to writes to it, so there are no locks on
+ * the way in.  A ring goes back on a list when its thread ends, for the
+ * next thread (the render threads come and go every pass) to carry on
+ * with.  traceWrite copies a ring while its thread may still be adding to
+ * it, and then drops the records that could have been overwritten during
+ * the copy.
+ */
+
+#include "csvtools.h"
+#include <errno.h>
+#include <pthread.h>
+
+#define TRACE_RING 8192 // records in each thread's ring, a power of 2
+#define TRACE_NAMES 256
+#define TRACE_MAGIC "CSVTRC1\n"
+
+#define TRACE_NONE 0 // what tracerec.mac holds
+#define TRACE_MAC 1 // a MAC, 6 bytes
+#define TRACE_TEXT 2 // up to 8 chars of something that wasn't one
+
+#define ARG_NONE 0 // what the decoder makes of tracerec.arg
+#define ARG_NUMBER 1
+#define ARG_PHASE 2
+#define ARG_NAME 3
+
+typedef struct tracerec {
+  long long ns; // metricsClock
+  unsigned char mac[8];
+  unsigned int arg;
+  unsigned char event;
+  unsigned char macKind;
+  unsigned short thread;
+} tracerec;
+
+typedef struct tracering {
+  tracerec recs[TRACE_RING];
+  unsigned long long head; // records ever written
+  struct tracering *next; // on the list of all rings
+  struct tracering *nextFree;
+} tracering;
+
+typedef struct traceevent {
+  const char *name;
+  const char *argName;
+  int argKind;
+} traceevent;
+
+static const traceevent events[TRACE_EVENTS] = {
+  { "none", NULL, ARG_NONE },
+  { "pass", NULL, ARG_NUMBER },
+  { "begin", NULL, ARG_PHASE },
+  { "end", NULL, ARG_PHASE },
+  { "file", NULL, ARG_NAME },
+  { "file_done", "rows", ARG_NUMBER },
+  { "ap_row", "unchanged", ARG_NUMBER },
+  { "ap_new", "new", ARG_NUMBER },
+  { "sta_row", "unchanged", ARG_NUMBER },
+  { "sta_new", "new", ARG_NUMBER },
+  { "ap_add", "chain", ARG_NUMBER },
+  { "sta_add", "chain", ARG_NUMBER },
+  { "ap_hit", "probes", ARG_NUMBER },
+  { "ap_miss", "probes", ARG_NUMBER },
+  { "sta_hit", "probes", ARG_NUMBER },
+  { "sta_miss", "probes", ARG_NUMBER },
+  { "bad_mac", "char", ARG_NUMBER },
+  { "ap_power", "found", ARG_NUMBER },
+  { "sta_power", "found", ARG_NUMBER },
+  { "printed", "found", ARG_NUMBER },
+  { "ap_power_out", NULL, ARG_NONE },
+  { "printed_out", "extra", ARG_NUMBER },
+  { "sta_sort", "index", ARG_NUMBER }
+};
+
+static tracering *rings;
+static tracering *freeRings;
+static int threads;
+static char *names[TRACE_NAMES];
+static int nameCount;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ringKey;
+static pthread_once_t ringOnce = PTHREAD_ONCE_INIT;
+static __thread tracering *mine;
+static __thread int thread;
+
+// A thread ended: its ring is for the next one
+static void ringDone (void *arg) {
+  tracering *r = (tracering *) arg;
+
+  pthread_mutex_lock (&lock);
+  r->nextFree = freeRings;
+  freeRings = r;
+  pthread_mutex_unlock (&lock);
+}
+
+static void makeKey (void) {
+  pthread_key_create (&ringKey, ringDone);
+}
+
+// The calling thread's ring
+static tracering *ring (void) {
+  tracering *r;
+
+  pthread_once (&ringOnce, makeKey);
+  pthread_mutex_lock (&lock);
+  r = freeRings;
+  if (r != NULL) {
+    freeRings = r->nextFree;
+  } else {
+    r = (tracering *) calloc (1, sizeof(tracering));
+    if (r == NULL) {
+      fputs ("Memory error\n", stderr);
+      exit(2);
+    }
+    r->next = rings;
+    rings = r;
+  }
+  thread = threads++;
+  pthread_mutex_unlock (&lock);
+  pthread_setspecific (ringKey, r);
+  mine = r;
+  return r;
+}
+
+// Adds an event to the calling thread's ring, with a MAC (mac, or NULL)
+// and a number (arg).  Use TRACE, which doesn't get here without --trace.
+void traceEvent (int event, const char *mac, unsigned int arg) {
+  tracering *r = mine ? mine : ring ();
+  unsigned long long head = r->head;
+  tracerec *t = &r->recs[head & (TRACE_RING - 1)];
+  int i, hi, lo;
+
+  t->ns = metricsClock ();
+  t->event = event;
+  t->thread = thread;
+  t->arg = arg;
+  t->macKind = TRACE_NONE;
+  if (mac != NULL) {
+    t->macKind = TRACE_MAC;
+    for (i=0; i < 6; i++) {
+      hi = charToHex (mac[i*3]);
+      lo = hi < 0 ? -1 : charToHex (mac[i*3+1]);
+      if (lo < 0 || (i < 5 && mac[i*3+2] != ':')) break;
+      t->mac[i] = hi << 4 | lo;
+    }
+    if (i < 6) {
+      t->macKind = TRACE_TEXT;
+      strncpy ((char *) t->mac, mac, 8);
+    }
+  }
+  __atomic_store_n (&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Returns a number for a name (a file name, say) that traceWrite writes
+// out with the records, so a record can have it as its arg
+unsigned int traceName (const char *name) {
+  int i;
+
+  pthread_mutex_lock (&lock);
+  for (i=0; i < nameCount; i++) {
+    if (strcmp(names[i], name) == 0) break;
+  }
+  if (i == nameCount && nameCount < TRACE_NAMES) {
+    names[i] = strdup (name);
+    if (names[i] == NULL) {
+      fputs ("Memory error\n", stderr);
+      exit(2);
+    }
+    nameCount++;
+  }
+  pthread_mutex_unlock (&lock);
+  return i;
+}
+
+// Writes every ring to the --trace file:
+//   TRACE_MAGIC, sizeof(tracerec), the names (count, then each one with
+//   its \0), and for each ring its record count and records, oldest first
+void traceWrite (void) {
+  static tracerec *copy;
+  tracering *r;
+  unsigned long long h1, h2, from, x;
+  unsigned int n, size = sizeof(tracerec);
+  FILE *f;
+  int i;
+
+  if (traceFile == NULL) return;
+  if (copy == NULL) {
+    copy = (tracerec *) malloc (TRACE_RING * sizeof(tracerec));
+    if (copy == NULL) {
+      fputs ("Memory error\n", stderr);
+      exit(2);
+    }
+  }
+  f = outputOpen (traceFile);
+  fwrite (TRACE_MAGIC, 1, 8, f);
+  fwrite (&size, sizeof(size), 1, f);
+  pthread_mutex_lock (&lock);
+  fwrite (&nameCount, sizeof(nameCount), 1, f);
+  for (i=0; i < nameCount; i++) fwrite (names[i], 1, strlen(names[i]) + 1, f);
+  for (r = rings; r != NULL; r = r->next) {
+    h1 = __atomic_load_n (&r->head, __ATOMIC_ACQUIRE);
+    memcpy (copy, r->recs, sizeof(r->recs));
+    h2 = __atomic_load_n (&r->head, __ATOMIC_ACQUIRE);
+    // Slot x % TRACE_RING was written again (or is being) by record
+    // x + TRACE_RING, for each x up to h2 - TRACE_RING
+    from = h1 > TRACE_RING ? h1 - TRACE_RING : 0;
+    if (h2 + 1 > TRACE_RING && h2 + 1 - TRACE_RING > from) from = h2 + 1 - TRACE_RING;
+    n = from < h1 ? h1 - from : 0;
+    fwrite (&n, sizeof(n), 1, f);
+    for (x = from; x < h1; x++) fwrite (&copy[x & (TRACE_RING - 1)], sizeof(tracerec), 1, f);
+  }
+  pthread_mutex_unlock (&lock);
+  outputCommit ();
+}
+
+static int compareTraceTime (const void *p1, const void *p2) {
+  const tracerec *t1 = (const tracerec *) p1;
+  const tracerec *t2 = (const tracerec *) p2;
+
+  if (t1->ns != t2->ns) return t1->ns < t2->ns ? -1 : 1;
+  return t1->thread - t2->thread;
+}
+
+// Prints a file traceWrite wrote (fileName) as text, in time order
+// Returns 0 if it couldn't
+int traceDecode (const char *fileName) {
+  char *buffer;
+  long size, off, i;
+  unsigned int recSize, n;
+  int count, j, nameTotal;
+  char **nameList;
+  tracerec *recs = NULL;
+  long recCount = 0;
+  const traceevent *ev;
+  char mac[9];
+  FILE *f;
+
+  f = fopen (fileName, "rb");
+  if (f == NULL) {
+    fprintf (stderr, "traceDecode - Error opening file: %s: %s\n", fileName, strerror(errno));
+    return 0;
+  }
+  buffer = readFileToString (f, &size);
+  fclose (f);
+  if (size < 16 || memcmp (buffer, TRACE_MAGIC, 8) != 0) {
+    fprintf (stderr, "traceDecode - Error: %s is not a --trace file\n", fileName);
+    free (buffer);
+    return 0;
+  }
+  memcpy (&recSize, buffer + 8, sizeof(recSize));
+  memcpy (&nameTotal, buffer + 12, sizeof(nameTotal));
+  if (recSize != sizeof(tracerec) || nameTotal < 0 || nameTotal > TRACE_NAMES) {
+    fprintf (stderr, "traceDecode - Error: %s was written by a different build\n", fileName);
+    free (buffer);
+    return 0;
+  }
+  nameList = (char **) malloc ((nameTotal + 1) * sizeof(char *));
+  if (nameList == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  off = 16;
+  for (count = 0; count < nameTotal && off < size; count++) {
+    nameList[count] = buffer + off;
+    off += strnlen (buffer + off, size - off) + 1;
+  }
+  nameTotal = count;
+
+  // Each ring's records, all together
+  while (off + (long) sizeof(n) <= size) {
+    memcpy (&n, buffer + off, sizeof(n));
+    off += sizeof(n);
+    if ((size - off) / (long) sizeof(tracerec) < n) n = (size - off) / sizeof(tracerec);
+    recs = (tracerec *) realloc (recs, (recCount + n + 1) * sizeof(tracerec));
+    if (recs == NULL) {
+      fputs ("Memory error\n", stderr);
+      exit(2);
+    }
+    memcpy (recs + recCount, buffer + off, n * sizeof(tracerec));
+    recCount += n;
+    off += n * sizeof(tracerec);
+  }
+  if (recCount) qsort (recs, recCount, sizeof(tracerec), compareTraceTime);
+
+  for (i=0; i < recCount; i++) {
+    if (recs[i].event >= TRACE_EVENTS) continue;
+    ev = &events[recs[i].event];
+    printf ("%12.6f t%-3d %-12s", (recs[i].ns - recs[0].ns) / 1e9, recs[i].thread, ev->name);
+    if (recs[i].macKind == TRACE_MAC) {
+      printf (" %02X:%02X:%02X:%02X:%02X:%02X", recs[i].mac[0], recs[i].mac[1], recs[i].mac[2],
+        recs[i].mac[3], recs[i].mac[4], recs[i].mac[5]);
+    } else if (recs[i].macKind == TRACE_TEXT) {
+      for (j=0; j < 8 && recs[i].mac[j]; j++) mac[j] = recs[i].mac[j];
+      mac[j] = '\0';
+      printf (" \"%s\"", mac);
+    }
+    switch (ev->argKind) {
+    case ARG_NUMBER:
+      if (ev->argName) printf (" %s=%u", ev->argName, recs[i].arg);
+      else printf (" %u", recs[i].arg);
+      break;
+    case ARG_PHASE:
+      printf (" %s", recs[i].arg < PHASE_COUNT ? phaseName (recs[i].arg) : "?");
+      break;
+    case ARG_NAME:
+      printf (" %s", recs[i].arg < (unsigned int) nameTotal ? nameList[recs[i].arg] : "?");
+      break;
+    }
+    putchar ('\n');
+  }
+  free (recs);
+  free (nameList);
+  free (buffer);
+  return 1;
+}
@@ -0,0 +1,147 @@
+/*
+    Airodump CSV Tools
+    GPS track output, simplified with Douglas-Peucker.
+    Copyright (C) 2013-2018 Christopher Bolduc
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* The GPS app logs a fix about once a second, which is far more than a
+ * route needs.  The file is read one line at a time into a fixed window
+ * that gets simplified whenever it fills up.  The last point of each
+ * window is carried over as the first point of the next one, so the
+ * pieces join up and the whole log is never held in memory.
+ */
+
+#include "csvtools.h"
+
+#define TRACK_WINDOW 1024
+#define METERS_PER_DEGREE 111320.0
+
+typedef struct trackpoint {
+  double lat;
+  double lon;
+} trackpoint;
+
+// Distance in meters from p to the segment a-b (flat earth is plenty here)
+static double segmentDistance (const trackpoint *p, const trackpoint *a, const trackpoint *b) {
+  double k = cos(a->lat * M_PI / 180) * METERS_PER_DEGREE;
+  double bx = (b->lon - a->lon) * k;
+  double by = (b->lat - a->lat) * METERS_PER_DEGREE;
+  double px = (p->lon - a->lon) * k;
+  double py = (p->lat - a->lat) * METERS_PER_DEGREE;
+  double len2 = bx * bx + by * by;
+  double t;
+
+  if (len2 == 0) return sqrt(px * px + py * py);
+  t = (px * bx + py * by) / len2;
+  if (t < 0) t = 0;
+  if (t > 1) t = 1;
+  px -= t * bx;
+  py -= t * by;
+  return sqrt(px * px + py * py);
+}
+
+// Douglas-Peucker on pts[0..n-1], sets keep[i] for the points to keep
+// Uses its own stack instead of recursion
+static void simplify (const trackpoint *pts, int n, double tolerance, char *keep) {
+  int stack[2 * TRACK_WINDOW];
+  int sp = 0;
+  int first, last, i, best;
+  double d, bestDist;
+
+  memset (keep, 0, n);
+  if (n == 0) return;
+  keep[0] = keep[n-1] = 1;
+  stack[sp++] = 0;
+  stack[sp++] = n - 1;
+  while (sp > 0) {
+    last = stack[--sp];
+    first = stack[--sp];
+    best = -1;
+    bestDist = tolerance;
+    for (i = first + 1; i < last; i++) {
+      d = segmentDistance (pts + i, pts + first, pts + last);
+      if (d > bestDist) {
+        bestDist = d;
+        best = i;
+      }
+    }
+    if (best == -1) continue;
+    keep[best] = 1;
+    stack[sp++] = first;
+    stack[sp++] = best;
+    stack[sp++] = best;
+    stack[sp++] = last;
+  }
+}
+
+// Prints the kept points of the window, optionally leaving off the last one
+static int printWindow (const trackpoint *pts, const char *keep, int n, int withLast, FILE *f) {
+  int i, ct = 0;
+  if (!withLast) n--;
+  for (i=0; i < n; i++) {
+    if (!keep[i]) continue;
+    fprintf (f, "%.6lf,%.6lf ", pts[i].lon, pts[i].lat);
+    // Keep the lines short
+    if (++ct % 8 == 0) fprintf (f, "%s", CRLF);
+  }
+  return ct;
+}
+
+// Reads the GPS file (gpsFileName) and prints the simplified route as a
+// KML Placemark to a file (f).  tolerance is in meters.
+// Returns the number of points printed, or -1 if the file can't be read
+int printTrackToFileKML (const char *gpsFileName, FILE *f, double tolerance) {
+  FILE *gpsf;
+  char line[256];
+  trackpoint pts[TRACK_WINDOW];
+  char keep[TRACK_WINDOW];
+  datetime dt;
+  double lat, lon;
+  int n = 0, total = 0, printed = 0;
+
+  gpsf = fopen (gpsFileName, "r");
+  if (gpsf == NULL) {
+    fprintf (stderr, "printTrackToFileKML - Error opening file: %s\n", gpsFileName);
+    return -1;
+  }
+
+  fprintf (f, "<Placemark>%s<name>GPS track</name>%s"
+    "<Style><LineStyle><color>ff0000ff</color><width>3</width></LineStyle></Style>%s"
+    "<LineString>%s<tessellate>1</tessellate>%s<coordinates>%s", CRLF, CRLF, CRLF, CRLF, CRLF, CRLF);
+
+  while (fgets (line, sizeof(line), gpsf) != NULL) {
+    if (sscanf (line, "%d-%d-%d %d:%d:%d, %lf, %lf", &dt.year, &dt.month, &dt.day,
+          &dt.hour, &dt.minute, &dt.second, &lat, &lon) != 8) continue;
+    if (lat == 0.0 && lon == 0.0) continue; // no fix
+    total++;
+    pts[n].lat = lat;
+    pts[n].lon = lon;
+    n++;
+    if (n == TRACK_WINDOW) {
+      simplify (pts, n, tolerance, keep);
+      printed += printWindow (pts, keep, n, 0, f);
+      pts[0] = pts[n-1];
+      n = 1;
+    }
+  }
+  simplify (pts, n, tolerance, keep);
+  printed += printWindow (pts, keep, n, 1, f);
+
+  fprintf (f, "%s</coordinates>%s</LineString>%s</Placemark>%s", CRLF, CRLF, CRLF, CRLF);
+  fclose (gpsf);
+  if (verbosity) printf ("GPS track: kept %d of %d points\n", printed, total);
+  return printed;
+}
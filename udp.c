@@ -0,0 +1,155 @@
+/*
+    Airodump CSV Tools
+    UDP alerts (-u).
+    Copyright (C) 2013-2018 Christopher Bolduc
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* send_info_udp used to make a new socket and look the server up for
+ * every alert, and never closed the socket.  Now each server (host and
+ * port; profiles can have their own -u) gets one socket, looked up and
+ * connected the first time it is used and kept for the whole run.
+ *
+ * Alerts are only queued while the devices are selected (udpQueue).
+ * udpFlush sends everything queued for a server with one sendmmsg call,
+ * still one datagram per alert, after the outputs are done.  The socket
+ * doesn't block: if the network can't take them, the rest of the alerts
+ * are dropped rather than holding up the next pass.  --events udp:
+ * goes through here too.
+ */
+
+#define _GNU_SOURCE // sendmmsg
+#include "csvtools.h"
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#define UDP_QUEUE_MAX 256 // alerts per server between flushes
+#define UDP_MSG_MAX 1024 // longer alerts are cut short
+
+typedef struct udpsink {
+  char host[256];
+  int port;
+  int fd; // -1 until it could be looked up and connected
+  int count;
+  int len[UDP_QUEUE_MAX];
+  char msg[UDP_QUEUE_MAX][UDP_MSG_MAX];
+  struct udpsink *next;
+} udpsink;
+
+static udpsink *sinks;
+
+// Looks up and connects the socket of a server (s)
+static int udpConnect (udpsink *s) {
+  struct addrinfo hints, *res, *r;
+  char port[16];
+  int err;
+
+  memset (&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  snprintf (port, sizeof(port), "%d", s->port);
+  err = getaddrinfo (s->host, port, &hints, &res);
+  if (err != 0) {
+    fprintf (stderr, "udpConnect - Error looking up %s: %s\n", s->host, gai_strerror(err));
+    return 0;
+  }
+  for (r = res; r != NULL; r = r->ai_next) {
+    s->fd = socket (r->ai_family, r->ai_socktype, r->ai_protocol);
+    if (s->fd < 0) continue;
+    if (connect (s->fd, r->ai_addr, r->ai_addrlen) == 0) break;
+    close (s->fd);
+    s->fd = -1;
+  }
+  freeaddrinfo (res);
+  if (s->fd < 0) {
+    fprintf (stderr, "udpConnect - Error connecting to %s:%d\n", s->host, s->port);
+    return 0;
+  }
+  fcntl (s->fd, F_SETFL, fcntl (s->fd, F_GETFL) | O_NONBLOCK);
+  fcntl (s->fd, F_SETFD, FD_CLOEXEC);
+  return 1;
+}
+
+// Sends what is queued for a server (s)
+static void udpSend (udpsink *s) {
+  struct mmsghdr msgs[UDP_QUEUE_MAX];
+  struct iovec iov[UDP_QUEUE_MAX];
+  int i, sent = 0, n, refused = 0;
+
+  if (s->count == 0) return;
+  // Look it up again each time until it works, but not for every alert
+  if (s->fd < 0 && !udpConnect (s)) {
+    s->count = 0;
+    return;
+  }
+  memset (msgs, 0, s->count * sizeof(msgs[0]));
+  for (i=0; i < s->count; i++) {
+    iov[i].iov_base = s->msg[i];
+    iov[i].iov_len = s->len[i];
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  while (sent < s->count) {
+    n = sendmmsg (s->fd, msgs + sent, s->count - sent, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      // An earlier datagram was refused; that is reported once, so retry
+      if (errno == ECONNREFUSED && !refused++) continue;
+      // EAGAIN: the socket is full; ECONNREFUSED: nothing listening (yet)
+      if (verbosity) fprintf (stderr, "udpSend - %d alerts to %s:%d not sent: %s\n",
+        s->count - sent, s->host, s->port, strerror(errno));
+      break;
+    }
+    sent += n;
+  }
+  if (verbosity >= 2) printf ("Sent %d UDP alerts to %s:%d\n", sent, s->host, s->port);
+  s->count = 0;
+}
+
+// Queues an alert (msg, len bytes) for the UDP server at hostname:portno
+void udpQueue (const char *hostname, int portno, const char *msg, size_t len) {
+  udpsink *s;
+
+  for (s = sinks; s != NULL; s = s->next) {
+    if (s->port == portno && strcmp(s->host, hostname) == 0) break;
+  }
+  if (s == NULL) {
+    s = (udpsink *) malloc (sizeof(udpsink));
+    if (s == NULL) {
+      fputs ("Memory error\n", stderr);
+      exit(2);
+    }
+    strncpy (s->host, hostname, sizeof(s->host) - 1);
+    s->host[sizeof(s->host) - 1] = '\0';
+    s->port = portno;
+    s->fd = -1;
+    s->count = 0;
+    s->next = sinks;
+    sinks = s;
+  }
+  if (s->count == UDP_QUEUE_MAX) udpSend (s);
+  if (len > UDP_MSG_MAX) len = UDP_MSG_MAX;
+  memcpy (s->msg[s->count], msg, len);
+  s->len[s->count] = len;
+  s->count++;
+}
+
+// Sends every queued alert
+void udpFlush (void) {
+  udpsink *s;
+
+  for (s = sinks; s != NULL; s = s->next) udpSend (s);
+}
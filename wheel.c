@@ -0,0 +1,121 @@
+/*
+    Airodump CSV Tools
+    Hierarchical timer wheel.
+    Copyright (C) 2013-2018 Christopher Bolduc
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Timers that go off on a given second, for deadlines like "last seen +
+ * --depart" without looking at every device on every pass.
+ *
+ * Level 0 has a slot for each of the next 64 seconds, level 1 a slot for
+ * each of the next 64 blocks of 64 seconds, and so on.  A timer sits in
+ * the slot for its second at the lowest level that reaches it, and moves
+ * down a level (cascades) when the level below comes round to its block,
+ * so setting, cancelling and firing a timer are all O(1) apart from the
+ * few moves.  The timer is part of whatever it times (see departTimer in
+ * ap and enddev), so nothing is allocated.
+ */
+
+#include "csvtools.h"
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+
+// Puts a timer (t) in its slot, counting from the wheel's time
+static void wheelPlace (timerwheel *w, timer *t) {
+  long long when = t->when;
+  long long delta;
+  timer **slot;
+  int level;
+
+  if (when <= w->now) when = w->now + 1; // due, goes off next second
+  delta = when - w->now;
+  for (level=0; level < WHEEL_LEVELS - 1; level++) {
+    if (delta < (1LL << (WHEEL_BITS * (level + 1)))) break;
+  }
+  // Further away than the wheel reaches: sits in the top level and comes
+  // back round until it is close enough
+  if (level == WHEEL_LEVELS - 1 && delta >= (1LL << (WHEEL_BITS * WHEEL_LEVELS)))
+    when = w->now + (1LL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+  slot = &w->slots[level][(when >> (WHEEL_BITS * level)) & WHEEL_MASK];
+
+  t->next = *slot;
+  if (*slot) (*slot)->pprev = &t->next;
+  t->pprev = slot;
+  *slot = t;
+}
+
+void wheelInit (timerwheel *w, long long now) {
+  memset (w, 0, sizeof(*w));
+  w->now = now;
+}
+
+// Sets a timer (t) to go off at the second when, or moves it there
+void wheelSet (timerwheel *w, timer *t, long long when) {
+  if (t->pprev) wheelCancel (w, t);
+  t->when = when;
+  wheelPlace (w, t);
+  w->count++;
+}
+
+// Stops a timer (t) if it is set
+void wheelCancel (timerwheel *w, timer *t) {
+  if (t->pprev == NULL) return;
+  *t->pprev = t->next;
+  if (t->next) t->next->pprev = t->pprev;
+  t->next = NULL;
+  t->pprev = NULL;
+  w->count--;
+}
+
+// Moves the timers of one slot at a level down to where they go now
+static void wheelCascade (timerwheel *w, int level) {
+  timer **slot = &w->slots[level][(w->now >> (WHEEL_BITS * level)) & WHEEL_MASK];
+  timer *t = *slot, *next;
+
+  *slot = NULL;
+  for (; t != NULL; t = next) {
+    next = t->next;
+    wheelPlace (w, t);
+  }
+}
+
+// Moves the wheel on to the second now, calling fire for each timer that
+// goes off on the way (it may set the timer again)
+// Returns how many went off
+int wheelAdvance (timerwheel *w, long long now, void (*fire)(timer *t, void *arg), void *arg) {
+  timer **slot;
+  timer *t;
+  int level, fired = 0;
+
+  while (w->now < now) {
+    if (w->count == 0) {
+      w->now = now;
+      break;
+    }
+    w->now++;
+    // From the top, so a timer can come down more than one level at once
+    for (level = WHEEL_LEVELS - 1; level > 0; level--) {
+      if ((w->now & ((1LL << (WHEEL_BITS * level)) - 1)) == 0) wheelCascade (w, level);
+    }
+    slot = &w->slots[0][w->now & WHEEL_MASK];
+    while ((t = *slot) != NULL) {
+      wheelCancel (w, t);
+      fire (t, arg);
+      fired++;
+    }
+  }
+  return fired;
+}
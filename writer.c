@@ -0,0 +1,179 @@
+/*
+    Airodump CSV Tools
+    Output files written in the background.
+    Copyright (C) 2013-2018 Christopher Bolduc
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* On a slow SD card, writing a big html file used to hold up the next
+ * --watch pass (and its alerts).  Now the text, csv, html and kml outputs
+ * are printed into memory (outputOpen gives a FILE * for that), and
+ * outputCommit hands them to a writer thread.  The writer writes each one
+ * to [file].tmp and renames it over [file], so nothing ever reads a half
+ * written file.
+ *
+ * While the writer works on one set of files, the next pass prints the
+ * next set.  If a file is committed again before the writer got to it,
+ * only the newer copy is written.
+ */
+
+#include "csvtools.h"
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+
+typedef struct outfile {
+  char name[256];
+  FILE *f;
+  char *buf;
+  size_t len;
+  struct outfile *next;
+} outfile;
+
+static outfile *openFiles; // being printed
+static outfile *pending;   // printed, waiting for the writer
+static pthread_t writer;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static int started, quit;
+
+static void freeOutfile (outfile *o) {
+  memSub (MEM_OUTPUT, o->len);
+  free (o->buf);
+  free (o);
+}
+
+// Writes an output file (o) to [name].tmp, then renames it to [name]
+static void writeOutfile (outfile *o) {
+  char tmpName[sizeof(o->name) + 4];
+  size_t off = 0;
+  ssize_t n;
+  int fd;
+
+  snprintf (tmpName, sizeof(tmpName), "%s.tmp", o->name);
+  fd = open (tmpName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0) {
+    fprintf (stderr, "writeOutfile - Error opening file: %s\n", tmpName);
+    return;
+  }
+  while (off < o->len) {
+    n = write (fd, o->buf + off, o->len - off);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    off += n;
+  }
+  if (close (fd) != 0 || off < o->len) {
+    fprintf (stderr, "writeOutfile - Error writing file: %s\n", tmpName);
+    unlink (tmpName);
+    return;
+  }
+  if (rename (tmpName, o->name) != 0) {
+    fprintf (stderr, "writeOutfile - Error renaming %s to %s\n", tmpName, o->name);
+    unlink (tmpName);
+    return;
+  }
+  __atomic_fetch_add (&counters[COUNTER_BYTES_WRITTEN], o->len, __ATOMIC_RELAXED);
+}
+
+static void *writerMain (void *arg) {
+  outfile *batch, *next;
+
+  pthread_mutex_lock (&lock);
+  for (;;) {
+    while (pending == NULL && !quit) pthread_cond_wait (&changed, &lock);
+    if (pending == NULL) break;
+    batch = pending;
+    pending = NULL;
+    pthread_mutex_unlock (&lock);
+    for (; batch != NULL; batch = next) {
+      next = batch->next;
+      writeOutfile (batch);
+      freeOutfile (batch);
+    }
+    pthread_mutex_lock (&lock);
+  }
+  pthread_mutex_unlock (&lock);
+  return NULL;
+}
+
+// Opens an output file (fileName) that is printed into memory, and written
+// to disk by outputCommit
+FILE *outputOpen (const char *fileName) {
+  outfile *o, **last;
+
+  o = (outfile *) calloc (1, sizeof(outfile));
+  if (o == NULL || (o->f = open_memstream (&o->buf, &o->len)) == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  strncpy (o->name, fileName, sizeof(o->name) - 1);
+  for (last = &openFiles; *last != NULL; last = &(*last)->next);
+  *last = o;
+  return o->f;
+}
+
+// Closes every file opened with outputOpen and hands them to the writer
+// thread.  Doesn't wait for them to be written.
+void outputCommit (void) {
+  outfile *o, *next, **p;
+
+  if (openFiles == NULL) return;
+  for (o = openFiles; o != NULL; o = o->next) {
+    fclose (o->f);
+    memAdd (MEM_OUTPUT, o->len);
+  }
+
+  pthread_mutex_lock (&lock);
+  for (o = openFiles; o != NULL; o = next) {
+    next = o->next;
+    o->next = NULL;
+    // A newer copy replaces one the writer hasn't got to yet
+    for (p = &pending; *p != NULL; p = &(*p)->next) {
+      if (strcmp((*p)->name, o->name) == 0) {
+        outfile *old = *p;
+        o->next = old->next;
+        *p = o;
+        freeOutfile (old);
+        break;
+      }
+    }
+    if (*p == NULL) *p = o;
+  }
+  openFiles = NULL;
+  pthread_cond_signal (&changed);
+  pthread_mutex_unlock (&lock);
+
+  if (!started) {
+    if (pthread_create (&writer, NULL, writerMain, NULL) != 0) {
+      fprintf (stderr, "Error: could not start the writer thread\n");
+      exit(1);
+    }
+    started = 1;
+  }
+}
+
+// Waits for the writer thread to write everything it was given
+void outputFinish (void) {
+  outputCommit ();
+  if (!started) return;
+  pthread_mutex_lock (&lock);
+  quit = 1;
+  pthread_cond_signal (&changed);
+  pthread_mutex_unlock (&lock);
+  pthread_join (writer, NULL);
+  started = quit = 0;
+}
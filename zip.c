@@ -0,0 +1,339 @@
+/*
+    Airodump CSV Tools
+    Minimal zip (KMZ) writer with its own deflate encoder, so we don't
+    need zlib on the Pi.
+    Copyright (C) 2013-2018 Christopher Bolduc
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "csvtools.h"
+
+#define DEFLATE_WSIZE 32768
+#define DEFLATE_WMASK (DEFLATE_WSIZE - 1)
+#define DEFLATE_HBITS 15
+#define DEFLATE_HSIZE (1 << DEFLATE_HBITS)
+#define DEFLATE_MAXCHAIN 32
+#define DEFLATE_MINMATCH 3
+#define DEFLATE_MAXMATCH 258
+
+static unsigned int crcTable[256];
+static int crcTableReady;
+
+static const unsigned short lenBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const unsigned char lenExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const unsigned short distBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const unsigned char distExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// LSB-first bit writer for the deflate stream
+typedef struct bitwriter {
+  unsigned char *buf;
+  size_t len;
+  size_t cap;
+  unsigned int bits;
+  int nbits;
+} bitwriter;
+
+unsigned int crc32Update (unsigned int crc, const unsigned char *buf, size_t len) {
+  size_t i;
+  int k;
+  unsigned int c;
+
+  if (!crcTableReady) {
+    for (i=0; i < 256; i++) {
+      c = (unsigned int) i;
+      for (k=0; k < 8; k++) c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+      crcTable[i] = c;
+    }
+    crcTableReady = 1;
+  }
+  crc = ~crc;
+  for (i=0; i < len; i++) crc = crcTable[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+unsigned int adler32Update (unsigned int adler, const unsigned char *buf, size_t len) {
+  unsigned int a = adler & 0xFFFF;
+  unsigned int b = adler >> 16;
+  size_t i, n;
+
+  while (len > 0) {
+    // 5552 is the largest run that can't overflow b
+    n = len < 5552 ? len : 5552;
+    for (i=0; i < n; i++) {
+      a += buf[i];
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+    buf += n;
+    len -= n;
+  }
+  return (b << 16) | a;
+}
+
+static void bwPut (bitwriter *w, unsigned int value, int n) {
+  w->bits |= value << w->nbits;
+  w->nbits += n;
+  while (w->nbits >= 8) {
+    if (w->len == w->cap) {
+      w->cap *= 2;
+      w->buf = (unsigned char *) realloc(w->buf, w->cap);
+      if (w->buf == NULL) {
+        fputs ("Memory error\n", stderr);
+        exit(2);
+      }
+    }
+    w->buf[w->len++] = w->bits & 0xFF;
+    w->bits >>= 8;
+    w->nbits -= 8;
+  }
+}
+
+// Huffman codes are packed MSB-first, so they have to be reversed
+static void bwPutCode (bitwriter *w, unsigned int code, int n) {
+  unsigned int rev = 0;
+  int i;
+  for (i=0; i < n; i++) {
+    rev = (rev << 1) | (code & 1);
+    code >>= 1;
+  }
+  bwPut (w, rev, n);
+}
+
+// Fixed Huffman literal/length code (RFC 1951 3.2.6)
+static void putLitLen (bitwriter *w, int v) {
+  if (v < 144) bwPutCode (w, 0x30 + v, 8);
+  else if (v < 256) bwPutCode (w, 0x190 + v - 144, 9);
+  else if (v < 280) bwPutCode (w, v - 256, 7);
+  else bwPutCode (w, 0xC0 + v - 280, 8);
+}
+
+static void putMatch (bitwriter *w, int len, int dist) {
+  int i = 28;
+  while (lenBase[i] > len) i--;
+  putLitLen (w, 257 + i);
+  if (lenExtra[i]) bwPut (w, len - lenBase[i], lenExtra[i]);
+  i = 29;
+  while (distBase[i] > dist) i--;
+  bwPutCode (w, i, 5);
+  if (distExtra[i]) bwPut (w, dist - distBase[i], distExtra[i]);
+}
+
+// Raw deflate (one fixed-Huffman block, greedy LZ77 with hash chains)
+// Returned buffer must be freed
+unsigned char *deflateBuffer (const unsigned char *in, size_t len, size_t *outLen) {
+  bitwriter w;
+  int *head, *prev;
+  size_t i;
+  unsigned int h;
+  int chain, bestLen, bestDist, l;
+  long cand, maxLen;
+
+  w.cap = len / 2 + 64;
+  w.buf = (unsigned char *) malloc(w.cap);
+  head = (int *) malloc(DEFLATE_HSIZE * sizeof(int));
+  prev = (int *) malloc(DEFLATE_WSIZE * sizeof(int));
+  if (w.buf == NULL || head == NULL || prev == NULL) {
+    fputs ("Memory error\n", stderr);
+    exit(2);
+  }
+  w.len = 0;
+  w.bits = 0;
+  w.nbits = 0;
+  memset (head, 0xFF, DEFLATE_HSIZE * sizeof(int));
+
+  bwPut (&w, 1, 1); // BFINAL
+  bwPut (&w, 1, 2); // BTYPE = fixed Huffman
+
+  i = 0;
+  while (i < len) {
+    bestLen = 0;
+    bestDist = 0;
+    if (i + DEFLATE_MINMATCH <= len) {
+      h = ((in[i] << 10) ^ (in[i+1] << 5) ^ in[i+2]) & (DEFLATE_HSIZE - 1);
+      cand = head[h];
+      maxLen = len - i < DEFLATE_MAXMATCH ? (long) (len - i) : DEFLATE_MAXMATCH;
+      chain = DEFLATE_MAXCHAIN;
+      while (cand >= 0 && (long) i - cand <= DEFLATE_WSIZE - 1 && chain-- > 0) {
+        l = 0;
+        while (l < maxLen && in[cand + l] == in[i + l]) l++;
+        if (l > bestLen) {
+          bestLen = l;
+          bestDist = (int) (i - cand);
+          if (l == maxLen) break;
+        }
+        cand = prev[cand & DEFLATE_WMASK];
+      }
+      prev[i & DEFLATE_WMASK] = head[h];
+      head[h] = (int) i;
+    }
+    if (bestLen >= DEFLATE_MINMATCH) {
+      putMatch (&w, bestLen, bestDist);
+      // Keep the hash chains up to date for the bytes we skipped over
+      for (l=1; l < bestLen; l++) {
+        i++;
+        if (i + DEFLATE_MINMATCH <= len) {
+          h = ((in[i] << 10) ^ (in[i+1] << 5) ^ in[i+2]) & (DEFLATE_HSIZE - 1);
+          prev[i & DEFLATE_WMASK] = head[h];
+          head[h] = (int) i;
+        }
+      }
+      i++;
+    } else {
+      putLitLen (&w, in[i]);
+      i++;
+    }
+  }
+  putLitLen (&w, 256); // end of block
+  if (w.nbits > 0) bwPut (&w, 0, 8 - w.nbits);
+
+  free (head);
+  free (prev);
+  *outLen = w.len;
+  return w.buf;
+}
+
+static void putLE16 (FILE *f, unsigned int v) {
+  fputc (v & 0xFF, f);
+  fputc ((v >> 8) & 0xFF, f);
+}
+
+static void putLE32 (FILE *f, unsigned int v) {
+  putLE16 (f, v & 0xFFFF);
+  putLE16 (f, v >> 16);
+}
+
+zipfile *zipOpen (const char *fileName) {
+  zipfile *z;
+  time_t timer;
+  struct tm tm_buf, *tm_info;
+
+  z = (zipfile *) malloc(sizeof(zipfile));
+  if (z == NULL) return NULL;
+  z->f = fopen(fileName, "wb");
+  if (z->f == NULL) {
+    free(z);
+    return NULL;
+  }
+  z->offset = 0;
+  z->first = z->last = NULL;
+  z->count = 0;
+
+  // MS-DOS date and time stamps for the entries
+  time(&timer);
+  tm_info = localtime_r(&timer, &tm_buf);
+  z->dosTime = (tm_info->tm_hour << 11) | (tm_info->tm_min << 5) | (tm_info->tm_sec / 2);
+  z->dosDate = ((tm_info->tm_year - 80) << 9) | ((tm_info->tm_mon + 1) << 5) | tm_info->tm_mday;
+  return z;
+}
+
+// Adds a file (name) with the given contents to the archive
+// Data is deflated unless that would make it bigger
+int zipAdd (zipfile *z, const char *name, const char *data, size_t len) {
+  zipentry *ze;
+  unsigned char *packed;
+  size_t packedLen;
+  int method = 8;
+
+  ze = (zipentry *) malloc(sizeof(zipentry));
+  if (ze == NULL) return -1;
+  strncpy (ze->name, name, sizeof(ze->name) - 1);
+  ze->name[sizeof(ze->name) - 1] = '\0';
+  ze->crc = crc32Update (0, (const unsigned char *) data, len);
+  ze->size = (unsigned int) len;
+  ze->offset = z->offset;
+  ze->next = NULL;
+
+  packed = deflateBuffer ((const unsigned char *) data, len, &packedLen);
+  if (packedLen >= len) {
+    method = 0;
+    packedLen = len;
+  }
+  ze->method = method;
+  ze->csize = (unsigned int) packedLen;
+
+  putLE32 (z->f, 0x04034b50);
+  putLE16 (z->f, 20);
+  putLE16 (z->f, 0);
+  putLE16 (z->f, method);
+  putLE16 (z->f, z->dosTime);
+  putLE16 (z->f, z->dosDate);
+  putLE32 (z->f, ze->crc);
+  putLE32 (z->f, ze->csize);
+  putLE32 (z->f, ze->size);
+  putLE16 (z->f, strlen(ze->name));
+  putLE16 (z->f, 0);
+  fputs (ze->name, z->f);
+  fwrite (method ? (const char *) packed : data, 1, packedLen, z->f);
+  free (packed);
+  z->offset += 30 + strlen(ze->name) + packedLen;
+
+  if (z->last) z->last->next = ze;
+  else z->first = ze;
+  z->last = ze;
+  z->count++;
+  return ferror(z->f) ? -1 : 0;
+}
+
+// Writes the central directory and closes the archive
+int zipClose (zipfile *z) {
+  zipentry *ze, *next;
+  unsigned int cdStart = z->offset;
+  unsigned int cdSize = 0;
+  int result;
+
+  for (ze = z->first; ze != NULL; ze = ze->next) {
+    putLE32 (z->f, 0x02014b50);
+    putLE16 (z->f, 20);
+    putLE16 (z->f, 20);
+    putLE16 (z->f, 0);
+    putLE16 (z->f, ze->method);
+    putLE16 (z->f, z->dosTime);
+    putLE16 (z->f, z->dosDate);
+    putLE32 (z->f, ze->crc);
+    putLE32 (z->f, ze->csize);
+    putLE32 (z->f, ze->size);
+    putLE16 (z->f, strlen(ze->name));
+    putLE16 (z->f, 0);
+    putLE16 (z->f, 0);
+    putLE16 (z->f, 0);
+    putLE16 (z->f, 0);
+    putLE32 (z->f, 0);
+    putLE32 (z->f, ze->offset);
+    fputs (ze->name, z->f);
+    cdSize += 46 + strlen(ze->name);
+  }
+  putLE32 (z->f, 0x06054b50);
+  putLE16 (z->f, 0);
+  putLE16 (z->f, 0);
+  putLE16 (z->f, z->count);
+  putLE16 (z->f, z->count);
+  putLE32 (z->f, cdSize);
+  putLE32 (z->f, cdStart);
+  putLE16 (z->f, 0);
+
+  result = ferror(z->f);
+  fclose (z->f);
+  for (ze = z->first; ze != NULL; ze = next) {
+    next = ze->next;
+    free (ze);
+  }
+  free (z);
+  return result ? -1 : 0;
+}